@@ -22,6 +22,8 @@
 #include "pico/stdlib.h"
 #include "hardware/spi.h"
 #include "winc_wifi.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
 
 #define VERBOSE     1           // Diagnostic output level (0 to 3)
 #define SPI_SPEED   11000000    // SPI clock (actually 10.42 MHz)
@@ -74,20 +76,29 @@ uint32_t usec(void)
 // Do SPI transfer
 int spi_xfer(int fd, uint8_t *txd, uint8_t *rxd, int len)
 {
+    STATS_INC(spi.xfers);
+    STATS_ADD(spi.bytes, len);
+    TRACE_BEGIN(TR_SPI_XFER, len);
     if (verbose > 2)
     {
         printf("  Tx:");
         for (int i=0; i<len; i++)
-            printf(" %02X", txd[i]);
+            printf(" %02X", txd ? txd[i] : 0);
     }
     gpio_put(CS_PIN, 0);
-    spi_write_read_blocking(SPI_PORT, txd, rxd, len);
+    if (!txd)
+        spi_read_blocking(SPI_PORT, 0, rxd, len);
+    else if (!rxd)
+        spi_write_blocking(SPI_PORT, txd, len);
+    else
+        spi_write_read_blocking(SPI_PORT, txd, rxd, len);
     while (gpio_get(SCK_PIN)) ;
     gpio_put(CS_PIN, 1);
+    TRACE_END(TR_SPI_XFER, len);
     if (verbose > 2)
     {
         printf("\n  Rx:");
-        for (int i=0; i<len; i++)
+        for (int i=0; rxd && i<len; i++)
             printf(" %02X", rxd[i]);
         printf("\n");
     }
@@ -0,0 +1,49 @@
+// Pico platform functions for the driver, connected to the chip emulator
+//
+// Used by host programs that run the driver against winc_emu.c in place of
+// the functions in winc_pico_part2.c. Time is the emulator's virtual time,
+// and each timer or IRQ line read takes a poll time, so the driver's delay
+// and polling loops advance it as they would on the board.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_emu.h"
+
+// Return microsecond time
+uint32_t time_us_32(void)
+{
+    emu_advance(emu_params.poll_ns);
+    return((uint32_t)(emu_time_ns() / 1000));
+}
+
+uint32_t usec(void)
+{
+    return(time_us_32());
+}
+
+// Do SPI transfer
+int spi_xfer(int fd, uint8_t *txd, uint8_t *rxd, int len)
+{
+    STATS_INC(spi.xfers);
+    STATS_ADD(spi.bytes, len);
+    return(emu_xfer(txd, rxd, len));
+}
+
+// Read IRQ line
+int read_irq(void)
+{
+    return(emu_irq());
+}
+
+// Reset the emulated chip
+void spi_setup(int fd)
+{
+    emu_reset();
+}
+
+// EOF
@@ -0,0 +1,27 @@
+// Host replacement for the Pico SDK SPI header, for the replay harness
+
+#ifndef HARDWARE_SPI_H
+#define HARDWARE_SPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+typedef struct spi_inst spi_inst_t;
+
+#define spi0                ((spi_inst_t *)0)
+#define spi1                ((spi_inst_t *)1)
+
+#define SPI_CPOL_0          0
+#define SPI_CPHA_0          0
+#define SPI_MSB_FIRST       1
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+void spi_set_format(spi_inst_t *spi, uint data_bits, uint cpol, uint cpha, uint order);
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+#endif // HARDWARE_SPI_H
+
+// EOF
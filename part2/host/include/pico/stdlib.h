@@ -0,0 +1,36 @@
+// Host replacement for the Pico SDK standard header, for the host builds
+//
+// Only the functions used by the driver and applications are declared. The
+// mesh simulator nodes supply the timer from the simulator's virtual clock,
+// and the replay harness supplies all of them from a captured log
+
+#ifndef PICO_STDLIB_H
+#define PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef unsigned int uint;
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+#define GPIO_IN             0
+#define GPIO_OUT            1
+#define GPIO_FUNC_SPI       1
+#define GPIO_FUNC_SIO       5
+#define GPIO_IRQ_EDGE_FALL  4
+
+uint32_t time_us_32(void);
+void sleep_ms(uint32_t ms);
+bool stdio_init_all(void);
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, uint fn);
+void gpio_pull_up(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled,
+                                        gpio_irq_callback_t callback);
+
+#endif // PICO_STDLIB_H
+
+// EOF
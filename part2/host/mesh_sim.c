@@ -0,0 +1,638 @@
+// Discrete-event simulator for the ATWINC1500 mesh code, running on Linux
+//
+// Runs N copies of winc_p2p.c over a virtual radio with configurable topology,
+// loss and latency, in virtual time, and reports route convergence time,
+// control overhead, delivery ratio, end-to-end latency and time sync error.
+//
+// The radio model is simple: each link has a loss probability and latency,
+// with random jitter, plus transmission time at a fixed bit rate. There are
+// no collisions, and no limit on the number of frames in flight.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_p2p.h"
+#include "winc_stats.h"
+#include "sim_node.h"
+
+#define MAX_NODES       MESH_MAX_NODES
+#define SIM_PORT        UDP_PORTNUM
+#define DATA_MAGIC      0x4d534944
+
+// Event types
+#define EV_START        0
+#define EV_POLL         1
+#define EV_RX           2
+#define EV_TRAFFIC      3
+#define EV_CHECK        4
+
+// Simulation parameters
+typedef struct {
+    int nodes;
+    char *topo;            // line, ring, grid, random, or file name
+    double range;          // Radio range for random topology, fraction of area
+    double loss;           // Frame loss probability
+    uint32_t latency;      // Link latency (us)
+    uint32_t jitter;       // Maximum extra random latency (us)
+    double bitrate;        // Link bit rate (Mbit/s)
+    double duration;       // Simulated time (s)
+    double warmup;         // Time before traffic starts (s)
+    double start_spread;   // Nodes start at random times up to this (s)
+    double rate;           // Data packets per second, per node
+    int size;              // Data packet size
+    int route_hops;        // Routes expected to nodes up to this many hops away
+    uint32_t poll_us;      // Interval between calls to mesh_beacon_handler
+    int clock_ppm;         // Maximum node clock drift (ppm)
+    unsigned seed;
+    int verbose;
+    bool csv;
+} SIM_PARAMS;
+
+// Link between two nodes
+typedef struct {
+    bool up;
+    double loss;
+    uint32_t latency;
+} SIM_LINK;
+
+// Simulated node
+typedef struct {
+    void *lib;
+    SIM_NODE_API *api;
+    bool started;
+    double x, y;
+} SIM_NODE;
+
+// Event, in priority queue ordered by time
+typedef struct {
+    uint64_t time;
+    int type, node;
+    uint32_t src_ip;
+    int len;
+    uint8_t *data;
+} SIM_EVENT;
+
+// Data packet payload, padded to requested size
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t sent;
+} SIM_DATA;
+
+// Results
+typedef struct {
+    uint64_t ctrl_pkts, ctrl_bytes, data_pkts, data_bytes;
+    uint64_t lost, no_link;
+    uint32_t sent, refused, limited, delivered, dups;
+    int64_t converged;
+    int pairs, routed, beyond;
+} SIM_STATS;
+
+static SIM_PARAMS params = {
+    .nodes=16, .topo="grid", .range=0.3, .loss=0.0, .latency=500, .jitter=200,
+    .bitrate=6.0, .duration=120, .warmup=30, .start_spread=1.0, .rate=1.0,
+    .size=64, .route_hops=MESH_MAX_HOPS, .poll_us=1000, .clock_ppm=50, .seed=1
+};
+static SIM_NODE nodes[MAX_NODES + 1];
+static SIM_LINK links[MAX_NODES + 1][MAX_NODES + 1];
+static uint8_t hops[MAX_NODES + 1][MAX_NODES + 1];
+static SIM_EVENT *events;
+static int nevents, maxevents;
+static uint64_t sim_time;
+static SIM_STATS stats = {.converged = -1};
+static uint8_t *delivered;
+static uint32_t *latencies;
+static uint64_t rng_state;
+
+// Random number generator (xorshift64*), repeatable for a given seed
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+// Add event to queue
+static void ev_add(uint64_t time, int type, int node, uint32_t src_ip, uint8_t *data, int len)
+{
+    SIM_EVENT ev = {time, type, node, src_ip, len, NULL};
+    int i, parent;
+
+    if (nevents >= maxevents)
+    {
+        maxevents = maxevents ? maxevents * 2 : 1024;
+        events = realloc(events, maxevents * sizeof(SIM_EVENT));
+    }
+    if (data)
+    {
+        ev.data = malloc(len);
+        memcpy(ev.data, data, len);
+    }
+    for (i = nevents++; i > 0; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (events[parent].time <= time)
+            break;
+        events[i] = events[parent];
+    }
+    events[i] = ev;
+}
+
+// Remove earliest event from queue
+static bool ev_get(SIM_EVENT *evp)
+{
+    SIM_EVENT last;
+    int i, child;
+
+    if (nevents == 0)
+        return false;
+    *evp = events[0];
+    last = events[--nevents];
+    for (i = 0; (child = 2*i + 1) < nevents; i = child)
+    {
+        if (child + 1 < nevents && events[child + 1].time < events[child].time)
+            child++;
+        if (last.time <= events[child].time)
+            break;
+        events[i] = events[child];
+    }
+    events[i] = last;
+    return true;
+}
+
+// Virtual time, for nodes
+static uint64_t host_now(void)
+{
+    return sim_time;
+}
+
+// Schedule a frame for one receiving node, if not lost
+static void radio_tx(int from, int to, uint8_t *data, int len)
+{
+    SIM_LINK *lp = &links[from][to];
+    uint64_t t;
+
+    if (!nodes[to].started)
+        return;
+    if (rnd() < lp->loss)
+    {
+        stats.lost++;
+        return;
+    }
+    t = sim_time + lp->latency + (uint64_t)(rnd() * params.jitter) +
+        (uint64_t)(len * 8 / params.bitrate);
+    ev_add(t, EV_RX, to, SIM_NODE_IP(from), data, len);
+}
+
+// Datagram sent by a node: count it, then pass to neighbors
+static void host_send(int node, uint32_t ip, uint16_t port, uint8_t *data, int len)
+{
+    MESH_PKT_HDR *hp = (MESH_PKT_HDR *)data;
+    int n, to = SIM_IP_NODE(ip);
+
+    if (hp->msg_type == MESH_MSG_DATA || hp->msg_type == MESH_MSG_FRAG ||
+        hp->msg_type == MESH_MSG_PUBLISH)
+    {
+        stats.data_pkts++;
+        stats.data_bytes += len;
+    }
+    else
+    {
+        stats.ctrl_pkts++;
+        stats.ctrl_bytes += len;
+    }
+    if (ip == SIM_BCAST_IP)
+    {
+        for (n = 1; n <= params.nodes; n++)
+        {
+            if (links[node][n].up)
+                radio_tx(node, n, data, len);
+        }
+    }
+    else if (to >= 1 && to <= params.nodes && links[node][to].up)
+        radio_tx(node, to, data, len);
+    else
+        stats.no_link++;
+}
+
+// Data delivered to a node: check for duplicates, and get latency
+static void host_deliver(int node, uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    SIM_DATA *dp = (SIM_DATA *)data;
+
+    if (len < sizeof(SIM_DATA) || dp->magic != DATA_MAGIC || dp->seq >= stats.sent)
+        return;
+    if (delivered[dp->seq])
+    {
+        stats.dups++;
+        return;
+    }
+    delivered[dp->seq] = 1;
+    latencies[stats.delivered++] = (uint32_t)(sim_time - dp->sent);
+}
+
+static SIM_HOST host = {host_now, host_send, host_deliver};
+
+// Load a separate copy of the node library for each node
+static bool load_nodes(char *libpath)
+{
+    char tmp[] = "/tmp/mesh_simXXXXXX", cmd[300];
+    int n, fd;
+
+    for (n = 1; n <= params.nodes; n++)
+    {
+        strcpy(tmp, "/tmp/mesh_simXXXXXX");
+        if ((fd = mkstemp(tmp)) < 0)
+            return false;
+        close(fd);
+        snprintf(cmd, sizeof(cmd), "cp '%s' '%s'", libpath, tmp);
+        if (system(cmd) != 0)
+            return false;
+        nodes[n].lib = dlopen(tmp, RTLD_NOW | RTLD_LOCAL);
+        unlink(tmp);
+        if (!nodes[n].lib)
+        {
+            printf("Can't load node: %s\n", dlerror());
+            return false;
+        }
+        nodes[n].api = ((SIM_NODE_API_FN)dlsym(nodes[n].lib, SIM_NODE_API_NAME))();
+    }
+    return true;
+}
+
+// Add link between two nodes, in both directions
+static void add_link(int a, int b, double loss, uint32_t latency)
+{
+    if (a < 1 || b < 1 || a > params.nodes || b > params.nodes || a == b)
+        return;
+    links[a][b].up = links[b][a].up = true;
+    links[a][b].loss = links[b][a].loss = loss;
+    links[a][b].latency = links[b][a].latency = latency;
+}
+
+// Create topology
+static bool make_topology(void)
+{
+    int a, b, cols = (int)ceil(sqrt(params.nodes));
+    double loss, dx, dy;
+    unsigned latency;
+    char line[100];
+    FILE *fp;
+
+    if (!strcmp(params.topo, "line") || !strcmp(params.topo, "ring"))
+    {
+        for (a = 1; a < params.nodes; a++)
+            add_link(a, a + 1, params.loss, params.latency);
+        if (!strcmp(params.topo, "ring"))
+            add_link(params.nodes, 1, params.loss, params.latency);
+    }
+    else if (!strcmp(params.topo, "grid"))
+    {
+        for (a = 1; a <= params.nodes; a++)
+        {
+            if ((a - 1) % cols != cols - 1)
+                add_link(a, a + 1, params.loss, params.latency);
+            add_link(a, a + cols, params.loss, params.latency);
+        }
+    }
+    else if (!strcmp(params.topo, "random"))
+    {
+        for (a = 1; a <= params.nodes; a++)
+        {
+            nodes[a].x = rnd();
+            nodes[a].y = rnd();
+        }
+        for (a = 1; a <= params.nodes; a++)
+        {
+            for (b = a + 1; b <= params.nodes; b++)
+            {
+                dx = nodes[a].x - nodes[b].x;
+                dy = nodes[a].y - nodes[b].y;
+                if (sqrt(dx*dx + dy*dy) < params.range)
+                    add_link(a, b, params.loss, params.latency);
+            }
+        }
+    }
+    else if ((fp = fopen(params.topo, "r")) != NULL)
+    {
+        // Lines of: node node [loss [latency_us]]
+        while (fgets(line, sizeof(line), fp))
+        {
+            loss = params.loss;
+            latency = params.latency;
+            if (line[0] != '#' && sscanf(line, "%d %d %lf %u", &a, &b, &loss, &latency) >= 2)
+                add_link(a, b, loss, latency);
+        }
+        fclose(fp);
+    }
+    else
+    {
+        printf("Unknown topology '%s'\n", params.topo);
+        return false;
+    }
+    return true;
+}
+
+// Get hop counts between all nodes (Floyd-Warshall)
+static void get_hops(void)
+{
+    int a, b, c;
+
+    for (a = 1; a <= params.nodes; a++)
+    {
+        for (b = 1; b <= params.nodes; b++)
+            hops[a][b] = a == b ? 0 : links[a][b].up ? 1 : 0xff;
+    }
+    for (c = 1; c <= params.nodes; c++)
+    {
+        for (a = 1; a <= params.nodes; a++)
+        {
+            for (b = 1; b <= params.nodes; b++)
+            {
+                if (hops[a][c] + hops[c][b] < hops[a][b])
+                    hops[a][b] = hops[a][c] + hops[c][b];
+            }
+        }
+    }
+}
+
+// Count node pairs within routing range, those with routes, and connected
+// pairs further apart than the range
+static void check_routes(void)
+{
+    int a, b;
+
+    stats.pairs = stats.routed = stats.beyond = 0;
+    for (a = 1; a <= params.nodes; a++)
+    {
+        for (b = 1; b <= params.nodes; b++)
+        {
+            if (a != b && hops[a][b] <= params.route_hops)
+            {
+                stats.pairs++;
+                stats.routed += nodes[a].started && nodes[a].api->has_route(b);
+            }
+            else if (a != b && hops[a][b] != 0xff)
+                stats.beyond++;
+        }
+    }
+    if (stats.converged < 0 && stats.pairs && stats.routed == stats.pairs)
+        stats.converged = sim_time;
+}
+
+// Send a data packet from a node to a random destination within range
+static void send_data(int node)
+{
+    uint8_t buff[MESH_MAX_PAYLOAD];
+    SIM_DATA *dp = (SIM_DATA *)buff;
+    MESH_SEND_RESULT res;
+    int dst, n, count = 0;
+
+    for (n = 1; n <= params.nodes; n++)
+        count += n != node && hops[node][n] <= params.route_hops;
+    if (count == 0)
+        return;
+    count = (int)(rnd() * count);
+    for (dst = 1; dst <= params.nodes; dst++)
+    {
+        if (dst != node && hops[node][dst] <= params.route_hops && count-- == 0)
+            break;
+    }
+    memset(buff, 0, params.size);
+    dp->magic = DATA_MAGIC;
+    dp->seq = stats.sent;
+    dp->sent = sim_time;
+    res = nodes[node].api->send(dst, buff, params.size);
+    if (res == MESH_SEND_OK)
+    {
+        delivered = realloc(delivered, stats.sent + 1);
+        latencies = realloc(latencies, (stats.sent + 1) * sizeof(uint32_t));
+        delivered[stats.sent++] = 0;
+    }
+    else if (res == MESH_SEND_RATE_LIMITED)
+        stats.limited++;
+    else
+        stats.refused++;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(uint32_t *)a, y = *(uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Print results, return false if any pair within range has no route
+static bool report(void)
+{
+    double secs = params.duration, mean = 0, sync_sum = 0, sync_max = 0, err;
+    uint32_t p50 = 0, p99 = 0, lmax = 0, root_time = 0;
+    uint32_t forwarded = 0, dropped = 0, duplicates = 0, ce_marked = 0;
+    int n, root = 0, nsynced = 0;
+
+    if (stats.delivered)
+    {
+        qsort(latencies, stats.delivered, sizeof(uint32_t), cmp_u32);
+        for (n = 0; n < (int)stats.delivered; n++)
+            mean += latencies[n];
+        mean /= stats.delivered;
+        p50 = latencies[stats.delivered / 2];
+        p99 = latencies[stats.delivered * 99 / 100];
+        lmax = latencies[stats.delivered - 1];
+    }
+
+    // Totals of the nodes' own counters
+    for (n = 1; n <= params.nodes; n++)
+    {
+        MESH_STATS *msp = nodes[n].started ? nodes[n].api->mesh_stats() : NULL;
+
+        if (msp)
+        {
+            forwarded += msp->forwarded;
+            dropped += msp->dropped;
+            duplicates += msp->duplicates;
+            ce_marked += msp->ce_marked;
+        }
+    }
+
+    // Sync error against the local clock of lowest node ID, for nodes in its partition
+    for (n = 1; n <= params.nodes && !root; n++)
+        root = nodes[n].started ? n : 0;
+    if (root)
+        root_time = nodes[root].api->local_time();
+    for (n = 1; n <= params.nodes; n++)
+    {
+        if (n != root && hops[root][n] != 0xff && nodes[n].api->synced())
+        {
+            err = fabs((double)(int32_t)(nodes[n].api->mesh_time() - root_time));
+            sync_sum += err;
+            sync_max = err > sync_max ? err : sync_max;
+            nsynced++;
+        }
+    }
+
+    if (params.csv)
+    {
+        printf("nodes,topo,loss,converged_s,pairs,routed,beyond,ctrl_pkts,ctrl_bytes,data_pkts,"
+               "data_bytes,sent,refused,delivered,dups,lat_mean_us,lat_p50_us,lat_p99_us,"
+               "lat_max_us,synced,sync_mean_us,sync_max_us,forwarded,dropped,duplicates,ce_marked,"
+               "limited\n");
+        printf("%d,%s,%.3f,%.3f,%d,%d,%d,%llu,%llu,%llu,%llu,%u,%u,%u,%u,%.0f,%u,%u,%u,%d,%.0f,%.0f,"
+               "%u,%u,%u,%u,%u\n",
+               params.nodes, params.topo, params.loss,
+               stats.converged < 0 ? -1.0 : stats.converged / 1e6, stats.pairs, stats.routed, stats.beyond,
+               (unsigned long long)stats.ctrl_pkts, (unsigned long long)stats.ctrl_bytes,
+               (unsigned long long)stats.data_pkts, (unsigned long long)stats.data_bytes,
+               stats.sent, stats.refused, stats.delivered, stats.dups, mean, p50, p99, lmax,
+               nsynced, nsynced ? sync_sum / nsynced : 0, sync_max,
+               forwarded, dropped, duplicates, ce_marked, stats.limited);
+        return stats.routed == stats.pairs;
+    }
+    printf("Nodes %d, topology %s, loss %.3f, %.1f s simulated\n",
+           params.nodes, params.topo, params.loss, secs);
+    if (stats.converged < 0)
+        printf("Convergence: not converged\n");
+    else
+        printf("Convergence: %.3f s\n", stats.converged / 1e6);
+    printf("Routes:      %d of %d pairs within %d hops%s\n", stats.routed, stats.pairs,
+           params.route_hops, stats.routed < stats.pairs ? ", FAILED: some unreachable" : "");
+    if (stats.beyond)
+        printf("             %d connected pairs more than %d hops apart not checked\n",
+               stats.beyond, params.route_hops);
+    printf("Control:     %llu packets, %llu bytes, %.1f bytes/s per node, %.1f%% of bytes\n",
+           (unsigned long long)stats.ctrl_pkts, (unsigned long long)stats.ctrl_bytes,
+           stats.ctrl_bytes / secs / params.nodes,
+           100.0 * stats.ctrl_bytes / (stats.ctrl_bytes + stats.data_bytes + 1e-9));
+    printf("Data:        %llu packets, %llu bytes on air\n",
+           (unsigned long long)stats.data_pkts, (unsigned long long)stats.data_bytes);
+    printf("Radio:       %llu frames lost, %llu unicasts with no link\n",
+           (unsigned long long)stats.lost, (unsigned long long)stats.no_link);
+    printf("Delivery:    %u sent, %u refused, %u rate limited, %u delivered (%.1f%%), "
+           "%u duplicates\n", stats.sent, stats.refused, stats.limited, stats.delivered,
+           stats.sent ? 100.0 * stats.delivered / stats.sent : 0, stats.dups);
+    printf("Nodes:       %u forwarded, %u dropped, %u duplicates, %u congestion marked\n",
+           forwarded, dropped, duplicates, ce_marked);
+    printf("Latency:     mean %.0f us, p50 %u us, p99 %u us, max %u us\n", mean, p50, p99, lmax);
+    printf("Time sync:   %d of %d nodes synced to node %d, error mean %.0f us, max %.0f us\n",
+           nsynced, params.nodes - 1, root, nsynced ? sync_sum / nsynced : 0, sync_max);
+    return stats.routed == stats.pairs;
+}
+
+static void usage(void)
+{
+    printf("Usage: mesh_sim [options]\n"
+           "  -n nodes     Number of nodes (max %d)\n"
+           "  -t topology  line, ring, grid, random, or file of 'node node [loss [latency]]'\n"
+           "  -r range     Radio range for random topology (0-1)\n"
+           "  -l loss      Frame loss probability\n"
+           "  -L latency   Link latency (us)\n"
+           "  -j jitter    Maximum random extra latency (us)\n"
+           "  -b rate      Link bit rate (Mbit/s)\n"
+           "  -d secs      Simulated time\n"
+           "  -w secs      Warmup time before sending data\n"
+           "  -p rate      Data packets per second per node\n"
+           "  -s size      Data packet size\n"
+           "  -h hops      Hop range in which routes are expected (default %d)\n"
+           "  -c ppm       Maximum node clock drift\n"
+           "  -S seed      Random seed\n"
+           "  -v           Verbose node output (repeat for more)\n"
+           "  -C           Print results as CSV\n", MAX_NODES, MESH_MAX_HOPS);
+}
+
+int main(int argc, char *argv[])
+{
+    char *libpath = SIM_NODE_LIB;
+    SIM_EVENT ev;
+    uint64_t end;
+    int n, opt;
+
+    while ((opt = getopt(argc, argv, "n:t:r:l:L:j:b:d:w:p:s:h:c:S:vC")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': params.nodes = atoi(optarg);          break;
+        case 't': params.topo = optarg;                 break;
+        case 'r': params.range = atof(optarg);          break;
+        case 'l': params.loss = atof(optarg);           break;
+        case 'L': params.latency = atoi(optarg);        break;
+        case 'j': params.jitter = atoi(optarg);         break;
+        case 'b': params.bitrate = atof(optarg);        break;
+        case 'd': params.duration = atof(optarg);       break;
+        case 'w': params.warmup = atof(optarg);         break;
+        case 'p': params.rate = atof(optarg);           break;
+        case 's': params.size = atoi(optarg);           break;
+        case 'h': params.route_hops = atoi(optarg);     break;
+        case 'c': params.clock_ppm = atoi(optarg);      break;
+        case 'S': params.seed = atoi(optarg);           break;
+        case 'v': params.verbose++;                     break;
+        case 'C': params.csv = true;                    break;
+        default:  usage();                              return 1;
+        }
+    }
+    if (params.nodes < 2 || params.nodes > MAX_NODES ||
+        params.size < (int)sizeof(SIM_DATA) || params.size > MESH_MAX_PAYLOAD)
+    {
+        usage();
+        return 1;
+    }
+    rng_state = params.seed * 0x9E3779B97F4A7C15ULL + 1;
+    if (!make_topology() || !load_nodes(libpath))
+        return 1;
+    get_hops();
+
+    // Nodes start at random times, with random clock offset and drift
+    for (n = 1; n <= params.nodes; n++)
+        ev_add((uint64_t)(rnd() * params.start_spread * 1e6), EV_START, n, 0, NULL, 0);
+    ev_add(100000, EV_CHECK, 0, 0, NULL, 0);
+
+    end = (uint64_t)(params.duration * 1e6);
+    while (ev_get(&ev) && ev.time <= end)
+    {
+        sim_time = ev.time;
+        switch (ev.type)
+        {
+        case EV_START:
+            nodes[ev.node].started = true;
+            if (!nodes[ev.node].api->init(&host, ev.node, SIM_PORT, (int32_t)(rnd() * 1e9),
+                    (int32_t)((rnd() * 2 - 1) * params.clock_ppm), params.verbose))
+            {
+                printf("Node %d failed to start\n", ev.node);
+                return 1;
+            }
+            ev_add(sim_time + params.poll_us, EV_POLL, ev.node, 0, NULL, 0);
+            if (params.rate > 0)
+                ev_add((uint64_t)(params.warmup * 1e6 + rnd() * 1e6 / params.rate),
+                       EV_TRAFFIC, ev.node, 0, NULL, 0);
+            break;
+        case EV_POLL:
+            nodes[ev.node].api->poll();
+            ev_add(sim_time + params.poll_us, EV_POLL, ev.node, 0, NULL, 0);
+            break;
+        case EV_RX:
+            nodes[ev.node].api->rx(ev.src_ip, SIM_PORT, ev.data, ev.len);
+            break;
+        case EV_TRAFFIC:
+            send_data(ev.node);
+            ev_add(sim_time + (uint64_t)(1e6 / params.rate), EV_TRAFFIC, ev.node, 0, NULL, 0);
+            break;
+        case EV_CHECK:
+            check_routes();
+            ev_add(sim_time + 100000, EV_CHECK, 0, 0, NULL, 0);
+            break;
+        }
+        free(ev.data);
+    }
+    sim_time = end;
+    check_routes();
+    return report() ? 0 : 2;
+}
+
+// EOF
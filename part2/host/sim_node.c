@@ -0,0 +1,208 @@
+// Mesh simulator node: replacement socket layer for winc_p2p.c
+//
+// Linked with winc_p2p.c into a shared library; the simulator loads one copy
+// per node. Datagrams from the mesh socket go to the simulator's radio model,
+// and those it delivers are passed to the socket handler as if received by
+// the WINC1500. Commands to the module (P2P enable, listen) always succeed.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_p2p.h"
+#include "winc_stats.h"
+#include "sim_node.h"
+
+int verbose, spi_fd;
+SOCKET sockets[MAX_SOCKETS];
+
+static SIM_HOST *host;
+static uint8_t node_id;
+static uint16_t node_port;
+static int32_t clock_offset, clock_ppm;
+static uint8_t *rx_data;
+static int rx_len;
+
+// Local clock, with this node's offset and drift from virtual time
+uint32_t time_us_32(void)
+{
+    uint64_t t = host->now();
+
+    return (uint32_t)(t + clock_offset + (int64_t)t * clock_ppm / 1000000);
+}
+
+// Microsecond time, as provided by the platform code
+uint32_t usec(void)
+{
+    return(time_us_32());
+}
+
+// Check for microsecond timeout
+bool ustimeout(uint32_t *tp, uint32_t tout)
+{
+    bool ret=1;
+    uint32_t t = time_us_32();
+
+    if (tout == 0)
+        *tp = t;
+    else if (t >= *tp + tout)
+        *tp += tout;
+    else
+        ret = 0;
+    return(ret);
+}
+
+// Display data in hex
+void dump_hex(uint8_t *data, int dlen, int ncols, char *indent)
+{
+    int i;
+
+    printf("%s", indent);
+    for (i=0; i<dlen; i++)
+    {
+        if (ncols && (i && i%ncols==0))
+            printf("\n%s", i==dlen-1 ? "" : indent);
+        printf("%02X ", *data++);
+    }
+    printf("\n");
+}
+
+// Swap bytes of 16-bit value
+uint16_t swap16(uint16_t val)
+{
+    return((uint16_t)((val >> 8) | (val << 8)));
+}
+
+// Opcode names aren't needed
+char *op_str(int gid, int op)
+{
+    return("");
+}
+
+// Module commands are accepted, but have no effect
+bool hif_put(int fd, uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset)
+{
+    return(true);
+}
+
+// Module responses aren't simulated, so there is nothing to hand on
+void set_resp_handler(RESP_HANDLER handler)
+{
+}
+
+// Open a UDP server socket, return socket number, -ve if error
+int open_sock_server(int portnum, bool tcp, SOCK_HANDLER handler)
+{
+    int sock = MIN_UDP_SOCK;
+
+    if (tcp)
+        return(-1);
+    memset(&sockets[sock], 0, sizeof(SOCKET));
+    sockets[sock].localport = portnum;
+    sockets[sock].state = STATE_BOUND;
+    sockets[sock].handler = handler;
+    return(sock);
+}
+
+// Send a datagram to the address in the socket
+bool put_sock_sendto(int fd, uint8_t sock, void *data, int len)
+{
+    SOCKET *sp = &sockets[sock];
+
+    host->send(node_id, sp->addr.ip, swap16(sp->addr.port), data, len);
+    return(true);
+}
+
+// Get data of the datagram being handled
+bool get_sock_data(int fd, uint8_t sock, void *data, int len)
+{
+    if (!rx_data || len > rx_len)
+        return(false);
+    memcpy(data, rx_data, len);
+    return(true);
+}
+
+// Pass mesh data for this node back to the simulator
+static void node_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    host->deliver(node_id, src_node, data, len);
+}
+
+// Start the node, with P2P and mesh enabled
+static bool node_init(SIM_HOST *hp, uint8_t id, uint16_t port, int32_t offset,
+                      int32_t ppm, int verb)
+{
+    char name[16];
+
+    host = hp;
+    node_id = id;
+    node_port = port;
+    clock_offset = offset;
+    clock_ppm = ppm;
+    verbose = verb;
+    snprintf(name, sizeof(name), "Sim%u", id);
+    if (!mesh_init(spi_fd, id, name) || !p2p_enable(spi_fd, P2P_LISTEN_CHAN) ||
+        !mesh_enable(spi_fd) || mesh_open_sock(port) < 0)
+        return(false);
+    mesh_set_handler(node_handler);
+    return(true);
+}
+
+// Run the node's periodic processing
+static void node_poll(void)
+{
+    mesh_beacon_handler(spi_fd);
+}
+
+// Receive a datagram on the mesh socket
+static void node_rx(uint32_t src_ip, uint16_t src_port, uint8_t *data, int len)
+{
+    int sock = MIN_UDP_SOCK;
+    SOCKET *sp = &sockets[sock];
+
+    if (sp->state != STATE_BOUND || !sp->handler)
+        return;
+    sp->addr.family = IP_FAMILY;
+    sp->addr.port = swap16(src_port);
+    sp->addr.ip = src_ip;
+    rx_data = data;
+    rx_len = len;
+    sp->handler(spi_fd, sock, len);
+    rx_data = NULL;
+}
+
+static MESH_SEND_RESULT node_send(uint8_t dst, uint8_t *data, uint16_t len)
+{
+    return(mesh_send_data(spi_fd, dst, data, len));
+}
+
+static bool node_has_route(uint8_t dst)
+{
+    return(mesh_find_route(dst) >= 0);
+}
+
+static uint32_t node_local_time(void)
+{
+    return(time_us_32());
+}
+
+static MESH_STATS *node_mesh_stats(void)
+{
+    return(&winc_stats.mesh);
+}
+
+static SIM_NODE_API node_api = {
+    node_init, node_poll, node_rx, node_send, node_has_route,
+    mesh_synced, mesh_time_us, node_local_time, node_mesh_stats
+};
+
+// Get node functions; the only symbol the simulator looks up
+SIM_NODE_API *sim_node_api(void)
+{
+    return(&node_api);
+}
+
+// EOF
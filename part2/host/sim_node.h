@@ -0,0 +1,48 @@
+// Mesh simulator node interface
+//
+// Needs winc_stats.h, for the mesh counters
+//
+// Each simulated node is a separately loaded copy of a shared library
+// containing winc_p2p.c and a replacement socket layer, so every node has its
+// own copy of the mesh state. The simulator and nodes call each other only
+// through these tables of functions.
+
+#ifndef SIM_NODE_H
+#define SIM_NODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_NODE_API_NAME   "sim_node_api"
+
+// Functions provided by the simulator to the nodes
+typedef struct {
+    uint64_t (*now)(void);                          // Virtual time (us)
+    void (*send)(int node, uint32_t ip, uint16_t port, uint8_t *data, int len);
+    void (*deliver)(int node, uint8_t src_node, uint8_t *data, uint16_t len);
+} SIM_HOST;
+
+// Functions provided by each node to the simulator
+typedef struct {
+    bool (*init)(SIM_HOST *host, uint8_t node_id, uint16_t port, int32_t clock_offset,
+                 int32_t clock_ppm, int verbose);
+    void (*poll)(void);
+    void (*rx)(uint32_t src_ip, uint16_t src_port, uint8_t *data, int len);
+    MESH_SEND_RESULT (*send)(uint8_t dst_node, uint8_t *data, uint16_t len);
+    bool (*has_route)(uint8_t dst_node);
+    bool (*synced)(void);
+    uint32_t (*mesh_time)(void);
+    uint32_t (*local_time)(void);
+    MESH_STATS *(*mesh_stats)(void);
+} SIM_NODE_API;
+
+typedef SIM_NODE_API *(*SIM_NODE_API_FN)(void);
+
+// IP address of simulated node, first octet in low byte as in SOCK_ADDR
+#define SIM_NODE_IP(n)      (10 | ((uint32_t)(n) << 24))
+#define SIM_IP_NODE(ip)     ((ip) >> 24)
+#define SIM_BCAST_IP        0xffffffff
+
+#endif // SIM_NODE_H
+
+// EOF
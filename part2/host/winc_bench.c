@@ -0,0 +1,337 @@
+// Benchmarks of ATWINC1500 driver hot paths, running on Linux
+//
+// The driver is built unmodified, with the platform SPI, IRQ and timer
+// functions in emu_pico.c connected to the chip emulator in winc_emu.c.
+// Times are the emulator's virtual time, which models the 10.42 MHz SPI
+// clock and a fixed cost per transfer, so they approximate hardware; the
+// host CPU time per operation is also given, for changes to the driver's
+// own code.
+//
+// Each result is a JSON line, tagged for comparison across commits:
+//   winc_bench -t $(git rev-parse --short HEAD) > bench.json
+//
+// SPI bytes per payload byte counts all bytes transferred, including
+// commands, polls, and HIF messages that carry no data, against the payload
+// bytes sent and received.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_emu.h"
+
+#define BENCH_UDP_PORT  1025
+#define BENCH_TCP_PORT  1026
+#define BENCH_BATCH_PORT 1027
+#define BENCH_MAX_COUNT 100000
+#define BENCH_TIMEOUT   1000000000ULL   // Emulated time limit for a step (ns)
+
+extern int verbose;
+extern SOCKET sockets[MAX_SOCKETS];
+
+static uint8_t bench_data[SPI_BUFFLEN], rx_data[SPI_BUFFLEN];
+static int udp_sock, tcp_sock, batch_sock, tcp_conn = -1, nrx, ntx;
+static bool echo;
+static uint64_t irq_ns;
+static uint32_t lats[BENCH_MAX_COUNT];
+static char *tag = "";
+static int count = 1000;
+
+// Host CPU time (ns)
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// Socket handlers, reading the data and optionally echoing it
+static void bench_udp_handler(int fd, uint8_t sock, int rxlen)
+{
+    if (rxlen > 0 && get_sock_data(fd, sock, rx_data, rxlen))
+    {
+        nrx++;
+        if (echo)
+            put_sock_sendto(fd, sock, rx_data, rxlen);
+    }
+}
+static void bench_tcp_handler(int fd, uint8_t sock, int rxlen)
+{
+    if (rxlen < 0)
+        put_sock_close(fd, sock);
+    else if (rxlen > 0 && get_sock_data(fd, sock, rx_data, rxlen))
+    {
+        nrx++;
+        if (echo)
+            put_sock_send(fd, sock, rx_data, rxlen);
+    }
+}
+
+// Data sent by the driver to the emulated network
+static void bench_tx_handler(uint8_t sock, bool tcp, uint32_t ip, uint16_t port,
+                             uint8_t *data, int len)
+{
+    ntx++;
+}
+
+// Handle interrupts until a count reaches its target, return false on timeout
+static bool bench_run(int *np, int target)
+{
+    uint64_t t, tout = emu_time_ns() + BENCH_TIMEOUT;
+
+    while (*np < target)
+    {
+        if (emu_time_ns() > tout)
+            return(false);
+        if (read_irq() == 0)
+        {
+            t = emu_time_ns();
+            interrupt_handler();
+            irq_ns += emu_time_ns() - t;
+        }
+    }
+    return(true);
+}
+
+// Run handler until chip has no more messages
+static void bench_idle(void)
+{
+    uint64_t tout = emu_time_ns() + BENCH_TIMEOUT;
+
+    while ((emu_rx_queued() || read_irq() == 0) && emu_time_ns() < tout)
+    {
+        if (read_irq() == 0)
+            interrupt_handler();
+    }
+}
+
+// Compare function for sorting latencies
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return(x < y ? -1 : x > y);
+}
+
+// Print common result fields
+static void print_result(char *bench, int size, int n, uint64_t emu_ns, uint64_t hns,
+                         uint32_t spi_bytes, uint32_t payload)
+{
+    printf("{\"tag\":\"%s\",\"bench\":\"%s\",\"size\":%d,\"count\":%d,"
+           "\"emu_us\":%.1f,\"ops_per_sec\":%.1f,\"spi_bytes\":%u,\"spi_per_payload\":%.3f,"
+           "\"host_ns_per_op\":%.1f",
+           tag, bench, size, n, emu_ns / 1e3, emu_ns ? n * 1e9 / emu_ns : 0.0, spi_bytes,
+           payload ? (double)spi_bytes / payload : 0.0, n ? (double)hns / n : 0.0);
+}
+
+// Print latency percentiles, and end result line
+static void print_lats(int n, int size)
+{
+    uint64_t total = 0;
+    int i;
+
+    if (n > 0)
+    {
+        qsort(lats, n, sizeof(lats[0]), cmp_u32);
+        for (i = 0; i < n; i++)
+            total += lats[i];
+        printf(",\"lat_p50_us\":%.2f,\"lat_p99_us\":%.2f,\"lat_max_us\":%.2f,\"mbit_per_sec\":%.3f",
+               lats[n / 2] / 1e3, lats[(n * 99) / 100] / 1e3, lats[n - 1] / 1e3,
+               total ? (double)n * size * 8 * 1e3 / total : 0.0);
+    }
+    printf("}\n");
+}
+
+// Reset chip, initialise it, and open UDP and TCP servers
+static bool bench_init(bool report)
+{
+    uint64_t t, h;
+    bool ok;
+
+    spi_setup(0);
+    stats_reset();
+    t = emu_time_ns();
+    h = host_ns();
+    disable_crc(0);
+    ok = chip_init(0) && chip_get_id(0);
+    if (report)
+    {
+        print_result("chip_init", 0, 1, emu_time_ns() - t, host_ns() - h, winc_stats.spi.bytes, 0);
+        printf(",\"ok\":%s}\n", ok ? "true" : "false");
+    }
+    memset(sockets, 0, sizeof(sockets));
+    udp_sock = open_sock_server(BENCH_UDP_PORT, 0, bench_udp_handler);
+    tcp_sock = open_sock_server(BENCH_TCP_PORT, 1, bench_tcp_handler);
+    batch_sock = open_sock_server(BENCH_BATCH_PORT, 0, udp_batch_handler);
+    ok = ok && join_net(0, "bench", "benchpass");
+    bench_idle();
+    return(ok && sockets[udp_sock].state == STATE_BOUND && sockets[tcp_sock].state == STATE_BOUND &&
+           sockets[batch_sock].state == STATE_BOUND);
+}
+
+// Sends from the driver to the chip, without responses
+static void bench_hif_put(int size)
+{
+    uint64_t t, h;
+    uint32_t b = winc_stats.spi.bytes;
+    int i;
+
+    emu_params.send_resp = false;
+    t = emu_time_ns();
+    h = host_ns();
+    for (i = 0; i < count; i++)
+        put_sock_sendto(0, (uint8_t)udp_sock, bench_data, size);
+    print_result("hif_put", size, count, emu_time_ns() - t, host_ns() - h,
+                 winc_stats.spi.bytes - b, (uint32_t)count * size);
+    printf("}\n");
+    emu_params.send_resp = true;
+}
+
+// Received datagrams, timing the interrupt handler only
+static void bench_irq(int size)
+{
+    uint64_t h;
+    uint32_t b = winc_stats.spi.bytes;
+    int n, batch;
+    bool ok = true;
+
+    echo = false;
+    nrx = 0;
+    irq_ns = 0;
+    h = host_ns();
+    for (n = 0; ok && n < count; n += batch)
+    {
+        batch = MIN(count - n, 4);
+        for (int i = 0; i < batch; i++)
+            emu_udp_in(BENCH_UDP_PORT, EMU_PEER_IP, EMU_PEER_PORT, bench_data, size);
+        ok = bench_run(&nrx, n + batch);
+    }
+    print_result("interrupt_handler", size, nrx, irq_ns, host_ns() - h,
+                 winc_stats.spi.bytes - b, (uint32_t)nrx * size);
+    printf("}\n");
+}
+
+// Closed-loop echo: one message in flight, time to reply
+static void bench_echo(bool tcp, int size)
+{
+    uint64_t t, t1, h;
+    uint32_t b;
+    int n;
+    bool ok = true;
+
+    echo = true;
+    if (tcp && tcp_conn < 0)
+    {
+        tcp_conn = emu_tcp_connect(BENCH_TCP_PORT, EMU_PEER_IP, EMU_PEER_PORT);
+        bench_idle();
+    }
+    if (tcp)
+        ok = tcp_conn >= 0 && sockets[tcp_conn].state == STATE_CONNECTED;
+    b = winc_stats.spi.bytes;
+    ntx = 0;
+    t = emu_time_ns();
+    h = host_ns();
+    for (n = 0; ok && n < count; n++)
+    {
+        t1 = emu_time_ns();
+        ok = (tcp ? emu_tcp_in(tcp_conn, bench_data, size) :
+                    emu_udp_in(BENCH_UDP_PORT, EMU_PEER_IP, EMU_PEER_PORT, bench_data, size)) &&
+             bench_run(&ntx, n + 1);
+        if (!ok)
+            break;
+        lats[n] = (uint32_t)(emu_time_ns() - t1);
+    }
+    bench_idle();
+    print_result(tcp ? "tcp_echo" : "udp_echo", size, n, emu_time_ns() - t, host_ns() - h,
+                 winc_stats.spi.bytes - b, (uint32_t)n * size * 2);
+    print_lats(n, size);
+    echo = false;
+}
+
+// Batched echo: datagrams from several peers are queued by the handler, then
+// taken and sent back to their senders a batch at a time
+static void bench_batch(int size)
+{
+    UDP_MSG msgs[UDP_BATCH_LEN];
+    uint64_t t, h;
+    uint32_t b = winc_stats.spi.bytes;
+    int n, i, batch, got;
+    bool ok = true;
+
+    ntx = 0;
+    t = emu_time_ns();
+    h = host_ns();
+    for (n = 0; ok && n < count; n += batch)
+    {
+        batch = MIN(count - n, MIN(UDP_BATCH_LEN, UDP_BATCH_BUFS));
+        for (i = 0; i < batch; i++)
+            emu_udp_in(BENCH_BATCH_PORT, EMU_PEER_IP, EMU_PEER_PORT + i, bench_data, size);
+        bench_idle();
+        got = get_sock_batch((uint8_t)batch_sock, msgs, batch);
+        ok = got == batch && put_sock_sendto_batch(0, (uint8_t)batch_sock, msgs, got) == got;
+        free_sock_batch(msgs, got);
+        ok = ok && bench_run(&ntx, n + batch);
+    }
+    print_result("udp_batch_echo", size, ntx, emu_time_ns() - t, host_ns() - h,
+                 winc_stats.spi.bytes - b, (uint32_t)ntx * size * 2);
+    printf("}\n");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: winc_bench [-t tag] [-n count] [-s spi_hz]\n");
+    fprintf(stderr, "  -t  Tag for results, e.g. commit hash\n");
+    fprintf(stderr, "  -n  Messages per benchmark (default %d)\n", count);
+    fprintf(stderr, "  -s  SPI clock (default %u Hz)\n", emu_params.spi_hz);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = {16, 64, 256, 512, 1024, 1400};
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "t:n:s:")) != -1)
+    {
+        if (opt == 't')
+            tag = optarg;
+        else if (opt == 'n')
+            count = MIN(atoi(optarg), BENCH_MAX_COUNT);
+        else if (opt == 's')
+            emu_params.spi_hz = (uint32_t)atoi(optarg);
+        else
+            usage();
+    }
+    if (count <= 0 || emu_params.spi_hz == 0)
+        usage();
+    verbose = 0;
+    for (i = 0; i < (int)sizeof(bench_data); i++)
+        bench_data[i] = (uint8_t)i;
+    emu_set_tx_handler(bench_tx_handler);
+    if (!bench_init(true))
+    {
+        fprintf(stderr, "Can't initialise emulated chip\n");
+        return(1);
+    }
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        bench_hif_put(sizes[i]);
+    bench_idle();
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        bench_irq(sizes[i]);
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        bench_echo(false, sizes[i]);
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        bench_echo(true, sizes[i]);
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        bench_batch(sizes[i]);
+    return(0);
+}
+
+// EOF
@@ -0,0 +1,348 @@
+// Benchmark of the C++ socket wrappers and coroutines against the C socket
+// functions
+//
+// The same operations are run through the classes in winc_sock.hpp and
+// through the C functions they wrap, on the emulated chip, alternating
+// between the two and keeping the fastest of several runs of each. The
+// emulated time and SPI bytes must be the same, and the host CPU time per
+// operation should only differ by measurement noise, since the wrappers
+// compile to the same calls. The echoes are also run as coroutines, using
+// winc_async.hpp, which cost a little host time to suspend and resume.
+//
+// Each result is a JSON line, tagged for comparison across commits:
+//   winc_bench_cpp -t $(git rev-parse --short HEAD) > bench_cpp.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include "winc_sock.hpp"
+#include "winc_async.hpp"
+
+extern "C" {
+#include "winc_stats.h"
+#include "winc_emu.h"
+extern int verbose;
+}
+
+#define C_UDP_PORT      1025
+#define C_TCP_PORT      1026
+#define CPP_UDP_PORT    1027
+#define CPP_TCP_PORT    1028
+#define ASYNC_UDP_PORT  1029
+#define ASYNC_TCP_PORT  1030
+#define BENCH_RUNS      5
+#define BENCH_TIMEOUT   1000000000ULL   // Emulated time limit for a step (ns)
+
+// Result of one run
+struct Run {
+    uint64_t host_ns = 0, emu_ns = 0;
+    uint32_t spi_bytes = 0;
+    int n = 0;
+};
+
+static uint8_t bench_data[SPI_BUFFLEN], rx_data[SPI_BUFFLEN];
+static int nrx, ntx, count = 1000;
+static const char *tag = "";
+
+// Host CPU time (ns)
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// C echo handlers
+static void c_udp_handler(int fd, uint8_t sock, int rxlen)
+{
+    int n = MIN(rxlen, (int)sizeof(rx_data));
+
+    if (n > 0 && get_sock_data(fd, sock, rx_data, n))
+    {
+        nrx++;
+        put_sock_sendto(fd, sock, rx_data, n);
+    }
+}
+static void c_tcp_handler(int fd, uint8_t sock, int rxlen)
+{
+    int n = MIN(rxlen, (int)sizeof(rx_data));
+
+    if (rxlen < 0)
+        put_sock_close(fd, sock);
+    else if (n > 0 && get_sock_data(fd, sock, rx_data, n))
+    {
+        nrx++;
+        put_sock_send(fd, sock, rx_data, n);
+    }
+}
+
+// The same handlers in C++
+static void cpp_udp_echo(winc::UdpSock s, int rxlen)
+{
+    int n = s.recv(rx_data, rxlen);
+
+    if (n > 0)
+    {
+        nrx++;
+        s.send(winc::Bytes(rx_data, n));
+    }
+}
+static void cpp_tcp_echo(winc::TcpSock s, int rxlen)
+{
+    int n = s.recv(rx_data, rxlen);
+
+    if (rxlen < 0)
+        s.close();
+    else if (n > 0)
+    {
+        nrx++;
+        s.send(winc::Bytes(rx_data, n));
+    }
+}
+
+// The same as coroutines
+static winc::Task async_udp_echo(winc::UdpSock s)
+{
+    int n;
+
+    for (;;)
+    {
+        if ((n = co_await winc::recv(s, rx_data)) > 0)
+        {
+            nrx++;
+            s.send(winc::Bytes(rx_data, n));
+        }
+    }
+}
+static winc::Task async_tcp_session(winc::TcpConnection c)
+{
+    int n;
+
+    while ((n = co_await winc::recv(c, rx_data)) > 0)
+    {
+        nrx++;
+        c.send(winc::Bytes(rx_data, n));
+    }
+}
+static winc::Task async_tcp_server(winc::TcpListener &l)
+{
+    for (;;)
+        if (winc::TcpConnection c = co_await winc::accept(l))
+            async_tcp_session(std::move(c));
+}
+
+// Data sent by the driver to the emulated network
+static void bench_tx_handler(uint8_t sock, bool tcp, uint32_t ip, uint16_t port,
+                             uint8_t *data, int len)
+{
+    ntx++;
+}
+
+// Handle interrupts until a count reaches its target, return false on timeout
+static bool bench_run(winc::Chip &chip, int *np, int target)
+{
+    uint64_t tout = emu_time_ns() + BENCH_TIMEOUT;
+
+    while (*np < target)
+    {
+        if (emu_time_ns() > tout)
+            return(false);
+        winc::poll(chip);
+    }
+    return(true);
+}
+
+// Run handler until chip has no more messages
+static void bench_idle(winc::Chip &chip)
+{
+    uint64_t tout = emu_time_ns() + BENCH_TIMEOUT;
+
+    while ((emu_rx_queued() || read_irq() == 0) && emu_time_ns() < tout)
+        winc::poll(chip);
+}
+
+// Time a function, keeping the fastest run
+template <typename F>
+static void time_run(F f, Run &best)
+{
+    uint32_t b = winc_stats.spi.bytes;
+    uint64_t t = emu_time_ns(), h = host_ns();
+    Run r;
+
+    r.n = f();
+    r.host_ns = host_ns() - h;
+    r.emu_ns = emu_time_ns() - t;
+    r.spi_bytes = winc_stats.spi.bytes - b;
+    if (best.n == 0 || r.host_ns < best.host_ns)
+        best = r;
+}
+
+// Print C and C++ results, and the difference
+static void print_pair(const char *bench, int size, const Run &c, const Run &cpp)
+{
+    double c_ns = c.n ? (double)c.host_ns / c.n : 0, cpp_ns = cpp.n ? (double)cpp.host_ns / cpp.n : 0;
+
+    printf("{\"tag\":\"%s\",\"bench\":\"%s\",\"size\":%d,\"count\":%d,"
+           "\"c_ns_per_op\":%.1f,\"cpp_ns_per_op\":%.1f,\"overhead_pct\":%.1f,"
+           "\"c_emu_us\":%.1f,\"cpp_emu_us\":%.1f,\"c_spi_bytes\":%u,\"cpp_spi_bytes\":%u,"
+           "\"same\":%s}\n",
+           tag, bench, size, c.n, c_ns, cpp_ns, c_ns ? 100.0 * (cpp_ns - c_ns) / c_ns : 0.0,
+           c.emu_ns / 1e3, cpp.emu_ns / 1e3, c.spi_bytes, cpp.spi_bytes,
+           c.n == cpp.n && c.emu_ns == cpp.emu_ns && c.spi_bytes == cpp.spi_bytes ?
+           "true" : "false");
+}
+
+// Sends from the driver to the chip, without responses
+static void bench_send(winc::UdpSocket &udp, uint8_t c_sock, int size)
+{
+    Run c, cpp;
+
+    emu_params.send_resp = false;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        time_run([&] {
+            for (int j = 0; j < count; j++)
+                put_sock_sendto(0, c_sock, bench_data, size);
+            return(count);
+        }, c);
+        time_run([&] {
+            for (int j = 0; j < count; j++)
+                udp.send(winc::Bytes(bench_data, size));
+            return(count);
+        }, cpp);
+    }
+    print_pair("udp_send", size, c, cpp);
+    emu_params.send_resp = true;
+}
+
+// Closed-loop echo through a handler, one message in flight
+static void bench_echo(winc::Chip &chip, const char *bench, bool tcp, int c_port, int cpp_port,
+                       int size)
+{
+    int c_conn = tcp ? emu_tcp_connect(c_port, EMU_PEER_IP, EMU_PEER_PORT) : -1;
+    int cpp_conn = tcp ? emu_tcp_connect(cpp_port, EMU_PEER_IP, EMU_PEER_PORT) : -1;
+    Run c, cpp;
+
+    bench_idle(chip);
+    auto echo = [&](int port, int conn) {
+        int n;
+
+        ntx = 0;
+        for (n = 0; n < count; n++)
+        {
+            if (!(tcp ? emu_tcp_in(conn, bench_data, size) :
+                        emu_udp_in(port, EMU_PEER_IP, EMU_PEER_PORT, bench_data, size)) ||
+                !bench_run(chip, &ntx, n + 1))
+                break;
+        }
+        bench_idle(chip);
+        return(n);
+    };
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        time_run([&] { return(echo(c_port, c_conn)); }, c);
+        time_run([&] { return(echo(cpp_port, cpp_conn)); }, cpp);
+    }
+    print_pair(bench, size, c, cpp);
+    if (tcp)
+    {
+        emu_tcp_close(c_conn);
+        emu_tcp_close(cpp_conn);
+        bench_idle(chip);
+    }
+}
+
+// Check a socket is closed when its owner is destroyed, and not before
+static bool check_close(winc::Chip &chip)
+{
+    winc::TcpListener kept;
+    int sock;
+
+    {
+        winc::TcpListener s(1031, winc::tcp_handler<cpp_tcp_echo>);
+        sock = s ? s.sock() : -1;
+        kept = std::move(s);
+    }
+    if (sock < 0 || !kept || sockets[sock].state == STATE_CLOSED)
+        return(false);
+    kept.reset();
+    bench_idle(chip);
+    return(sockets[sock].state == STATE_CLOSED);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: winc_bench_cpp [-t tag] [-n count]\n");
+    fprintf(stderr, "  -t  Tag for results, e.g. commit hash\n");
+    fprintf(stderr, "  -n  Messages per benchmark (default %d)\n", count);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = {16, 256, 1400};
+    winc::Chip chip;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1)
+    {
+        if (opt == 't')
+            tag = optarg;
+        else if (opt == 'n')
+            count = atoi(optarg);
+        else
+            usage();
+    }
+    if (count <= 0)
+        usage();
+    verbose = 0;
+    for (int i = 0; i < (int)sizeof(bench_data); i++)
+        bench_data[i] = (uint8_t)i;
+    emu_set_tx_handler(bench_tx_handler);
+    spi_setup(0);
+    stats_reset();
+    if (!chip.init())
+    {
+        fprintf(stderr, "Can't initialise emulated chip\n");
+        return(1);
+    }
+    int c_udp = open_sock_server(C_UDP_PORT, 0, c_udp_handler);
+    int c_tcp = open_sock_server(C_TCP_PORT, 1, c_tcp_handler);
+    winc::UdpSocket udp(CPP_UDP_PORT, winc::udp_handler<cpp_udp_echo>);
+    winc::TcpListener tcp(CPP_TCP_PORT, winc::tcp_handler<cpp_tcp_echo>);
+    winc::UdpSocket async_udp(ASYNC_UDP_PORT, winc::async_handler);
+    winc::TcpListener async_tcp(ASYNC_TCP_PORT, winc::async_handler);
+    bool ok = chip.join((char *)"bench", (char *)"benchpass");
+
+    bench_idle(chip);
+    if (!ok || c_udp < 0 || c_tcp < 0 || !udp || !tcp || !async_udp || !async_tcp ||
+        udp.state() != STATE_BOUND || !async_udp_echo(async_udp) || !async_tcp_server(async_tcp))
+    {
+        fprintf(stderr, "Can't open sockets\n");
+        return(1);
+    }
+    printf("{\"tag\":\"%s\",\"bench\":\"close\",\"ok\":%s}\n", tag,
+           check_close(chip) ? "true" : "false");
+    for (int size : sizes)
+        bench_send(udp, (uint8_t)c_udp, size);
+    bench_idle(chip);
+    for (int size : sizes)
+        bench_echo(chip, "udp_echo", false, C_UDP_PORT, CPP_UDP_PORT, size);
+    for (int size : sizes)
+        bench_echo(chip, "tcp_echo", true, C_TCP_PORT, CPP_TCP_PORT, size);
+    for (int size : sizes)
+        bench_echo(chip, "udp_echo_async", false, C_UDP_PORT, ASYNC_UDP_PORT, size);
+    for (int size : sizes)
+        bench_echo(chip, "tcp_echo_async", true, C_TCP_PORT, ASYNC_TCP_PORT, size);
+    printf("{\"tag\":\"%s\",\"bench\":\"coroutines\",\"frames_used\":%d,\"frames\":%d,"
+           "\"max_frame_bytes\":%u,\"frame_bytes\":%u}\n", tag, winc::coro_count(), CORO_FRAMES,
+           (unsigned)winc::coro_max_size, (unsigned)CORO_FRAME_SIZE);
+    return(0);
+}
+
+// EOF
@@ -0,0 +1,334 @@
+// Bridge from Linux sockets to the driver running on the chip emulator
+//
+// The driver runs unmodified against winc_emu.c, with UDP and TCP echo
+// servers on the module. This program listens on real sockets, passes each
+// datagram and TCP connection to the emulated chip with the client's
+// address, and sends back whatever the driver sends, so load generators and
+// test clients can be pointed at 127.0.0.1 instead of a module.
+//
+// Emulated time is paced to the wall clock, so throughput is limited as it
+// would be by the SPI bus; with -f it runs as fast as the host allows.
+// Datagrams are dropped if the chip's receive queue is full, as on the
+// module; TCP data is left in the socket until there is space.
+//
+// The module has 7 TCP sockets, one of which is the listener, so there can
+// be at most 6 TCP connections; further connections are closed at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_buf.h"
+#include "winc_emu.h"
+
+#define BRIDGE_MAX_DATA     1400            // Largest datagram or TCP read
+#define BRIDGE_STATUS_NS    1000000000ULL   // Status print interval with -v
+#define BRIDGE_SETUP_NS     1000000000ULL   // Emulated time limit for setup
+
+extern int verbose;
+extern SOCKET sockets[MAX_SOCKETS];
+
+static int udp_fd = -1, listen_fd = -1, conn_fds[MIN_UDP_SOCK];
+static uint8_t rx_data[SPI_BUFFLEN], net_data[BRIDGE_MAX_DATA];
+static uint16_t udp_port = UDP_PORTNUM, tcp_port = TCP_PORTNUM;
+static bool free_run;
+static volatile sig_atomic_t stop;
+
+// Counts for status
+static uint32_t udp_in, udp_out, udp_drops, tcp_in, tcp_out, tcp_conns, tcp_refused;
+
+// Host time (ns)
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// Echo handlers on the emulated module
+static void bridge_udp_handler(int fd, uint8_t sock, int rxlen)
+{
+    if (rxlen > 0 && get_sock_data(fd, sock, rx_data, rxlen))
+        put_sock_sendto(fd, sock, rx_data, rxlen);
+}
+static void bridge_tcp_handler(int fd, uint8_t sock, int rxlen)
+{
+    if (rxlen < 0)
+        put_sock_close(fd, sock);
+    else if (rxlen > 0 && get_sock_data(fd, sock, rx_data, rxlen))
+        put_sock_send(fd, sock, rx_data, rxlen);
+}
+
+// Data sent by the driver, to the client it is addressed to
+static void bridge_tx_handler(uint8_t sock, bool tcp, uint32_t ip, uint16_t port,
+                              uint8_t *data, int len)
+{
+    struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int n, fd = tcp && sock < MIN_UDP_SOCK ? conn_fds[sock] : -1;
+
+    if (!tcp)
+    {
+        sa.sin_addr.s_addr = ip;
+        sendto(udp_fd, data, len, 0, (struct sockaddr *)&sa, sizeof(sa));
+        udp_out++;
+    }
+    else if (fd >= 0)
+    {
+        while (len > 0 && (n = (int)send(fd, data, len, MSG_NOSIGNAL)) > 0)
+        {
+            data += n;
+            len -= n;
+        }
+        tcp_out++;
+    }
+}
+
+// Open a listening socket
+static int open_listen(char *addr, int port, bool tcp)
+{
+    struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int fd = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0), one = 1;
+
+    sa.sin_addr.s_addr = inet_addr(addr);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        (tcp && listen(fd, 8) < 0))
+    {
+        perror(tcp ? "TCP socket" : "UDP socket");
+        return(-1);
+    }
+    return(fd);
+}
+
+// Handle interrupts from the emulated chip
+static void poll_chip(void)
+{
+    while (read_irq() == 0)
+        interrupt_handler();
+}
+
+// Initialise the emulated chip, and open the echo servers
+static bool chip_setup(void)
+{
+    int usock, tsock;
+    uint64_t tout;
+    bool ok;
+
+    spi_setup(0);
+    disable_crc(0);
+    ok = chip_init(0);
+    usock = open_sock_server(udp_port, 0, bridge_udp_handler);
+    tsock = open_sock_server(tcp_port, 1, bridge_tcp_handler);
+    ok = ok && join_net(0, "bridge", "bridgepass");
+    tout = emu_time_ns() + BRIDGE_SETUP_NS;
+    while (ok && (sockets[usock].state != STATE_BOUND || sockets[tsock].state != STATE_BOUND))
+    {
+        if (emu_time_ns() > tout)
+            ok = false;
+        poll_chip();
+    }
+    return(ok);
+}
+
+// Accept a TCP connection, and pass it to the chip
+static void net_accept(void)
+{
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    int fd = accept(listen_fd, (struct sockaddr *)&sa, &salen), sock, one = 1;
+
+    if (fd < 0)
+        return;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sock = emu_tcp_connect(tcp_port, sa.sin_addr.s_addr, ntohs(sa.sin_port));
+    if (sock < 0)
+    {
+        close(fd);
+        tcp_refused++;
+        return;
+    }
+    conn_fds[sock] = fd;
+    tcp_conns++;
+}
+
+// Read TCP data, or close, and pass it to the chip
+static void net_tcp_read(int sock)
+{
+    int n = (int)recv(conn_fds[sock], net_data, sizeof(net_data), 0);
+
+    if (n > 0)
+    {
+        emu_tcp_in(sock, net_data, n);
+        tcp_in++;
+    }
+    else
+    {
+        emu_tcp_close(sock);
+        close(conn_fds[sock]);
+        conn_fds[sock] = -1;
+    }
+}
+
+// Read datagram, and pass it to the chip
+static void net_udp_read(void)
+{
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    int n = (int)recvfrom(udp_fd, net_data, sizeof(net_data), MSG_TRUNC,
+                          (struct sockaddr *)&sa, &salen);
+
+    if (n <= 0)
+        return;
+    udp_in++;
+    if (n > (int)sizeof(net_data) ||
+        !emu_udp_in(udp_port, sa.sin_addr.s_addr, ntohs(sa.sin_port), net_data, n))
+        udp_drops++;
+}
+
+// Wait for network data, for up to the given time
+static void poll_net(int tout_ms)
+{
+    struct pollfd fds[MIN_UDP_SOCK + 2];
+    int socks[MIN_UDP_SOCK + 2], i, n = 0;
+
+    fds[n].fd = udp_fd;
+    fds[n].events = POLLIN;
+    socks[n++] = -1;
+    fds[n].fd = listen_fd;
+    fds[n].events = POLLIN;
+    socks[n++] = -1;
+    for (i = 0; i < MIN_UDP_SOCK; i++)
+    {
+        if (conn_fds[i] >= 0)
+        {
+            fds[n].fd = conn_fds[i];
+            fds[n].events = emu_sock_space(i) > 0 ? POLLIN : 0;
+            socks[n++] = i;
+        }
+    }
+    if (poll(fds, n, tout_ms) <= 0)
+        return;
+    if (fds[0].revents & POLLIN)
+        net_udp_read();
+    if (fds[1].revents & POLLIN)
+        net_accept();
+    for (i = 2; i < n; i++)
+    {
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            net_tcp_read(socks[i]);
+    }
+}
+
+// Keep emulated time in step with the wall clock
+static void pace(uint64_t wall0, uint64_t emu0)
+{
+    uint64_t wall = host_ns() - wall0, emu = emu_time_ns() - emu0;
+    struct timespec ts;
+
+    if (emu < wall)
+        emu_advance(wall - emu);
+    else if (emu - wall > 1000000)
+    {
+        ts.tv_sec = 0;
+        ts.tv_nsec = (long)(emu - wall);
+        nanosleep(&ts, 0);
+    }
+}
+
+static void handle_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: winc_bridge [-a addr] [-u port] [-t port] [-f] [-s spi_hz] [-v]\n");
+    fprintf(stderr, "  -a  Address to listen on (default 127.0.0.1)\n");
+    fprintf(stderr, "  -u  UDP echo port (default %u)\n", UDP_PORTNUM);
+    fprintf(stderr, "  -t  TCP echo port (default %u)\n", TCP_PORTNUM);
+    fprintf(stderr, "  -f  Free-running: don't pace emulated time to the wall clock\n");
+    fprintf(stderr, "  -s  SPI clock (default %u Hz)\n", emu_params.spi_hz);
+    fprintf(stderr, "  -v  Print counts every second\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char *addr = "127.0.0.1";
+    uint64_t wall0, emu0, last = 0;
+    int opt, i, show = 0;
+
+    while ((opt = getopt(argc, argv, "a:u:t:fs:v")) != -1)
+    {
+        if (opt == 'a')
+            addr = optarg;
+        else if (opt == 'u')
+            udp_port = (uint16_t)atoi(optarg);
+        else if (opt == 't')
+            tcp_port = (uint16_t)atoi(optarg);
+        else if (opt == 'f')
+            free_run = true;
+        else if (opt == 's')
+            emu_params.spi_hz = (uint32_t)atoi(optarg);
+        else if (opt == 'v')
+            show = 1;
+        else
+            usage();
+    }
+    if (emu_params.spi_hz == 0)
+        usage();
+    verbose = 0;
+    for (i = 0; i < MIN_UDP_SOCK; i++)
+        conn_fds[i] = -1;
+    emu_set_tx_handler(bridge_tx_handler);
+    if (!chip_setup())
+    {
+        fprintf(stderr, "Can't initialise emulated chip\n");
+        return(1);
+    }
+    if ((udp_fd = open_listen(addr, udp_port, false)) < 0 ||
+        (listen_fd = open_listen(addr, tcp_port, true)) < 0)
+        return(1);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    printf("Bridge UDP %s:%u TCP %s:%u, SPI %u Hz%s\n", addr, udp_port, addr, tcp_port,
+           emu_params.spi_hz, free_run ? ", free-running" : "");
+    fflush(stdout);
+    wall0 = host_ns();
+    emu0 = emu_time_ns();
+    while (!stop)
+    {
+        poll_chip();
+        poll_net(emu_rx_queued() ? 0 : 1);
+        if (!free_run)
+            pace(wall0, emu0);
+        if (show && host_ns() - last >= BRIDGE_STATUS_NS)
+        {
+            last = host_ns();
+            printf("UDP in %u out %u dropped %u, TCP conns %u refused %u in %u out %u\n",
+                   udp_in, udp_out, udp_drops, tcp_conns, tcp_refused, tcp_in, tcp_out);
+            fflush(stdout);
+        }
+    }
+    printf("UDP in %u out %u dropped %u, TCP conns %u refused %u in %u out %u\n",
+           udp_in, udp_out, udp_drops, tcp_conns, tcp_refused, tcp_in, tcp_out);
+    stats_print(&winc_stats);
+    stats_bus_print(&winc_stats, emu_params.spi_hz);
+    buf_print();
+    return(0);
+}
+
+// EOF
@@ -0,0 +1,579 @@
+// SPI-level emulator of the ATWINC1500, for host builds of the driver
+//
+// Each byte clocked in by spi_xfer() is parsed as the chip would: register
+// reads and writes, and data block reads and writes to chip memory, with the
+// same responses, polling bytes and tokens. HIF messages written by the
+// driver are acted on when the transfer is completed, and responses are put
+// in a queue, each raising the IRQ line when its time comes and the previous
+// one has been acknowledged.
+//
+// The socket layer holds a few datagrams or TCP segments per socket, which
+// are passed to the driver as a receive is requested. There is no real
+// network: data sent by the driver goes to the caller's handler, with the
+// peer address the driver gave, so the caller can route it back.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_emu.h"
+
+#define EMU_MEM_SIZE        0x50000
+#define EMU_INFO_ADDR       0x30000     // Firmware info table
+#define EMU_HIF_TX_ADDR     0x40000     // Host to chip message buffer
+#define EMU_HIF_RX_ADDR     0x48000     // Chip to host message buffer
+#define EMU_MAX_DATA        1600
+#define EMU_MAX_MSG         (sizeof(RECV_RESP_MSG) + EMU_MAX_DATA)
+#define EMU_MSGS            32
+#define EMU_SOCK_QLEN       8
+#define EMU_REGS            32
+#define EMU_OUT_MAX         (EMU_MAX_DATA + 16)
+
+#define FINISH_BOOT_VAL     0x10add09e
+#define START_FIRMWARE      0xef522f61
+#define FINISH_INIT_VAL     0x02532636
+#define DATA_TOKEN          0xf3
+#define WRITE_ACK           0xc3
+
+// Write data states
+#define WR_IDLE             0
+#define WR_TOKEN            1
+#define WR_DATA             2
+
+// Message from chip to host
+typedef struct {
+    uint64_t time;
+    uint16_t gop;
+    int len;
+    uint8_t data[EMU_MAX_MSG];
+} EMU_MSG;
+
+// Received datagram or TCP segment, with the sender's address
+typedef struct {
+    uint32_t ip;
+    uint16_t port;
+    int len;
+    uint8_t data[EMU_MAX_DATA];
+} EMU_PKT;
+
+// Emulated socket
+typedef struct {
+    uint8_t state;
+    bool tcp, recv_pending, closing;
+    uint16_t port, session;
+    uint32_t peer_ip;
+    uint16_t peer_port;
+    int qhead, qcount;
+    EMU_PKT q[EMU_SOCK_QLEN];
+} EMU_SOCK;
+
+typedef struct {
+    uint32_t addr, val;
+} EMU_REG;
+
+EMU_PARAMS emu_params = EMU_DEFAULT_PARAMS;
+
+static uint64_t now_ns;
+static uint8_t mem[EMU_MEM_SIZE];
+static EMU_REG regs[EMU_REGS];
+static int nregs;
+
+// SPI byte parser
+static uint8_t out_buff[EMU_OUT_MAX], cmd_buff[8];
+static int out_len, out_pos, cmd_len, cmd_need;
+static bool out_data;
+static int wr_state;
+static uint32_t wr_addr, wr_count, wr_pos;
+
+// Chip state
+static bool booting, accepting, irq_on, msg_active;
+static uint64_t boot_time, accept_time;
+static EMU_MSG msgs[EMU_MSGS];
+static int msg_head, msg_count;
+static EMU_SOCK socks[MAX_SOCKETS];
+static EMU_TX_HANDLER tx_handler;
+
+static uint16_t emu_swap16(uint16_t val)
+{
+    return((uint16_t)((val >> 8) | (val << 8)));
+}
+
+// Register storage
+static uint32_t *reg_ptr(uint32_t addr)
+{
+    int i;
+
+    for (i = 0; i < nregs; i++)
+    {
+        if (regs[i].addr == addr)
+            return(&regs[i].val);
+    }
+    if (nregs >= EMU_REGS)
+        return(&regs[EMU_REGS - 1].val);
+    regs[nregs].addr = addr;
+    regs[nregs].val = 0;
+    return(&regs[nregs++].val);
+}
+
+// Reset chip, and set up initial register and memory values
+void emu_reset(void)
+{
+    static const uint16_t info_table[4] = {0, 0x100, 0x200, 0};
+    static const uint8_t mac[6] = {0xf8, 0xf0, 0x05, 0x00, 0x00, 0x01};
+    static const uint8_t info[8] = {0, 0, 0, 0, 19, 6, 1, 0};
+
+    now_ns = 0;
+    memset(mem, 0, sizeof(mem));
+    memset(socks, 0, sizeof(socks));
+    nregs = out_len = out_pos = cmd_len = cmd_need = 0;
+    out_data = false;
+    wr_state = WR_IDLE;
+    booting = accepting = irq_on = msg_active = false;
+    msg_head = msg_count = 0;
+    *reg_ptr(EFUSE_REG) = 1u << 31;
+    *reg_ptr(HOST_WAIT_REG) = 0;
+    *reg_ptr(BOOTROM_REG) = FINISH_BOOT_VAL;
+    *reg_ptr(CHIPID_REG) = 0x1503a0;
+    *reg_ptr(REVID_REG) = 0x3;
+    *reg_ptr(NMI_GP_REG2) = 0;
+    memcpy(&mem[EMU_INFO_ADDR], info_table, sizeof(info_table));
+    memcpy(&mem[EMU_INFO_ADDR + 0x100], mac, sizeof(mac));
+    memcpy(&mem[EMU_INFO_ADDR + 0x200], info, sizeof(info));
+}
+
+uint64_t emu_time_ns(void)
+{
+    return(now_ns);
+}
+
+// Advance time, e.g. for host processing
+void emu_advance(uint64_t ns)
+{
+    now_ns += ns;
+}
+
+void emu_set_tx_handler(EMU_TX_HANDLER handler)
+{
+    tx_handler = handler;
+}
+
+// Add message for host, after the response time
+static void msg_add(uint16_t gop, void *data, int len, void *data2, int len2)
+{
+    EMU_MSG *mp;
+    uint64_t t = now_ns + emu_params.resp_ns;
+
+    if (msg_count >= EMU_MSGS || len + len2 > (int)EMU_MAX_MSG)
+        return;
+    if (msg_count && msgs[(msg_head + msg_count - 1) % EMU_MSGS].time > t)
+        t = msgs[(msg_head + msg_count - 1) % EMU_MSGS].time;
+    mp = &msgs[(msg_head + msg_count++) % EMU_MSGS];
+    mp->time = t;
+    mp->gop = gop;
+    mp->len = len + len2;
+    memcpy(mp->data, data, len);
+    if (data2 && len2)
+        memcpy(&mp->data[len], data2, len2);
+}
+
+// Put the next message in the receive buffer, and raise IRQ, if due
+static void msg_post(void)
+{
+    EMU_MSG *mp = &msgs[msg_head];
+    uint8_t *p = &mem[EMU_HIF_RX_ADDR];
+    int len;
+
+    if (msg_active || !msg_count || mp->time > now_ns)
+        return;
+    len = HIF_HDR_SIZE + mp->len;
+    p[0] = (uint8_t)(mp->gop >> 8);
+    p[1] = (uint8_t)mp->gop;
+    p[2] = (uint8_t)len;
+    p[3] = (uint8_t)(len >> 8);
+    memcpy(&p[HIF_HDR_SIZE], mp->data, mp->len);
+    *reg_ptr(RCV_CTRL_REG0) = 1 | (uint32_t)len << 2;
+    msg_active = irq_on = true;
+}
+
+// Host has finished with message
+static void msg_done(void)
+{
+    if (msg_active)
+    {
+        msg_active = irq_on = false;
+        *reg_ptr(RCV_CTRL_REG0) = 0;
+        msg_head = (msg_head + 1) % EMU_MSGS;
+        msg_count--;
+        msg_post();
+    }
+}
+
+// Pass queued data to host, if it has asked for it
+static void sock_deliver(uint8_t sock)
+{
+    EMU_SOCK *sp = &socks[sock];
+    EMU_PKT *pp;
+    RECV_RESP_MSG rm = {
+        .addr = {IP_FAMILY, emu_swap16(sp->peer_port), sp->peer_ip},
+        .oset = sizeof(RECV_RESP_MSG), .sock = sock, .session = sp->session};
+
+    if (sp->recv_pending && !sp->qcount && sp->closing)
+    {
+        rm.dlen = EMU_ERR_CLOSED;
+        msg_add(GOP_RECV, &rm, sizeof(rm), 0, 0);
+        sp->recv_pending = sp->closing = false;
+    }
+    if (!sp->recv_pending || !sp->qcount)
+        return;
+    pp = &sp->q[sp->qhead];
+    rm.addr.ip = pp->ip;
+    rm.addr.port = emu_swap16(pp->port);
+    rm.dlen = (int16_t)pp->len;
+    msg_add(sp->tcp ? GOP_RECV : GOP_RECVFROM, &rm, sizeof(rm), pp->data, pp->len);
+    sp->qhead = (sp->qhead + 1) % EMU_SOCK_QLEN;
+    sp->qcount--;
+    sp->recv_pending = false;
+}
+
+// Add data to socket queue
+static bool sock_queue(uint8_t sock, uint32_t ip, uint16_t port, uint8_t *data, int len)
+{
+    EMU_SOCK *sp = &socks[sock];
+    EMU_PKT *pp;
+
+    if (sp->qcount >= EMU_SOCK_QLEN || len > EMU_MAX_DATA)
+        return(false);
+    pp = &sp->q[(sp->qhead + sp->qcount++) % EMU_SOCK_QLEN];
+    pp->ip = ip;
+    pp->port = port;
+    pp->len = len;
+    memcpy(pp->data, data, len);
+    sock_deliver(sock);
+    return(true);
+}
+
+// Act on HIF message from host
+static void hif_process(uint32_t addr)
+{
+    uint8_t *p = &mem[addr % EMU_MEM_SIZE], *dp = p + HIF_HDR_SIZE;
+    uint16_t gop = GIDOP(p[0], p[1] & 0x7f);
+    uint8_t resp[16] = {0};
+    SENDTO_CMD *scp = (SENDTO_CMD *)dp;
+    uint8_t sock = dp[0];
+    EMU_SOCK *sp;
+
+    switch (gop)
+    {
+    case GOP_BIND:
+        sock = ((BIND_CMD *)dp)->sock;
+        if (sock < MAX_SOCKETS)
+        {
+            sp = &socks[sock];
+            memset(sp, 0, sizeof(EMU_SOCK));
+            sp->state = STATE_BOUND;
+            sp->tcp = sock < MIN_UDP_SOCK;
+            sp->port = emu_swap16(((BIND_CMD *)dp)->saddr.port);
+            sp->session = ((BIND_CMD *)dp)->session;
+            BIND_RESP_MSG br = {sock, 0, sp->session};
+            msg_add(GOP_BIND, &br, sizeof(br), 0, 0);
+        }
+        break;
+    case GOP_LISTEN:
+        if (sock < MAX_SOCKETS)
+        {
+            LISTEN_RESP_MSG lr = {sock, 0, socks[sock].session};
+            msg_add(GOP_LISTEN, &lr, sizeof(lr), 0, 0);
+        }
+        break;
+    case GOP_RECV:
+    case GOP_RECVFROM:
+        sock = ((RECVFROM_CMD *)dp)->sock;
+        if (sock < MAX_SOCKETS)
+        {
+            socks[sock].recv_pending = true;
+            sock_deliver(sock);
+        }
+        break;
+    case GOP_SEND:
+    case GOP_SENDTO:
+        sock = scp->sock;
+        if (sock < MAX_SOCKETS && tx_handler)
+            tx_handler(sock, gop == GOP_SEND, scp->saddr.ip, emu_swap16(scp->saddr.port),
+                       dp + (gop == GOP_SEND ? TCP_DATA_OSET : UDP_DATA_OSET), scp->len);
+        if (emu_params.send_resp)
+        {
+            resp[0] = sock;
+            resp[2] = (uint8_t)scp->len;
+            resp[3] = (uint8_t)(scp->len >> 8);
+            msg_add(gop, resp, 8, 0, 0);
+        }
+        break;
+    case GOP_CLOSE:
+        if (sock < MAX_SOCKETS)
+            memset(&socks[sock], 0, sizeof(EMU_SOCK));
+        break;
+    case GOP_CONN_REQ_OLD:
+    case GOP_CONN_REQ_NEW:
+        resp[0] = 1;
+        msg_add(GOP_STATE_CHANGE, resp, sizeof(resp), 0, 0);
+        DHCP_RESP_MSG dr = {EMU_CHIP_IP, EMU_PEER_IP, EMU_PEER_IP, 0x00ffffff, 3600};
+        msg_add(GOP_DHCP_CONF, &dr, sizeof(dr), 0, 0);
+        break;
+    case GOP_SCAN_REQ:
+        msg_add(GOP_SCAN_DONE, resp, sizeof(SCAN_DONE_MSG), 0, 0);
+        break;
+    }
+}
+
+// Read register
+static uint32_t reg_read(uint32_t addr)
+{
+    uint32_t *rp = reg_ptr(addr);
+
+    if (addr == NMI_STATE_REG && booting && now_ns >= boot_time)
+    {
+        booting = false;
+        *rp = FINISH_INIT_VAL;
+    }
+    else if (addr == RCV_CTRL_REG2 && accepting && now_ns >= accept_time)
+    {
+        accepting = false;
+        *rp &= ~2u;
+        *reg_ptr(RCV_CTRL_REG4) = EMU_HIF_TX_ADDR;
+    }
+    else if (addr == RCV_CTRL_REG0)
+        msg_post();
+    else if (addr == RCV_CTRL_REG1)
+        *rp = EMU_HIF_RX_ADDR;
+    return(*rp);
+}
+
+// Write register
+static void reg_write(uint32_t addr, uint32_t val)
+{
+    uint32_t *rp = reg_ptr(addr);
+
+    if (addr == BOOTROM_REG && val == START_FIRMWARE)
+    {
+        booting = true;
+        boot_time = now_ns + emu_params.boot_ns;
+    }
+    else if (addr == RCV_CTRL_REG2 && (val & 2))
+    {
+        accepting = true;
+        accept_time = now_ns + emu_params.accept_ns;
+    }
+    else if (addr == RCV_CTRL_REG3 && (val & 2))
+        hif_process(val >> 2);
+    else if (addr == RCV_CTRL_REG0)
+    {
+        if (!(val & 1))
+            irq_on = false;
+        if (val & 2)
+        {
+            msg_done();
+            return;
+        }
+    }
+    *rp = val;
+}
+
+// Set response bytes, after given number of polling bytes
+static void out_set(int polls, uint8_t *data, int len, uint8_t *data2, int len2)
+{
+    memset(out_buff, 0, polls);
+    memcpy(&out_buff[polls], data, len);
+    if (data2 && len2)
+        memcpy(&out_buff[polls + len], data2, len2);
+    out_len = polls + len + len2;
+    out_pos = 0;
+    out_data = data2 != 0;
+}
+
+// Execute SPI command
+static void cmd_exec(void)
+{
+    uint8_t *c = cmd_buff, resp[7] = {c[0], 0, DATA_TOKEN};
+    uint32_t addr = (uint32_t)c[1] << 16 | c[2] << 8 | c[3], val, count;
+
+    switch (c[0])
+    {
+    case CMD_INTERNAL_READ:
+        addr = (addr >> 8) & 0x7fff;
+        // Fall through
+    case CMD_SINGLE_READ:
+        val = reg_read(addr);
+        resp[3] = (uint8_t)val;
+        resp[4] = (uint8_t)(val >> 8);
+        resp[5] = (uint8_t)(val >> 16);
+        resp[6] = (uint8_t)(val >> 24);
+        out_set(0, resp, 7, 0, 0);
+        break;
+    case CMD_SINGLE_WRITE:
+        reg_write(addr, (uint32_t)c[4] << 24 | c[5] << 16 | c[6] << 8 | c[7]);
+        out_set(0, resp, 2, 0, 0);
+        break;
+    case CMD_READ_DATA:
+        count = (uint32_t)c[4] << 16 | c[5] << 8 | c[6];
+        count = MIN(count, EMU_MAX_DATA);
+        addr = MIN(addr, EMU_MEM_SIZE - count);
+        out_set(emu_params.poll_bytes, resp, 3, &mem[addr], count);
+        break;
+    case CMD_WRITE_DATA:
+        wr_addr = addr;
+        wr_count = (uint32_t)c[4] << 16 | c[5] << 8 | c[6];
+        wr_pos = 0;
+        wr_state = WR_TOKEN;
+        out_set(0, resp, 2, 0, 0);
+        break;
+    }
+}
+
+// End of write data block
+static void write_done(void)
+{
+    uint8_t resp[2] = {WRITE_ACK, 0};
+
+    wr_state = WR_IDLE;
+    out_set(emu_params.poll_bytes, resp, 2, 0, 0);
+}
+
+// Handle one byte from host, return byte to host
+static uint8_t emu_byte(uint8_t b)
+{
+    uint8_t r = out_pos < out_len ? out_buff[out_pos++] : 0;
+
+    if (out_data)
+        out_data = out_pos < out_len;       // Host bytes ignored during read data
+    else if (wr_state == WR_TOKEN)
+    {
+        if (b == DATA_TOKEN)
+        {
+            wr_state = WR_DATA;
+            if (wr_count == 0)
+                write_done();
+        }
+    }
+    else if (wr_state == WR_DATA)
+    {
+        if (wr_addr + wr_pos < EMU_MEM_SIZE)
+            mem[wr_addr + wr_pos] = b;
+        if (++wr_pos >= wr_count)
+            write_done();
+    }
+    else if (cmd_need)
+    {
+        cmd_buff[cmd_len++] = b;
+        if (cmd_len >= cmd_need)
+        {
+            cmd_need = 0;
+            cmd_exec();
+        }
+    }
+    else if (b == CMD_SINGLE_READ || b == CMD_INTERNAL_READ || b == CMD_SINGLE_WRITE ||
+             b == CMD_READ_DATA || b == CMD_WRITE_DATA)
+    {
+        cmd_buff[0] = b;
+        cmd_len = 1;
+        cmd_need = b == CMD_SINGLE_WRITE ? 8 : b == CMD_READ_DATA || b == CMD_WRITE_DATA ? 7 : 4;
+    }
+    return(r);
+}
+
+// SPI transfer, taking the time it would at the modelled clock; NULL transmit
+// data is zeros, NULL receive data is discarded
+int emu_xfer(uint8_t *txd, uint8_t *rxd, int len)
+{
+    uint8_t b;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        b = emu_byte(txd ? txd[i] : 0);
+        if (rxd)
+            rxd[i] = b;
+    }
+    now_ns += emu_params.xfer_ns + (uint64_t)len * 8 * 1000000000ULL / emu_params.spi_hz;
+    return(len);
+}
+
+// IRQ line level, low if a message is waiting; each read takes a poll time
+int emu_irq(void)
+{
+    now_ns += emu_params.poll_ns;
+    msg_post();
+    return(irq_on ? 0 : 1);
+}
+
+// Datagram from the network to a UDP port
+bool emu_udp_in(uint16_t port, uint32_t ip, uint16_t peer_port, uint8_t *data, int len)
+{
+    int sock;
+
+    for (sock = MIN_UDP_SOCK; sock < MAX_SOCKETS; sock++)
+    {
+        if (socks[sock].state == STATE_BOUND && socks[sock].port == port)
+            return(sock_queue((uint8_t)sock, ip, peer_port, data, len));
+    }
+    return(false);
+}
+
+// TCP connection from the network to a listening port, return socket or -1
+int emu_tcp_connect(uint16_t port, uint32_t ip, uint16_t peer_port)
+{
+    int lsock, sock;
+    ACCEPT_RESP_MSG am = {.addr = {IP_FAMILY, emu_swap16(peer_port), ip}};
+
+    for (lsock = MIN_TCP_SOCK; lsock < MIN_UDP_SOCK; lsock++)
+    {
+        if (socks[lsock].state == STATE_BOUND && socks[lsock].port == port)
+            break;
+    }
+    for (sock = MIN_TCP_SOCK; sock < MIN_UDP_SOCK && socks[sock].state; sock++) ;
+    if (lsock >= MIN_UDP_SOCK || sock >= MIN_UDP_SOCK)
+        return(-1);
+    memset(&socks[sock], 0, sizeof(EMU_SOCK));
+    socks[sock].state = STATE_CONNECTED;
+    socks[sock].tcp = true;
+    socks[sock].port = port;
+    socks[sock].peer_ip = ip;
+    socks[sock].peer_port = peer_port;
+    am.listen_sock = (uint8_t)lsock;
+    am.conn_sock = (uint8_t)sock;
+    msg_add(GOP_ACCEPT, &am, sizeof(am), 0, 0);
+    return(sock);
+}
+
+// TCP data from the network to a connected socket
+bool emu_tcp_in(int sock, uint8_t *data, int len)
+{
+    if (sock < 0 || sock >= MIN_UDP_SOCK || socks[sock].state != STATE_CONNECTED)
+        return(false);
+    return(sock_queue((uint8_t)sock, socks[sock].peer_ip, socks[sock].peer_port, data, len));
+}
+
+// TCP connection closed by the network; the driver is told after any data
+void emu_tcp_close(int sock)
+{
+    if (sock >= 0 && sock < MIN_UDP_SOCK && socks[sock].state == STATE_CONNECTED)
+    {
+        socks[sock].closing = true;
+        sock_deliver((uint8_t)sock);
+    }
+}
+
+// Free space in socket receive queue
+int emu_sock_space(int sock)
+{
+    return(sock >= 0 && sock < MAX_SOCKETS ? EMU_SOCK_QLEN - socks[sock].qcount : 0);
+}
+
+// Number of messages waiting to be sent to the host
+int emu_rx_queued(void)
+{
+    return(msg_count);
+}
+
+// EOF
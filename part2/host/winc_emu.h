@@ -0,0 +1,61 @@
+// SPI-level emulator of the ATWINC1500, for host builds of the driver
+//
+// Emulates the chip as seen on the SPI bus: register and data commands, the
+// HIF message exchange, IRQ line, and enough of the firmware's socket layer
+// for UDP and TCP servers. The network side is driven by the caller, which
+// injects datagrams and TCP data, and is called with data the driver sends.
+//
+// Time is virtual: each SPI transfer takes its duration at the modelled
+// SPI clock, plus a fixed overhead, so timings translate to hardware.
+
+#ifndef WINC_EMU_H
+#define WINC_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timing model
+typedef struct {
+    uint32_t spi_hz;        // SPI clock
+    uint32_t xfer_ns;       // Overhead per transfer (chip select, call)
+    uint32_t poll_ns;       // Time for one host poll of IRQ line or timer
+    uint32_t poll_bytes;    // Bytes before chip responds to data command
+    uint32_t accept_ns;     // Time for chip to accept HIF message
+    uint32_t resp_ns;       // Time for chip to respond to HIF message
+    uint32_t boot_ns;       // Firmware start time
+    bool send_resp;         // Chip sends a response to each send or sendto
+} EMU_PARAMS;
+
+#define EMU_DEFAULT_PARAMS {10416667, 1000, 100, 1, 5000, 20000, 20000000, true}
+
+// Address of emulated network peer, and the chip's own address
+#define EMU_PEER_IP         (10 | 1 << 8 | 1 << 16 | 2 << 24)
+#define EMU_CHIP_IP         (10 | 1 << 8 | 1 << 16 | 11 << 24)
+#define EMU_PEER_PORT       5000
+
+// TCP status given to the driver when the peer closes: "Client closed"
+#define EMU_ERR_CLOSED      (-12)
+
+// Called with data sent by the driver; tcp is false for UDP. The peer
+// address is as given by the driver, with the IP address in network order
+typedef void (*EMU_TX_HANDLER)(uint8_t sock, bool tcp, uint32_t ip, uint16_t port,
+                               uint8_t *data, int len);
+
+extern EMU_PARAMS emu_params;
+
+void emu_reset(void);
+uint64_t emu_time_ns(void);
+void emu_advance(uint64_t ns);
+int emu_xfer(uint8_t *txd, uint8_t *rxd, int len);
+int emu_irq(void);
+void emu_set_tx_handler(EMU_TX_HANDLER handler);
+bool emu_udp_in(uint16_t port, uint32_t ip, uint16_t peer_port, uint8_t *data, int len);
+int emu_tcp_connect(uint16_t port, uint32_t ip, uint16_t peer_port);
+bool emu_tcp_in(int sock, uint8_t *data, int len);
+void emu_tcp_close(int sock);
+int emu_sock_space(int sock);
+int emu_rx_queued(void);
+
+#endif // WINC_EMU_H
+
+// EOF
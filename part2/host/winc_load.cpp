@@ -0,0 +1,487 @@
+// Load generator for the module's UDP and TCP echo servers
+//
+// Runs a number of flows (UDP sockets or TCP connections) in parallel, each
+// with a sending and a receiving thread. In closed-loop mode a flow keeps a
+// fixed number of messages in flight, sending the next when one returns; in
+// open-loop mode messages are sent on a fixed schedule whatever the replies,
+// and latency is measured from the scheduled time, so a stalled server shows
+// as latency rather than a lower send rate.
+//
+// Each message starts with a header giving the flow, sequence number and
+// length, followed by a pattern derived from them, so echoes are checked
+// byte for byte. UDP messages with no reply within the timeout are counted
+// as lost; a TCP timeout ends the flow.
+//
+// Works against a module, or the emulator bridge on 127.0.0.1:
+//   winc_load -a 10.1.1.11 -r 1 -v 2           # One message per second, in hex
+//   winc_load -c 4 -s 16-1400 -d 10            # 4 UDP flows, closed loop
+//   winc_load -t -c 2 -o -r 500 -s 64,512,1400 # 2 TCP connections, open loop
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define LOAD_MAGIC      0x57494e43      // "WINC"
+#define LOAD_HDR_LEN    16
+#define LOAD_MAX_LEN    1400
+#define LOAD_MAX_FLOWS  64
+
+typedef std::chrono::steady_clock Clock;
+
+// Message header, at the start of each payload
+struct LoadHdr {
+    uint32_t magic;
+    uint16_t flow, len;
+    uint32_t seq, x;
+};
+
+// Message in flight
+struct Pending {
+    uint32_t seq;
+    int len;
+    Clock::time_point t;
+};
+
+// Settings
+struct Options {
+    std::string addr = "127.0.0.1";
+    int port = 1025;
+    bool tcp = false, open_loop = false, json = false;
+    int flows = 1, window = 1, timeout_ms = 1000, verbose = 0;
+    double rate = 0, duration = 10;
+    std::vector<int> sizes = {64};
+    bool size_range = false;
+};
+
+// Per-flow state and results
+struct Flow {
+    int id = 0, fd = -1;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::unordered_map<uint32_t, Pending> pending;    // UDP, by sequence number
+    std::deque<Pending> stream;                       // TCP, in order sent
+    bool failed = false, done = false;
+    uint64_t sent = 0, received = 0, bad = 0, lost = 0, unexpected = 0, bytes = 0;
+    std::vector<uint32_t> lats;                       // Latencies (ns)
+};
+
+static Options opts;
+static std::atomic<uint64_t> total_sent(0), total_rcvd(0);
+
+// Fill payload with header and pattern
+static void make_msg(uint8_t *buff, int flow, uint32_t seq, int len)
+{
+    LoadHdr hdr = {LOAD_MAGIC, (uint16_t)flow, (uint16_t)len, seq, 0};
+
+    memcpy(buff, &hdr, LOAD_HDR_LEN);
+    for (int i = LOAD_HDR_LEN; i < len; i++)
+        buff[i] = (uint8_t)(seq * 31 + i * 7 + flow);
+}
+
+// Check echoed payload against what was sent
+static bool check_msg(uint8_t *buff, int flow, uint32_t seq, int len)
+{
+    LoadHdr hdr;
+
+    memcpy(&hdr, buff, LOAD_HDR_LEN);
+    if (hdr.magic != LOAD_MAGIC || hdr.flow != flow || hdr.seq != seq || hdr.len != len)
+        return(false);
+    for (int i = LOAD_HDR_LEN; i < len; i++)
+    {
+        if (buff[i] != (uint8_t)(seq * 31 + i * 7 + flow))
+            return(false);
+    }
+    return(true);
+}
+
+// Print message in hex
+static void print_hex(const char *s, uint8_t *data, int len)
+{
+    printf("%s %u:", s, len);
+    for (int i = 0; i < len; i++)
+        printf(" %02x", data[i]);
+    printf("\n");
+}
+
+// Choose a message size
+static int next_size(std::mt19937 &rng)
+{
+    if (opts.size_range)
+        return(std::uniform_int_distribution<int>(opts.sizes[0], opts.sizes[1])(rng));
+    return(opts.sizes[std::uniform_int_distribution<size_t>(0, opts.sizes.size() - 1)(rng)]);
+}
+
+// Record a reply, given the message it matches
+static void got_reply(Flow &f, Pending &p, uint8_t *data, int len)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - p.t).count();
+
+    if (len != p.len || !check_msg(data, f.id, p.seq, len))
+        f.bad++;
+    else
+    {
+        f.received++;
+        f.bytes += len;
+        f.lats.push_back((uint32_t)std::min<int64_t>(ns, UINT32_MAX));
+        total_rcvd++;
+    }
+    if (opts.verbose > 1)
+        print_hex("Rx", data, len);
+}
+
+// Count UDP messages with no reply as lost
+static void expire(Flow &f, Clock::time_point now)
+{
+    auto tout = std::chrono::milliseconds(opts.timeout_ms);
+
+    for (auto it = f.pending.begin(); it != f.pending.end(); )
+    {
+        if (now - it->second.t > tout)
+        {
+            it = f.pending.erase(it);
+            f.lost++;
+        }
+        else
+            ++it;
+    }
+}
+
+// Receive UDP replies
+static void udp_receiver(Flow &f)
+{
+    uint8_t buff[65536];
+
+    for (;;)
+    {
+        int n = (int)recv(f.fd, buff, sizeof(buff), 0);
+        std::unique_lock<std::mutex> lk(f.lock);
+
+        if (n >= LOAD_HDR_LEN)
+        {
+            LoadHdr hdr;
+            memcpy(&hdr, buff, LOAD_HDR_LEN);
+            auto it = f.pending.find(hdr.seq);
+            if (it == f.pending.end())
+                f.unexpected++;
+            else
+            {
+                got_reply(f, it->second, buff, n);
+                f.pending.erase(it);
+            }
+        }
+        else if (n > 0)
+            f.bad++;
+        expire(f, Clock::now());
+        f.cv.notify_all();
+        if (f.done && f.pending.empty())
+            break;
+    }
+}
+
+// Receive TCP replies, in the order sent
+static void tcp_receiver(Flow &f)
+{
+    uint8_t buff[LOAD_MAX_LEN];
+    int have = 0, n;
+
+    for (;;)
+    {
+        std::unique_lock<std::mutex> lk(f.lock);
+        if (f.done && f.stream.empty())
+            break;
+        if (f.stream.empty())
+        {
+            f.cv.wait_for(lk, std::chrono::milliseconds(100));
+            continue;
+        }
+        Pending p = f.stream.front();
+        lk.unlock();
+        n = (int)recv(f.fd, &buff[have], p.len - have, 0);
+        lk.lock();
+        if (n > 0 && (have += n) == p.len)
+        {
+            got_reply(f, p, buff, p.len);
+            f.stream.pop_front();
+            have = 0;
+        }
+        else if (n == 0 ||
+                 (n < 0 && Clock::now() - p.t > std::chrono::milliseconds(opts.timeout_ms)))
+        {
+            f.lost += f.stream.size();
+            f.stream.clear();
+            f.failed = f.done = true;
+        }
+        f.cv.notify_all();
+    }
+}
+
+// Send messages for the test duration
+static void sender(Flow &f)
+{
+    uint8_t buff[LOAD_MAX_LEN];
+    std::mt19937 rng(f.id + 1);
+    Clock::time_point start = Clock::now(), end, t;
+    std::chrono::nanoseconds interval(0);
+    uint32_t seq = 0;
+    int len;
+
+    end = start + std::chrono::milliseconds((int64_t)(opts.duration * 1000));
+    if (opts.rate > 0)
+        interval = std::chrono::nanoseconds((int64_t)(1e9 * opts.flows / opts.rate));
+    for (;; seq++)
+    {
+        t = opts.rate > 0 ? start + interval * seq : Clock::now();
+        if (t >= end)
+            break;
+        std::this_thread::sleep_until(t);
+        std::unique_lock<std::mutex> lk(f.lock);
+        if (!opts.open_loop)
+        {
+            while (!f.failed && (int)(f.pending.size() + f.stream.size()) >= opts.window &&
+                   Clock::now() < end)
+                f.cv.wait_for(lk, std::chrono::milliseconds(10));
+            if (Clock::now() >= end)
+                break;
+            t = std::max(t, Clock::now());
+        }
+        if (f.failed)
+            break;
+        len = next_size(rng);
+        make_msg(buff, f.id, seq, len);
+        Pending p = {seq, len, opts.open_loop ? t : Clock::now()};
+        if (opts.tcp)
+            f.stream.push_back(p);
+        else
+            f.pending[seq] = p;
+        f.cv.notify_all();
+        lk.unlock();
+        if (opts.verbose > 1)
+            print_hex("Tx", buff, len);
+        if (send(f.fd, buff, len, MSG_NOSIGNAL) != len)
+        {
+            lk.lock();
+            f.failed = true;
+            break;
+        }
+        f.sent++;
+        total_sent++;
+    }
+    std::unique_lock<std::mutex> lk(f.lock);
+    f.done = true;
+    f.cv.notify_all();
+}
+
+// Open socket for flow, connected to the server
+static bool flow_open(Flow &f)
+{
+    struct sockaddr_in sa = {};
+    struct timeval tv = {0, 100000};
+    int one = 1;
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(opts.port);
+    sa.sin_addr.s_addr = inet_addr(opts.addr.c_str());
+    f.fd = socket(AF_INET, opts.tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (f.fd < 0 || connect(f.fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("connect");
+        return(false);
+    }
+    setsockopt(f.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (opts.tcp)
+        setsockopt(f.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return(true);
+}
+
+// Get value at percentile from sorted latencies (us)
+static double percentile(std::vector<uint32_t> &lats, double pct)
+{
+    if (lats.empty())
+        return(0);
+    size_t i = std::min(lats.size() - 1, (size_t)(lats.size() * pct / 100));
+    return(lats[i] / 1e3);
+}
+
+// Parse size list "64,256", or range "16-1400"
+static bool parse_sizes(const char *s)
+{
+    int a, b;
+
+    opts.sizes.clear();
+    opts.size_range = sscanf(s, "%d-%d", &a, &b) == 2;
+    if (opts.size_range)
+        opts.sizes = {a, b};
+    else
+    {
+        for (const char *p = s; p && *p; p = strchr(p, ','), p = p ? p + 1 : p)
+            opts.sizes.push_back(atoi(p));
+    }
+    for (int &n : opts.sizes)
+    {
+        if (n <= 0 || n > LOAD_MAX_LEN)
+            return(false);
+        n = std::max(n, LOAD_HDR_LEN);
+    }
+    return(!opts.sizes.empty() && (!opts.size_range || opts.sizes[0] <= opts.sizes[1]));
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: winc_load [options]\n");
+    fprintf(stderr, "  -a addr   Server address (default %s)\n", opts.addr.c_str());
+    fprintf(stderr, "  -p port   Server port (default %d)\n", opts.port);
+    fprintf(stderr, "  -t        TCP (default UDP)\n");
+    fprintf(stderr, "  -c n      Flows: UDP sockets or TCP connections (default 1)\n");
+    fprintf(stderr, "  -r rate   Total messages per second (default 0: as fast as replies allow)\n");
+    fprintf(stderr, "  -o        Open loop: send at the rate, whatever the replies\n");
+    fprintf(stderr, "  -w n      Closed loop: messages in flight per flow (default 1)\n");
+    fprintf(stderr, "  -s sizes  Payload sizes: 64, 64,256,1400 or 16-1400 (default 64)\n");
+    fprintf(stderr, "  -d secs   Duration (default 10)\n");
+    fprintf(stderr, "  -T ms     Reply timeout (default 1000)\n");
+    fprintf(stderr, "  -j        Print result as JSON\n");
+    fprintf(stderr, "  -v n      1: progress every second, 2: also messages in hex\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:tc:r:ow:s:d:T:jv:")) != -1)
+    {
+        if (opt == 'a')
+            opts.addr = optarg;
+        else if (opt == 'p')
+            opts.port = atoi(optarg);
+        else if (opt == 't')
+            opts.tcp = true;
+        else if (opt == 'c')
+            opts.flows = atoi(optarg);
+        else if (opt == 'r')
+            opts.rate = atof(optarg);
+        else if (opt == 'o')
+            opts.open_loop = true;
+        else if (opt == 'w')
+            opts.window = atoi(optarg);
+        else if (opt == 's')
+        {
+            if (!parse_sizes(optarg))
+                usage();
+        }
+        else if (opt == 'd')
+            opts.duration = atof(optarg);
+        else if (opt == 'T')
+            opts.timeout_ms = atoi(optarg);
+        else if (opt == 'j')
+            opts.json = true;
+        else if (opt == 'v')
+            opts.verbose = atoi(optarg);
+        else
+            usage();
+    }
+    if (opts.flows < 1 || opts.flows > LOAD_MAX_FLOWS || opts.window < 1 ||
+        (opts.open_loop && opts.rate <= 0))
+        usage();
+
+    std::vector<Flow> flows(opts.flows);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.flows; i++)
+    {
+        flows[i].id = i;
+        if (!flow_open(flows[i]))
+            return(1);
+    }
+    if (!opts.json)
+        printf("%s %s:%d, %d flow%s, %s loop, rate %s\n", opts.tcp ? "TCP" : "UDP",
+               opts.addr.c_str(), opts.port, opts.flows, opts.flows > 1 ? "s" : "",
+               opts.open_loop ? "open" : "closed",
+               opts.rate > 0 ? std::to_string((int)opts.rate).c_str() : "max");
+    Clock::time_point start = Clock::now();
+    for (Flow &f : flows)
+    {
+        threads.emplace_back(sender, std::ref(f));
+        threads.emplace_back(opts.tcp ? tcp_receiver : udp_receiver, std::ref(f));
+    }
+    if (opts.verbose == 1)
+    {
+        uint64_t last_sent = 0, last_rcvd = 0;
+        for (int secs = 1; secs <= (int)opts.duration; secs++)
+        {
+            std::this_thread::sleep_until(start + std::chrono::seconds(secs));
+            uint64_t s = total_sent, r = total_rcvd;
+            printf("%3d s: sent %llu received %llu\n", secs,
+                   (unsigned long long)(s - last_sent), (unsigned long long)(r - last_rcvd));
+            fflush(stdout);
+            last_sent = s;
+            last_rcvd = r;
+        }
+    }
+    for (std::thread &t : threads)
+        t.join();
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Combine flow results
+    Flow all;
+    for (Flow &f : flows)
+    {
+        all.sent += f.sent;
+        all.received += f.received;
+        all.bad += f.bad;
+        all.lost += f.lost;
+        all.unexpected += f.unexpected;
+        all.bytes += f.bytes;
+        all.failed |= f.failed;
+        all.lats.insert(all.lats.end(), f.lats.begin(), f.lats.end());
+        close(f.fd);
+    }
+    std::sort(all.lats.begin(), all.lats.end());
+    double mean = 0;
+    for (uint32_t l : all.lats)
+        mean += l / 1e3;
+    mean = all.lats.empty() ? 0 : mean / all.lats.size();
+    if (opts.json)
+        printf("{\"proto\":\"%s\",\"flows\":%d,\"mode\":\"%s\",\"rate\":%.1f,\"secs\":%.3f,"
+               "\"sent\":%llu,\"received\":%llu,\"bad\":%llu,\"lost\":%llu,\"unexpected\":%llu,"
+               "\"msgs_per_sec\":%.1f,\"mbit_per_sec\":%.3f,\"lat_mean_us\":%.1f,"
+               "\"lat_p50_us\":%.1f,\"lat_p90_us\":%.1f,\"lat_p99_us\":%.1f,"
+               "\"lat_p999_us\":%.1f,\"lat_max_us\":%.1f}\n",
+               opts.tcp ? "tcp" : "udp", opts.flows, opts.open_loop ? "open" : "closed",
+               opts.rate, secs, (unsigned long long)all.sent, (unsigned long long)all.received,
+               (unsigned long long)all.bad, (unsigned long long)all.lost,
+               (unsigned long long)all.unexpected, all.received / secs,
+               all.bytes * 8 / secs / 1e6, mean, percentile(all.lats, 50),
+               percentile(all.lats, 90), percentile(all.lats, 99), percentile(all.lats, 99.9),
+               percentile(all.lats, 100));
+    else
+    {
+        printf("Sent %llu, received %llu, bad %llu, lost %llu, unexpected %llu%s\n",
+               (unsigned long long)all.sent, (unsigned long long)all.received,
+               (unsigned long long)all.bad, (unsigned long long)all.lost,
+               (unsigned long long)all.unexpected, all.failed ? " (flow failed)" : "");
+        printf("Throughput %.1f msgs/s, %.3f Mbit/s echoed in %.1f s\n",
+               all.received / secs, all.bytes * 8 / secs / 1e6, secs);
+        printf("Latency us: mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+               mean, percentile(all.lats, 50), percentile(all.lats, 90),
+               percentile(all.lats, 99), percentile(all.lats, 99.9), percentile(all.lats, 100));
+    }
+    return(all.bad || all.failed ? 2 : 0);
+}
+
+// EOF
@@ -0,0 +1,310 @@
+// Replay of ATWINC1500 SPI captures through the driver, running on Linux
+//
+// The firmware application and driver are built unmodified, with the Pico
+// SDK SPI, GPIO and timer functions replaced by this file, which feeds them
+// the chip responses and IRQ levels from a log made by winc_capture.c. The
+// transmitted bytes are checked against the log, so a change in the driver's
+// behaviour shows up as a divergence, and the driver counters and latency
+// histograms at the end show the cost of the session.
+//
+// Time is taken from the log: it advances by 1 us per timer read until the
+// time of the next recorded event, so delay loops finish as they did when
+// captured, and each transfer or IRQ read sets it to the recorded time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_capture.h"
+
+// Timer reads without reaching the next event, before giving up
+#define MAX_STALLS      100000000
+
+// Largest transfer in the log format
+#define CAP_MAX_XFER    0x10000
+
+extern int verbose;
+
+int app_main(int argc, char *argv[]);
+
+static uint8_t *log_data;
+static uint32_t log_len, log_pos;
+static uint32_t irq_n, irq_pin = ~0u;
+static int irq_last = 1;
+static uint32_t clock_us, stalls;
+static bool keep_going, started;
+static gpio_irq_callback_t irq_callback;
+
+// Counts for summary
+static uint32_t nxfers, nbytes, nirqs, nmismatch;
+
+// Append hex bytes from text line to log
+static void add_hex(char *s)
+{
+    unsigned val;
+
+    while (sscanf(s, "%2x", &val) == 1)
+    {
+        log_data[log_len++] = (uint8_t)val;
+        s += 2;
+    }
+}
+
+// Load binary log, or the first dump in a UART log
+static bool load_log(char *fname)
+{
+    FILE *f = fopen(fname, "rb");
+    char line[200];
+    bool in_dump = false, done = false;
+    long size;
+
+    if (!f)
+    {
+        perror(fname);
+        return(false);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    log_data = malloc(size + 1);
+    if (fread(log_data, 1, 4, f) == 4 && !memcmp(log_data, CAP_MAGIC, 4))
+        log_len = 4 + (uint32_t)fread(&log_data[4], 1, size - 4, f);
+    else
+    {
+        rewind(f);
+        while (!done && fgets(line, sizeof(line), f))
+        {
+            if (!strncmp(line, "CAP_START", 9))
+                in_dump = true;
+            else if (in_dump && !strncmp(line, "CD ", 3))
+                add_hex(&line[3]);
+            else if (in_dump && !strncmp(line, "CAP_END", 7))
+                done = true;
+        }
+    }
+    fclose(f);
+    if (log_len < CAP_HDR_LEN || memcmp(log_data, CAP_MAGIC, 4) || log_data[4] != CAP_VERSION)
+    {
+        printf("%s: no capture log found\n", fname);
+        return(false);
+    }
+    log_pos = CAP_HDR_LEN;
+    return(true);
+}
+
+// Find IRQ pin from the first IRQ record
+static void find_irq_pin(void)
+{
+    uint32_t pos = CAP_HDR_LEN;
+
+    while (pos < log_len)
+    {
+        if (log_data[pos] == CAP_IRQ)
+        {
+            irq_pin = log_data[pos + 5];
+            return;
+        }
+        pos += CAP_XFER_LEN + 2 * CAP_U16(&log_data[pos + 5]);
+    }
+}
+
+// Write log in binary form
+static bool save_log(char *fname)
+{
+    FILE *f = fopen(fname, "wb");
+    bool ok = f && fwrite(log_data, 1, log_len, f) == log_len;
+
+    if (f)
+        fclose(f);
+    if (!ok)
+        perror(fname);
+    return(ok);
+}
+
+// End of replay: print summary and driver counters, then exit
+static void replay_end(char *reason, int status)
+{
+    started = false;
+    fflush(stdout);
+    printf("\n=== Replay %s at offset %u of %u ===\n", reason, log_pos, log_len);
+    printf("%u transfers, %u bytes, %u IRQ reads, %u mismatches, %.3f s\n",
+           nxfers, nbytes, nirqs, nmismatch, clock_us / 1e6);
+    stats_snapshot(&winc_stats);
+    stats_print(&winc_stats);
+    hist_print();
+    exit(status);
+}
+
+// Time of the next event in the log
+static uint32_t next_time(void)
+{
+    uint8_t *p = &log_data[log_pos];
+    uint32_t t, count, last;
+
+    if (log_pos >= log_len)
+        return(clock_us);
+    t = CAP_U32(&p[1]);
+    if (p[0] == CAP_IRQ && (count = CAP_U32(&p[7])) > 1)
+    {
+        last = CAP_U32(&p[11]);
+        t += (uint32_t)((uint64_t)(last - t) * irq_n / (count - 1));
+    }
+    return(t);
+}
+
+// Timer, advancing towards the next event in the log
+uint32_t time_us_32(void)
+{
+    if ((int32_t)(next_time() - clock_us) > 0)
+        clock_us++;
+    else if (started && ++stalls > MAX_STALLS)
+        replay_end("stalled waiting for time", 1);
+    return(clock_us);
+}
+
+// SPI transfer: check transmit data, return recorded receive data
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    uint8_t *p = &log_data[log_pos];
+    uint16_t rlen;
+
+    if (log_pos >= log_len)
+        replay_end("complete", 0);
+    if (p[0] != CAP_XFER)
+        replay_end("diverged: SPI transfer where log has IRQ read", 1);
+    rlen = CAP_U16(&p[5]);
+    if (rlen != len || memcmp(&p[CAP_XFER_LEN], src, len))
+    {
+        nmismatch++;
+        if (verbose || !keep_going)
+        {
+            printf("Transfer %u: sent %u bytes, log has %u\n  Sent:", nxfers, (unsigned)len, rlen);
+            dump_hex((uint8_t *)src, (int)len, 16, " ");
+            printf("  Log: ");
+            dump_hex(&p[CAP_XFER_LEN], rlen, 16, " ");
+        }
+        if (!keep_going)
+            replay_end("diverged: transmit data differs", 1);
+    }
+    memset(dst, 0, len);
+    memcpy(dst, &p[CAP_XFER_LEN + rlen], MIN(len, rlen));
+    clock_us = CAP_U32(&p[1]);
+    stalls = 0;
+    log_pos += CAP_XFER_LEN + 2 * rlen;
+    nxfers++;
+    nbytes += (uint32_t)len;
+    return((int)len);
+}
+
+// SPI read, sending a fixed byte
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    static uint8_t txd[CAP_MAX_XFER];
+
+    len = MIN(len, sizeof(txd));
+    memset(txd, repeated_tx_data, len);
+    return(spi_write_read_blocking(spi, txd, dst, len));
+}
+
+// SPI write, discarding receive data
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    static uint8_t rxd[CAP_MAX_XFER];
+
+    return(spi_write_read_blocking(spi, src, rxd, MIN(len, sizeof(rxd))));
+}
+
+// GPIO input: IRQ level from log, other pins low
+bool gpio_get(uint gpio)
+{
+    uint8_t *p = &log_data[log_pos];
+    int level;
+
+    if (gpio != irq_pin)
+        return(false);
+    if (log_pos >= log_len)
+        replay_end("complete", 0);
+    if (p[0] != CAP_IRQ)
+        replay_end("diverged: IRQ read where log has SPI transfer", 1);
+    level = p[6];
+    clock_us = next_time();
+    stalls = 0;
+    if (++irq_n >= CAP_U32(&p[7]))
+    {
+        irq_n = 0;
+        log_pos += CAP_IRQ_LEN;
+    }
+    nirqs++;
+    if (irq_last && !level && irq_callback)
+        irq_callback(gpio, GPIO_IRQ_EDGE_FALL);
+    irq_last = level;
+    return(level);
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled,
+                                        gpio_irq_callback_t callback)
+{
+    irq_callback = enabled ? callback : NULL;
+}
+
+// Delay, advancing the clock
+void sleep_ms(uint32_t ms)
+{
+    clock_us += ms * 1000;
+}
+
+// Hardware setup has no effect
+bool stdio_init_all(void)                                   { return(true); }
+void gpio_init(uint gpio)                                   { }
+void gpio_set_dir(uint gpio, bool out)                      { }
+void gpio_set_function(uint gpio, uint fn)                  { }
+void gpio_pull_up(uint gpio)                                { }
+void gpio_put(uint gpio, bool value)                        { }
+uint spi_init(spi_inst_t *spi, uint baudrate)               { return(baudrate); }
+void spi_set_format(spi_inst_t *spi, uint data_bits, uint cpol, uint cpha, uint order) { }
+
+static void usage(void)
+{
+    printf("Usage: winc_replay [options] logfile\n"
+           "  logfile      Binary capture, or UART log containing a capture dump\n"
+           "  -k           Keep going if transmit data differs from log\n"
+           "  -o file      Save capture in binary form\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char *outfile = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ko:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k': keep_going = true;                    break;
+        case 'o': outfile = optarg;                     break;
+        default:  usage();                              return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage();
+        return 1;
+    }
+    if (!load_log(argv[optind]) || (outfile && !save_log(outfile)))
+        return 1;
+    find_irq_pin();
+    clock_us = next_time();
+    started = true;
+    app_main(1, argv);
+    replay_end("application exited", 0);
+    return 0;
+}
+
+// EOF
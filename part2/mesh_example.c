@@ -15,6 +15,8 @@
 #include "winc_wifi.h"
 #include "winc_sock.h"
 #include "winc_p2p.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
 
 #define VERBOSE     2           // Diagnostic output level (0 to 3)
 #define SPI_SPEED   11000000    // SPI clock (actually 10.42 MHz)
@@ -35,6 +37,10 @@
 #define MESH_NODE_NAME   "PicoNode1"
 #define P2P_CHAN         1
 
+#if !MESH_ENABLE
+#error "The mesh needs the larger buffer pool: build with WINC_MESH on"
+#endif
+
 #define MESH_UDP_PORT    1025
 #define MESH_TCP_PORT    1026
 
@@ -46,23 +52,32 @@ uint32_t usec(void)
     return(time_us_32());
 }
 
-// Do SPI transfer
+// Do SPI transfer; if no transmit data, send zeros, if no receive data, discard it
 int spi_xfer(int fd, uint8_t *txd, uint8_t *rxd, int len)
 {
+    STATS_INC(spi.xfers);
+    STATS_ADD(spi.bytes, len);
+    TRACE_BEGIN(TR_SPI_XFER, len);
     if (verbose > 2)
     {
         printf("  Tx:");
         for (int i=0; i<len; i++)
-            printf(" %02X", txd[i]);
+            printf(" %02X", txd ? txd[i] : 0);
     }
     gpio_put(CS_PIN, 0);
-    spi_write_read_blocking(SPI_PORT, txd, rxd, len);
+    if (!txd)
+        spi_read_blocking(SPI_PORT, 0, rxd, len);
+    else if (!rxd)
+        spi_write_blocking(SPI_PORT, txd, len);
+    else
+        spi_write_read_blocking(SPI_PORT, txd, rxd, len);
     while (gpio_get(SCK_PIN)) ;
     gpio_put(CS_PIN, 1);
+    TRACE_END(TR_SPI_XFER, len);
     if (verbose > 2)
     {
         printf("\n  Rx:");
-        for (int i=0; i<len; i++)
+        for (int i=0; rxd && i<len; i++)
             printf(" %02X", rxd[i]);
         printf("\n");
     }
@@ -103,7 +118,24 @@ void spi_setup(int fd)
     sleep_ms(1);
 }
 
-// Custom mesh data handler
+// Application handler for mesh payloads, reassembled if fragmented
+void mesh_app_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    printf("\n=== Mesh Payload Received ===\n");
+    printf("From node: %u, Length: %u\n", src_node, len);
+    printf("Data: ");
+    for (int i = 0; i < len && i < 64; i++)
+    {
+        if (data[i] >= 32 && data[i] < 127)
+            putchar(data[i]);
+        else
+            printf("<%02X>", data[i]);
+    }
+    printf("%s\n", len > 64 ? "..." : "");
+    printf("========================\n\n");
+}
+
+// Custom socket data handler
 void mesh_data_rx_handler(int fd, uint8_t sock, int rxlen)
 {
     uint8_t data[256];
@@ -139,6 +171,7 @@ int main(void)
     int sock_udp, sock_tcp;
     uint32_t last_beacon = 0;
     uint32_t last_status = 0;
+    uint32_t last_search = 0;
 
     verbose = VERBOSE;
 
@@ -219,10 +252,15 @@ int main(void)
         return -1;
     }
 
+    // Look for P2P peers, then again every P2P_SEARCH_INTERVAL
+    if (!p2p_start_search(fd))
+        printf("WARNING: Failed to start peer search\n");
+
     // Set up sockets for mesh communication
     printf("Setting up mesh communication sockets...\n");
 
-    sock_udp = open_sock_server(MESH_UDP_PORT, 0, mesh_data_rx_handler);
+    mesh_set_handler(mesh_app_handler);
+    sock_udp = mesh_open_sock(MESH_UDP_PORT);
     if (sock_udp < 0)
     {
         printf("ERROR: Failed to create UDP socket!\n");
@@ -267,11 +305,19 @@ int main(void)
         // Handle mesh beacon processing
         mesh_beacon_handler(fd);
 
+        // Search for P2P peers periodically, to keep the peer table fresh
+        if (now - last_search > P2P_SEARCH_INTERVAL)
+        {
+            p2p_start_search(fd);
+            last_search = now;
+        }
+
         // Print status every 30 seconds
         if (now - last_status > 30000)
         {
             printf("\n--- Status Update (Loop: %lu) ---\n", loop_count);
             mesh_print_routing_table();
+            p2p_print_peers();
             printf("P2P Mode: %s\n", is_p2p_enabled() ? "Enabled" : "Disabled");
             printf("Mesh Mode: %s\n", is_mesh_enabled() ? "Enabled" : "Disabled");
             printf("--------------------------------\n\n");
@@ -0,0 +1,196 @@
+# Analyse SPI bus use in a WINC1500 driver capture
+#
+# Reads a capture made by winc_capture.c, either the hex dump in a UART log
+# or a binary file saved by winc_replay -o, and follows the SPI protocol to
+# split bus time into commands (including register zero tails, data headers
+# and write tokens), polls, HIF messages, socket payload and idle time. The
+# payload bandwidth is given as a fraction of the SPI clock, and the command
+# overhead is broken down further, with the most-used registers, so the
+# largest costs can be found.
+#
+# python3 spi_analyze.py uart.log
+# python3 spi_analyze.py -j session.cap          # JSON
+# python3 spi_analyze.py --hz 20000000 uart.log  # Other SPI clock
+import sys, struct, json, argparse, collections
+
+CAP_MAGIC, CAP_HDR_LEN, CAP_XFER, CAP_IRQ, CAP_IRQ_LEN = b"WCAP", 5, 1, 2, 15
+CMD_WRITE_DATA, CMD_READ_DATA, CMD_SINGLE_WRITE = 0xc7, 0xc8, 0xc9
+CMD_SINGLE_READ, CMD_INTERNAL_READ, DATA_TOKEN, WRITE_ACK = 0xca, 0xc4, 0xf3, 0xc3
+RCV_CTRL_REG0, RCV_CTRL_REG3 = 0x1070, 0x106c
+GID_IP, SOCK_OPS = 2, (69, 70, 71, 72)      # Send, recv, sendto, recvfrom
+REG_NAMES = {0x1070: "RCV_CTRL_REG0", 0x1084: "RCV_CTRL_REG1", 0x1078: "RCV_CTRL_REG2",
+             0x106c: "RCV_CTRL_REG3", 0x150400: "RCV_CTRL_REG4", 0x108c: "NMI_STATE_REG",
+             0x1014: "EFUSE_REG", 0x1000: "CHIPID_REG", 0xc000c: "BOOTROM_REG"}
+
+# Load log from UART text, or binary
+def load(fname):
+    data = open(fname, "rb").read()
+    if data.startswith(CAP_MAGIC):
+        return data
+    log, in_dump = bytearray(), False
+    for line in data.decode(errors="replace").splitlines():
+        fields = line.split()
+        if fields and fields[0] == "CAP_START":
+            log, in_dump = bytearray(), True
+        elif fields and fields[0] == "CAP_END" and in_dump:
+            break
+        elif in_dump and len(fields) == 2 and fields[0] == "CD":
+            log += bytes.fromhex(fields[1])
+    return bytes(log)
+
+# Get transfers from log, as (time, tx, rx)
+def transfers(log):
+    pos, last = CAP_HDR_LEN, None
+    while pos < len(log):
+        typ = log[pos]
+        if typ == CAP_XFER and pos + 7 <= len(log):
+            t, n = struct.unpack_from("<IH", log, pos + 1)
+            tx, rx = log[pos + 7:pos + 7 + n], log[pos + 7 + n:pos + 7 + 2 * n]
+            pos += 7 + 2 * n
+            yield t, tx, rx
+        elif typ == CAP_IRQ:
+            pos += CAP_IRQ_LEN
+        else:
+            break
+
+class Analyser:
+    def __init__(self):
+        self.bytes = collections.Counter()      # Bytes by category
+        self.cmd = collections.Counter()        # Command bytes by kind
+        self.reg_reads, self.reg_writes = collections.Counter(), collections.Counter()
+        self.xfers, self.first, self.last, self.end, self.base = 0, None, None, 0, 0
+        self.state = "idle"
+        self.count = self.put_block = self.rx_block = 0
+        self.put_sock = self.rx_sock = False
+
+    # Account for data block, as HIF message or socket payload
+    def data(self, block, write):
+        if write:
+            if self.put_block == 0 and len(block) >= 2:
+                self.put_sock = block[0] == GID_IP and (block[1] & 0x7f) in SOCK_OPS
+            payload = self.put_sock and self.put_block >= 2
+            self.put_block += 1
+        else:
+            if self.rx_block == 0 and len(block) >= 2:
+                self.rx_sock = block[0] == GID_IP and (block[1] & 0x7f) in SOCK_OPS
+            payload = self.rx_sock and self.rx_block >= 2
+            self.rx_block += 1
+        self.bytes["payload" if payload else "hif"] += len(block)
+        self.bytes["data_write" if write else "data_read"] += len(block)
+
+    # Classify transfer from idle state, i.e. a new command
+    def command(self, tx, rx):
+        n, c = len(tx), tx[0] if tx else 0
+        if c in (CMD_SINGLE_READ, CMD_INTERNAL_READ) and n >= 4:
+            addr = tx[1] << 16 | tx[2] << 8 | tx[3]
+            self.reg_reads[(addr >> 8) & 0x7fff if c == CMD_INTERNAL_READ else addr] += 1
+            self.cmd["reg_read"] += 4
+            self.cmd["reg_read_tail"] += n - 4
+        elif c == CMD_SINGLE_WRITE and n >= 8:
+            addr, val = tx[1] << 16 | tx[2] << 8 | tx[3], struct.unpack(">I", tx[4:8])[0]
+            self.reg_writes[addr] += 1
+            self.cmd["reg_write"] += n
+            if addr == RCV_CTRL_REG3:
+                self.put_block = 0
+            elif addr == RCV_CTRL_REG0:
+                self.rx_block = 0
+        elif c in (CMD_READ_DATA, CMD_WRITE_DATA) and n >= 7:
+            self.count = tx[4] << 16 | tx[5] << 8 | tx[6]
+            self.cmd["data_cmd"] += n
+            self.state = "rd_poll" if c == CMD_READ_DATA else "wr_data"
+        else:
+            self.bytes["other"] += n
+            return
+        self.bytes["command"] += n
+
+    def xfer(self, t, tx, rx):
+        # Unwrap 32-bit microsecond time
+        if self.last is not None and t < self.last and self.last - t > 0x80000000:
+            self.base += 1 << 32
+        self.last = t
+        t += self.base
+        if self.first is None:
+            self.first = t
+        self.end, self.xfers = t, self.xfers + 1
+        n, s = len(tx), self.state
+        self.state = "idle"
+        if s == "rd_poll" and n == 1:
+            self.bytes["poll"] += 1
+            self.cmd["read_poll"] += 1
+            self.state = "rd_hdr" if rx[0] == CMD_READ_DATA else "rd_poll" if rx[0] == 0 else "idle"
+        elif s == "rd_hdr" and n == 2:
+            self.bytes["command"] += 2
+            self.cmd["read_hdr_skip"] += 2
+            self.state = "rd_data"
+        elif s == "rd_data" and n == self.count:
+            self.data(rx, False)
+        elif s == "wr_data" and n == self.count + 1 and tx[0] == DATA_TOKEN:
+            self.bytes["command"] += 1
+            self.cmd["write_token"] += 1
+            self.data(tx[1:], True)
+            self.state = "wr_poll"
+        elif s == "wr_poll" and n == 1:
+            self.bytes["poll"] += 1
+            self.cmd["write_poll"] += 1
+            self.state = "wr_ack" if rx[0] == WRITE_ACK else "wr_poll"
+        elif s == "wr_ack" and n == 1:
+            self.bytes["poll"] += 1
+            self.cmd["write_ack"] += 1
+        else:
+            self.command(tx, rx)
+
+    # Results, with times in us at the given clock
+    def result(self, hz):
+        us = lambda n: n * 8e6 / hz
+        total = sum(self.bytes[k] for k in ("command", "poll", "hif", "payload", "other"))
+        span = max(self.end - self.first if self.first is not None else 0, us(total))
+        times = {k: us(self.bytes[k]) for k in ("command", "poll", "hif", "payload", "other")}
+        times["idle"] = span - us(total)
+        payload = self.bytes["payload"]
+        return {
+            "spi_hz": hz, "span_us": span, "xfers": self.xfers, "bus_bytes": total,
+            "bytes": {k: self.bytes[k] for k in ("command", "poll", "hif", "payload", "other",
+                                                 "data_read", "data_write")},
+            "time_us": times,
+            "time_pct": {k: 100.0 * v / span if span else 0 for k, v in times.items()},
+            "command_bytes": dict(self.cmd.most_common()),
+            "reg_reads": {"0x%x" % a: c for a, c in self.reg_reads.most_common()},
+            "reg_writes": {"0x%x" % a: c for a, c in self.reg_writes.most_common()},
+            "payload_kbit_per_sec": payload * 8e3 / span if span else 0,
+            "payload_clock_pct": 100.0 * us(payload) / span if span else 0,
+            "bus_bytes_per_payload_byte": total / payload if payload else 0}
+
+def report(r):
+    print("SPI %u Hz, %u transfers, %u bytes in %.1f ms" %
+          (r["spi_hz"], r["xfers"], r["bus_bytes"], r["span_us"] / 1e3))
+    print("\n%-10s %10s %12s %7s" % ("Bus time", "bytes", "us", "%"))
+    for k in ("command", "poll", "hif", "payload", "other", "idle"):
+        print("%-10s %10s %12.1f %6.1f%%" % (k, r["bytes"].get(k, ""), r["time_us"][k],
+                                             r["time_pct"][k]))
+    print("\nPayload %.1f kbit/s, %.2f%% of SPI clock, %.2f bus bytes per payload byte" %
+          (r["payload_kbit_per_sec"], r["payload_clock_pct"], r["bus_bytes_per_payload_byte"]))
+    print("Data blocks: %u bytes read (clocked with zeros), %u written" %
+          (r["bytes"]["data_read"], r["bytes"]["data_write"]))
+    print("\nCommand and poll bytes, largest first:")
+    for k, v in r["command_bytes"].items():
+        print("  %-14s %10u" % (k, v))
+    for title, regs in (("Register reads", r["reg_reads"]), ("Register writes", r["reg_writes"])):
+        print("\n%s, most used:" % title)
+        for a, c in list(regs.items())[:6]:
+            print("  %-8s %-15s %8u" % (a, REG_NAMES.get(int(a, 16), ""), c))
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="SPI bus use in a WINC1500 capture")
+    ap.add_argument("capture", help="UART log with capture dump, or binary capture")
+    ap.add_argument("--hz", type=int, default=10416667, help="SPI clock (default 10416667)")
+    ap.add_argument("-j", action="store_true", help="JSON output")
+    args = ap.parse_args()
+    log = load(args.capture)
+    if not log.startswith(CAP_MAGIC):
+        sys.exit("No capture found in %s" % args.capture)
+    a = Analyser()
+    for t, tx, rx in transfers(log):
+        a.xfer(t, tx, rx)
+    r = a.result(args.hz)
+    print(json.dumps(r, indent=1)) if args.j else report(r)
+# EOF
@@ -0,0 +1,57 @@
+# Convert WINC1500 driver trace dumps to Chrome trace JSON
+#
+# Reads a UART log containing one or more dumps from trace_dump(), and
+# writes JSON that can be opened in https://ui.perfetto.dev or
+# chrome://tracing. Each dump is shown as a separate process.
+#
+# python3 trace2json.py uart.log > trace.json
+import sys, json
+
+# Trace points with a group ID and opcode as argument
+GOP_IDS = ("hif_put", "interrupt_handler", "check_sock")
+
+def convert(lines):
+    events, names, dump, depth = [], {}, 0, {}
+    base = last = None
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "TRACE_START":
+            dump += 1
+            names, depth, base, last = {}, {}, None, None
+            events.append({"name": "process_name", "ph": "M", "pid": dump,
+                           "args": {"name": "Dump %u" % dump}})
+        elif fields[0] == "TN" and len(fields) >= 3:
+            names[int(fields[1])] = fields[2]
+        elif fields[0] == "TE" and len(fields) >= 5 and dump:
+            t, ph, id, arg = int(fields[1]), fields[2], int(fields[3]), int(fields[4])
+            # Unwrap 32-bit microsecond time
+            if base is None:
+                base = t
+            elif t < last and last - t > 0x80000000:
+                base -= 1 << 32
+            last = t
+            name = names.get(id, "id%u" % id)
+            # End events whose begin was overwritten in the ring buffer are dropped
+            if ph == "E":
+                if depth.get(id, 0) == 0:
+                    continue
+                depth[id] -= 1
+            elif ph == "B":
+                depth[id] = depth.get(id, 0) + 1
+            ev = {"name": name, "ph": ph, "ts": t - base, "pid": dump, "tid": 1,
+                  "args": {"arg": ("gid %u op %u" % (arg >> 8, arg & 0x7f))
+                           if name in GOP_IDS else arg}}
+            if ph == "i":
+                ev["s"] = "t"
+            events.append(ev)
+    return events
+
+if __name__ == "__main__":
+    f = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    events = convert(f)
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, sys.stdout, indent=0)
+    print()
+    sys.stderr.write("%u events\n" % len(events))
+# EOF
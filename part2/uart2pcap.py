@@ -0,0 +1,46 @@
+# Convert WINC1500 driver packet output to pcap
+#
+# Reads a UART log, or the serial device itself, and writes the "PK" lines
+# from pcap_sock() as a pcap file, flushing after each packet so the output
+# can be piped into Wireshark. Times are the board's microsecond clock,
+# offset to the wall-clock time the first packet was read.
+#
+# python3 uart2pcap.py uart.log capture.pcap
+# python3 uart2pcap.py /dev/ttyACM0 - | wireshark -k -i -
+import sys, struct, time
+
+LINKTYPE_ETHERNET = 1
+SNAPLEN = 65535
+
+def convert(inf, outf):
+    outf.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, SNAPLEN, LINKTYPE_ETHERNET))
+    outf.flush()
+    count, base, last, wall = 0, 0, None, None
+    for line in inf:
+        fields = line.split()
+        if len(fields) != 4 or fields[0] != "PK":
+            continue
+        try:
+            t, orig_len, frame = int(fields[1]), int(fields[2]), bytes.fromhex(fields[3])
+        except ValueError:
+            continue
+        # Unwrap 32-bit microsecond time
+        if last is None:
+            wall = time.time() - t / 1e6
+        elif t < last and last - t > 0x80000000:
+            base += 1 << 32
+        last = t
+        ts = wall + (base + t) / 1e6
+        secs = int(ts)
+        outf.write(struct.pack("<IIII", secs, int((ts - secs) * 1e6), len(frame), orig_len))
+        outf.write(frame)
+        outf.flush()
+        count += 1
+    return count
+
+if __name__ == "__main__":
+    inf = open(sys.argv[1], errors="replace") if len(sys.argv) > 1 and sys.argv[1] != "-" else sys.stdin
+    outf = open(sys.argv[2], "wb") if len(sys.argv) > 2 and sys.argv[2] != "-" else sys.stdout.buffer
+    n = convert(inf, outf)
+    sys.stderr.write("%u packets\n" % n)
+# EOF
@@ -0,0 +1,347 @@
+// ATWINC1500/1510 WiFi module C++ coroutines for the Pico 2W
+//
+// Awaitable socket operations and timers, for C++20 applications
+// Based on original work by Jeremy P Bentham
+//
+// Request and response protocols can be written as sequential code, rather
+// than a state machine in a socket handler:
+//
+//   winc::Task session(winc::TcpConnection c)
+//   {
+//       int n;
+//       while ((n = co_await winc::recv(c, buff)) > 0)
+//           c.send(winc::Bytes(buff, n));
+//   }                                       // Connection closed here
+//   winc::Task server(winc::TcpListener &l)
+//   {
+//       for (;;)
+//           if (winc::TcpConnection c = co_await winc::accept(l))
+//               session(std::move(c));
+//   }
+//
+// Sockets are opened with async_handler, and the main loop calls poll(),
+// which handles module interrupts, accepted connections and timers. It is
+// all single-threaded: a coroutine runs from the socket handler or poll()
+// until it next waits, so it must not block. Sends complete before they
+// return, as in the C API, so they aren't awaited.
+//
+// Coroutine frames come from a fixed pool of CORO_FRAMES blocks, set in
+// winc_config.h, so no heap is used; if none is free, or the frame is
+// larger than CORO_FRAME_SIZE, the coroutine isn't started, and the Task
+// it returns is false. Each coroutine waits for one thing at a time, and
+// only one can receive on a socket. Data that arrives when no coroutine is
+// waiting, or TCP data beyond the size it asked for, is kept in a buffer
+// pool block until the next recv(); the socket's receive isn't re-armed
+// until then, so further data waits in the module. Data is only dropped if
+// the pool is empty.
+
+#ifndef WINC_ASYNC_HPP
+#define WINC_ASYNC_HPP
+
+#include <string.h>
+#include <coroutine>
+#include <exception>
+#include "winc_sock.hpp"
+
+extern "C" {
+#include "winc_buf.h"
+#include "winc_stats.h"
+}
+
+namespace winc {
+
+// Result of a receive on a socket that isn't open, as the firmware's
+// invalid operation error
+inline constexpr int ERR_INVALID = -9;
+
+// Coroutine frame pool
+struct alignas(16) CoroFrame {
+    uint8_t data[CORO_FRAME_SIZE];
+};
+inline CoroFrame coro_frames[CORO_FRAMES];
+inline bool coro_used[CORO_FRAMES];
+inline size_t coro_max_size;        // Largest frame requested, for tuning
+
+// Get a frame, nullptr if none free or too small
+inline void *coro_alloc(size_t size)
+{
+    coro_max_size = size > coro_max_size ? size : coro_max_size;
+    for (int i = 0; size <= sizeof(CoroFrame) && i < CORO_FRAMES; i++) {
+        if (!coro_used[i]) {
+            coro_used[i] = true;
+            return coro_frames[i].data;
+        }
+    }
+    return nullptr;
+}
+
+// Return a frame to the pool
+inline void coro_free(void *p)
+{
+    coro_used[(CoroFrame *)p - coro_frames] = false;
+}
+
+// Return number of frames in use
+inline int coro_count()
+{
+    int n = 0;
+
+    for (int i = 0; i < CORO_FRAMES; i++)
+        n += coro_used[i];
+    return n;
+}
+
+// Coroutine started by a call, running until it ends; its frame is freed then
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() { return Task(true); }
+        static Task get_return_object_on_allocation_failure() { return Task(false); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+        static void *operator new(size_t size) noexcept { return coro_alloc(size); }
+        static void operator delete(void *p) { coro_free(p); }
+    };
+
+    // True if the coroutine was started
+    explicit operator bool() const { return started_; }
+
+private:
+    explicit Task(bool started) : started_(started) {}
+    bool started_;
+};
+
+// Coroutine waiting for data on a socket, and where to put it
+struct RecvWait {
+    std::coroutine_handle<> h;
+    uint8_t *data;
+    int size, result;
+};
+inline RecvWait recv_waits[MAX_SOCKETS];
+
+// Data received with no coroutine waiting, in a pool block, and how much
+// has been taken; receive on the socket is paused while it is held
+struct RecvHeld {
+    uint8_t *buff;
+    int len, oset, fd;
+    bool full;
+    SOCK_ADDR addr;
+};
+inline RecvHeld recv_held[MAX_SOCKETS];
+
+// Coroutines waiting for a connection, or for a time
+struct AcceptWait {
+    std::coroutine_handle<> h;
+    uint16_t port;
+    uint8_t sock;
+};
+inline AcceptWait accept_waits[CORO_FRAMES];
+struct TimerWait {
+    std::coroutine_handle<> h;
+    uint32_t start, tout;
+};
+inline TimerWait timer_waits[CORO_FRAMES];
+
+// Hold data from an offset in the module's buffer, or a status, and pause receiving
+inline void async_hold(int fd, uint8_t sock, int rxlen, int oset)
+{
+    RecvHeld &r = recv_held[sock];
+    SOCKET *sp = &sockets[sock];
+    int n = rxlen - oset < BUF_SIZE ? rxlen - oset : BUF_SIZE;
+
+    if (r.full || (rxlen > 0 && (r.buff = buf_alloc()) == nullptr)) {
+        STATS_INC(sock[sock].drops);
+        return;
+    }
+    sp->hif_data_addr += oset;
+    r.len = rxlen <= 0 ? rxlen : get_sock_data(fd, sock, r.buff, n) ? n : 0;
+    sp->hif_data_addr -= oset;
+    r.oset = 0;
+    r.fd = fd;
+    r.addr = sp->addr;
+    r.full = true;
+    if (rxlen > 0 || sock >= MIN_UDP_SOCK)
+        sock_rx_pause(sock);
+}
+
+// Read data for a socket into a waiting coroutine, holding the rest of TCP
+// data it has no room for; or hold it all if no coroutine is waiting
+inline void async_rx(int fd, uint8_t sock, int rxlen)
+{
+    RecvWait &w = recv_waits[sock];
+    std::coroutine_handle<> h = w.h;
+    int n = 0;
+
+    if (h) {
+        n = rxlen < w.size ? rxlen : w.size;
+        w.result = rxlen <= 0 ? rxlen : n > 0 && get_sock_data(fd, sock, w.data, n) ? n : 0;
+        w.h = nullptr;
+        if (sock >= MIN_UDP_SOCK)
+            n = rxlen;
+    }
+    if (!h || rxlen > n)
+        async_hold(fd, sock, rxlen, n);
+    if (h)
+        h.resume();
+}
+
+// Handler for sockets used by coroutines; connections accepted on a TCP
+// socket get it too, and are given async_conn_handler when taken by accept()
+inline void async_handler(int fd, uint8_t sock, int rxlen) { async_rx(fd, sock, rxlen); }
+inline void async_conn_handler(int fd, uint8_t sock, int rxlen) { async_rx(fd, sock, rxlen); }
+
+// Awaitable receive, giving the data length, or status if 0 or negative;
+// ERR_INVALID at once if the socket isn't open, e.g. an empty connection
+class Recv {
+public:
+    Recv(uint8_t sock, Bytes b, bool open = true)
+        : sock_(sock), data_(b.data()), size_((int)b.size()), open_(open) {}
+
+    // Take held data if there is any, restoring the sender's address
+    bool await_ready() {
+        RecvHeld &r = recv_held[sock_];
+
+        if (!open_) {
+            result_ = ERR_INVALID;
+            held_ = true;
+            return true;
+        }
+        if (!r.full)
+            return false;
+        result_ = r.len - r.oset < size_ ? r.len - r.oset : size_;
+        if (result_ > 0) {
+            memcpy(data_, r.buff + r.oset, result_);
+            r.oset += result_;
+        }
+        sockets[sock_].addr = r.addr;
+        held_ = true;
+
+        // A datagram is taken at once, TCP data when all read; then receive again
+        if (sock_ >= MIN_UDP_SOCK || r.oset >= r.len) {
+            int fd = r.fd;
+
+            buf_free(r.buff);
+            r = RecvHeld();
+            sock_rx_resume(fd, sock_);
+        }
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        recv_waits[sock_] = RecvWait{h, data_, size_, 0};
+    }
+    int await_resume() { return held_ ? result_ : recv_waits[sock_].result; }
+
+private:
+    uint8_t sock_;
+    uint8_t *data_;
+    int size_, result_ = 0;
+    bool open_, held_ = false;
+};
+
+// Receive on a socket given to a handler, or owned by a Sock
+template <bool Tcp>
+inline Recv recv(const SockRef<Tcp> &s, Bytes b) { return Recv(s.sock(), b); }
+template <bool Tcp>
+inline Recv recv(const Sock<Tcp> &s, Bytes b) { return Recv(s.sock(), b, (bool)s); }
+
+// Find a connection accepted on a port not yet taken, and take it
+inline int accept_take(uint16_t port)
+{
+    for (int sock = MIN_TCP_SOCK; sock < MAX_TCP_SOCK; sock++) {
+        SOCKET *sp = &sockets[sock];
+
+        if (sp->state == STATE_CONNECTED && sp->handler == async_handler && sp->localport == port) {
+            sp->handler = async_conn_handler;
+            return sock;
+        }
+    }
+    return -1;
+}
+
+// Awaitable accept, giving the connection
+class Accept {
+public:
+    explicit Accept(const TcpListener &l) : fd_(l.fd()), port_(sockets[l.sock()].localport) {}
+
+    bool await_ready() { return (sock_ = accept_take(port_)) >= 0; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        for (AcceptWait &w : accept_waits) {
+            if (!w.h) {
+                w = AcceptWait{h, port_, 0};
+                wait_ = &w;
+                return true;
+            }
+        }
+        return false;
+    }
+    // Connection, empty if there were too many coroutines waiting
+    TcpConnection await_resume() {
+        if (wait_)
+            sock_ = wait_->sock;
+        return sock_ < 0 ? TcpConnection() : TcpConnection(TcpSock(fd_, (uint8_t)sock_));
+    }
+
+private:
+    int fd_, sock_ = -1;
+    uint16_t port_;
+    AcceptWait *wait_ = nullptr;
+};
+
+inline Accept accept(const TcpListener &l) { return Accept(l); }
+
+// Awaitable delay
+class Sleep {
+public:
+    explicit Sleep(uint32_t ms) : tout_(ms * 1000) {}
+
+    bool await_ready() { return tout_ == 0; }
+    // Wait, unless there are too many coroutines waiting
+    bool await_suspend(std::coroutine_handle<> h) {
+        for (TimerWait &w : timer_waits) {
+            if (!w.h) {
+                w = TimerWait{h, usec(), tout_};
+                return true;
+            }
+        }
+        return false;
+    }
+    void await_resume() {}
+
+private:
+    uint32_t tout_;
+};
+
+inline Sleep sleep_ms(uint32_t ms) { return Sleep(ms); }
+
+// Handle module interrupt, then resume coroutines with accepted connections
+// or expired timers; call from the main loop
+inline void poll(Chip &chip)
+{
+    std::coroutine_handle<> h;
+    int sock;
+
+    chip.poll();
+    for (AcceptWait &w : accept_waits) {
+        if (w.h && (sock = accept_take(w.port)) >= 0) {
+            w.sock = (uint8_t)sock;
+            h = w.h;
+            w.h = nullptr;
+            h.resume();
+        }
+    }
+    for (TimerWait &w : timer_waits) {
+        if (w.h && usec() - w.start >= w.tout) {
+            h = w.h;
+            w.h = nullptr;
+            h.resume();
+        }
+    }
+}
+
+} // namespace winc
+
+#endif // WINC_ASYNC_HPP
+
+// EOF
@@ -0,0 +1,97 @@
+// ATWINC1500/1510 WiFi module buffer pool for the Pico 2W
+//
+// Fixed-size blocks with reference counts, shared by sockets and mesh
+// Based on original work by Jeremy P Bentham
+//
+// Most large buffers are only needed for the duration of one transfer or
+// one handler call, so rather than each layer having its own, they are taken
+// from a common pool. A block can be passed from one layer to another by
+// taking a reference to it (e.g. a received mesh packet that is forwarded is
+// queued for transmission in the same block), and it returns to the pool
+// when the last reference is freed. The peak number in use is kept, so the
+// pool size can be checked against the application's needs.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_buf.h"
+
+static uint8_t buf_pool[BUF_COUNT][BUF_SIZE] __attribute__((aligned(4)));
+static uint8_t buf_refcount[BUF_COUNT];
+static int buf_nused, buf_peak;
+
+// Get index of block, -ve if not the start of a pool block
+static int buf_index(uint8_t *buff)
+{
+    uintptr_t oset = (uintptr_t)buff - (uintptr_t)buf_pool;
+
+    return(oset < sizeof(buf_pool) && oset % BUF_SIZE == 0 ? (int)(oset / BUF_SIZE) : -1);
+}
+
+// Get a free block with one reference, NULL if none
+uint8_t *buf_alloc(void)
+{
+    int i;
+
+    for (i = 0; i < BUF_COUNT; i++)
+    {
+        if (!buf_refcount[i])
+        {
+            buf_refcount[i] = 1;
+            buf_nused++;
+            buf_peak = MAX(buf_peak, buf_nused);
+            STATS_INC(buf.allocs);
+            return(buf_pool[i]);
+        }
+    }
+    STATS_INC(buf.fails);
+    return(NULL);
+}
+
+// Add a reference to a block, so it is kept until that is freed
+uint8_t *buf_ref(uint8_t *buff)
+{
+    int i = buf_index(buff);
+
+    if (i < 0)
+        return(NULL);
+    buf_refcount[i]++;
+    return(buff);
+}
+
+// Remove a reference, returning the block to the pool if it was the last
+void buf_free(uint8_t *buff)
+{
+    int i = buff ? buf_index(buff) : -1;
+
+    if (i >= 0 && buf_refcount[i] && --buf_refcount[i] == 0)
+        buf_nused--;
+}
+
+// Return number of references to a block, 0 if not a pool block
+int buf_refs(uint8_t *buff)
+{
+    int i = buf_index(buff);
+
+    return(i < 0 ? 0 : buf_refcount[i]);
+}
+
+// Return number of blocks in use
+int buf_used(void)
+{
+    return(buf_nused);
+}
+
+// Print blocks in use and peak since last print
+void buf_print(void)
+{
+    printf("Buffers: %d of %d in use, peak %d, %u bytes each\n",
+           buf_nused, BUF_COUNT, buf_peak, (unsigned)BUF_SIZE);
+    buf_peak = buf_nused;
+}
+
+// EOF
@@ -0,0 +1,25 @@
+// ATWINC1500/1510 WiFi module buffer pool for the Pico 2W
+//
+// Fixed-size blocks with reference counts, shared by sockets and mesh
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_BUF_H
+#define WINC_BUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_config.h"
+
+// Block size: the largest SPI data block
+#define BUF_SIZE            SPI_BUFFLEN
+
+uint8_t *buf_alloc(void);
+uint8_t *buf_ref(uint8_t *buff);
+void buf_free(uint8_t *buff);
+int buf_refs(uint8_t *buff);
+int buf_used(void);
+void buf_print(void);
+
+#endif // WINC_BUF_H
+
+// EOF
@@ -0,0 +1,144 @@
+// ATWINC1500/1510 WiFi module SPI capture for the Pico 2W
+//
+// Records every SPI transfer and IRQ line read, for replay on Linux
+// Based on original work by Jeremy P Bentham
+//
+// The platform spi_xfer() and read_irq() functions pass every transfer and
+// IRQ level to the recorder, which stores them in a RAM buffer. When the
+// buffer is full, capture stops and the log is dumped over the UART as hex;
+// host/winc_replay feeds the recorded chip responses back into the driver.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_capture.h"
+
+uint32_t usec(void);
+
+static uint8_t cap_buff[CAPTURE_SIZE];
+static uint32_t cap_len, cap_irq_oset;
+static bool cap_on, cap_full;
+
+// Put little-endian values into buffer
+static void cap_put16(uint8_t *p, uint16_t val)
+{
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+}
+static void cap_put32(uint8_t *p, uint32_t val)
+{
+    cap_put16(p, (uint16_t)val);
+    cap_put16(p + 2, (uint16_t)(val >> 16));
+}
+
+// Check for space in buffer, stop capture if none
+static bool cap_space(uint32_t len)
+{
+    if (cap_len + len > CAPTURE_SIZE)
+    {
+        cap_on = false;
+        cap_full = true;
+    }
+    return(cap_on);
+}
+
+// Clear buffer and start capture
+void capture_start(void)
+{
+    memcpy(cap_buff, CAP_MAGIC, 4);
+    cap_buff[4] = CAP_VERSION;
+    cap_len = CAP_HDR_LEN;
+    cap_irq_oset = 0;
+    cap_full = false;
+    cap_on = true;
+}
+
+// Stop capture, and clear buffer full indication
+void capture_stop(void)
+{
+    cap_on = false;
+    cap_full = false;
+}
+
+// Check if capture stopped because buffer is full
+bool capture_full(void)
+{
+    return(cap_full);
+}
+
+// Check if capture is running, or stopped but not yet dumped
+bool capture_running(void)
+{
+    return(cap_on || cap_full);
+}
+
+// Record SPI transfer; missing transmit or receive data is recorded as zeros
+void capture_xfer(uint8_t *txd, uint8_t *rxd, int len)
+{
+    uint8_t *p = &cap_buff[cap_len];
+
+    if (cap_on && cap_space(CAP_XFER_LEN + 2 * len))
+    {
+        p[0] = CAP_XFER;
+        cap_put32(&p[1], usec());
+        cap_put16(&p[5], (uint16_t)len);
+        if (txd)
+            memcpy(&p[CAP_XFER_LEN], txd, len);
+        else
+            memset(&p[CAP_XFER_LEN], 0, len);
+        if (rxd)
+            memcpy(&p[CAP_XFER_LEN + len], rxd, len);
+        else
+            memset(&p[CAP_XFER_LEN + len], 0, len);
+        cap_len += CAP_XFER_LEN + 2 * len;
+        cap_irq_oset = 0;
+    }
+}
+
+// Record IRQ level, merging with the last record if it is the same
+void capture_irq(int pin, int level)
+{
+    uint8_t *p = &cap_buff[cap_irq_oset];
+    uint32_t t = usec();
+
+    if (!cap_on)
+        return;
+    if (cap_irq_oset && p[5] == pin && p[6] == level)
+    {
+        cap_put32(&p[7], CAP_U32(&p[7]) + 1);
+        cap_put32(&p[11], t);
+    }
+    else if (cap_space(CAP_IRQ_LEN))
+    {
+        cap_irq_oset = cap_len;
+        p = &cap_buff[cap_len];
+        p[0] = CAP_IRQ;
+        cap_put32(&p[1], t);
+        p[5] = (uint8_t)pin;
+        p[6] = (uint8_t)level;
+        cap_put32(&p[7], 1);
+        cap_put32(&p[11], t);
+        cap_len += CAP_IRQ_LEN;
+    }
+}
+
+// Dump log as hex, 32 bytes per line
+void capture_dump(void)
+{
+    bool on = cap_on;
+    uint32_t n;
+
+    cap_on = false;
+    printf("CAP_START %lu\n", (unsigned long)cap_len);
+    for (n = 0; n < cap_len; n++)
+    {
+        if (n % 32 == 0)
+            printf("%sCD ", n ? "\n" : "");
+        printf("%02X", cap_buff[n]);
+    }
+    printf("\nCAP_END\n");
+    cap_on = on;
+}
+
+// EOF
@@ -0,0 +1,48 @@
+// ATWINC1500/1510 WiFi module SPI capture for the Pico 2W
+//
+// Records every SPI transfer and IRQ line read, for replay on Linux
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_CAPTURE_H
+#define WINC_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "winc_config.h"
+
+// Log starts with magic and version; then records, with little-endian values:
+//   CAP_XFER: type, time (4), len (2), tx data (len), rx data (len)
+//   CAP_IRQ:  type, time (4), pin, level, count (4), time of last read (4)
+// Consecutive reads of the same IRQ level are merged into one record
+#define CAP_MAGIC           "WCAP"
+#define CAP_VERSION         1
+#define CAP_HDR_LEN         5
+#define CAP_XFER            1
+#define CAP_IRQ             2
+#define CAP_XFER_LEN        7
+#define CAP_IRQ_LEN         15
+
+#if CAPTURE_ENABLE
+#define CAPTURE_XFER(txd, rxd, len)     capture_xfer(txd, rxd, len)
+#define CAPTURE_IRQ(pin, level)         capture_irq(pin, level)
+#else
+#define CAPTURE_XFER(txd, rxd, len)     ((void)0)
+#define CAPTURE_IRQ(pin, level)         ((void)0)
+#endif
+
+void capture_start(void);
+void capture_stop(void);
+bool capture_full(void);
+bool capture_running(void);
+void capture_xfer(uint8_t *txd, uint8_t *rxd, int len);
+void capture_irq(int pin, int level);
+void capture_dump(void);
+
+// Get little-endian values from log
+#define CAP_U16(p)          ((uint16_t)((p)[0] | (p)[1] << 8))
+#define CAP_U32(p)          ((uint32_t)((p)[0] | (p)[1] << 8 | (p)[2] << 16 | (uint32_t)(p)[3] << 24))
+
+#endif // WINC_CAPTURE_H
+
+// EOF
@@ -0,0 +1,94 @@
+// ATWINC1500/1510 WiFi module driver configuration for the Pico 2W
+//
+// Build-time settings for the driver library, in one place
+// Based on original work by Jeremy P Bentham
+//
+// Each value can be overridden with a compile definition. The CMake options
+// in winc_driver.cmake set them on the winc_driver library, and pass them on
+// to everything linked with it, so the library and application always agree.
+// Features that are off are compiled out.
+
+#ifndef WINC_CONFIG_H
+#define WINC_CONFIG_H
+
+// Join with the newer connect message format
+#ifndef NEW_JOIN
+#define NEW_JOIN            0
+#endif
+
+// Largest SPI data block, and the size of a buffer pool block
+#ifndef SPI_BUFFLEN
+#define SPI_BUFFLEN         1600
+#endif
+
+// Mesh networking in the application, which needs a larger buffer pool
+#ifndef MESH_ENABLE
+#define MESH_ENABLE         0
+#endif
+
+// Buffer pool blocks. Sockets need one for the packet being handled, one
+// held by a coroutine or batch, and a spare; the mesh needs a full transmit
+// queue and a received packet. Increase if the application keeps blocks
+#ifndef BUF_COUNT
+#if MESH_ENABLE
+#define BUF_COUNT           10
+#else
+#define BUF_COUNT           3
+#endif
+#endif
+
+// Performance counters, 0 to compile out all counting
+#ifndef STATS_ENABLE
+#define STATS_ENABLE        1
+#endif
+
+// Event tracing, 1 to compile in; ring buffer size must be a power of 2
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE        0
+#endif
+#ifndef TRACE_SIZE
+#define TRACE_SIZE          4096
+#endif
+
+// SPI capture for replay, 1 to compile in; buffer size in bytes
+#ifndef CAPTURE_ENABLE
+#define CAPTURE_ENABLE      0
+#endif
+#ifndef CAPTURE_SIZE
+#define CAPTURE_SIZE        (128 * 1024)
+#endif
+
+// Socket payloads output as packets, 1 to compile in; maximum payload
+// bytes output per packet, the full length is still given
+#ifndef PCAP_ENABLE
+#define PCAP_ENABLE         0
+#endif
+#ifndef PCAP_SNAPLEN
+#define PCAP_SNAPLEN        256
+#endif
+
+// Received datagrams queued per UDP socket for get_sock_batch(), and the
+// pool blocks all batch sockets may hold together, until freed; the rest of
+// the pool is kept for receiving, sending and the mesh
+#ifndef UDP_BATCH_LEN
+#define UDP_BATCH_LEN       8
+#endif
+#ifndef UDP_BATCH_BUFS
+#if MESH_ENABLE
+#define UDP_BATCH_BUFS      (BUF_COUNT - 4)
+#else
+#define UDP_BATCH_BUFS      (BUF_COUNT - 2)
+#endif
+#endif
+
+// C++ coroutine frames, in winc_async.hpp: number, and size of each
+#ifndef CORO_FRAMES
+#define CORO_FRAMES         8
+#endif
+#ifndef CORO_FRAME_SIZE
+#define CORO_FRAME_SIZE     256
+#endif
+
+#endif // WINC_CONFIG_H
+
+// EOF
@@ -0,0 +1,62 @@
+# ATWINC1500/1510 WiFi module driver library, for the Pico or a Linux host
+#
+# include(winc_driver.cmake) after pico_sdk_init() (or project() on a host),
+# then link winc_driver to the application. The options are passed to the
+# driver sources and the application as compile definitions; see winc_config.h
+#
+# cmake -DWINC_MESH=ON -DWINC_TRACE=ON ..
+# cmake -DWINC_BUF_COUNT=16 ..
+# cmake -DWINC_STATS=OFF -DWINC_LTO=ON ..
+
+set(WINC_DRIVER_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+option(WINC_STATS    "Performance counters"                  ON)
+option(WINC_TRACE    "Event tracing"                         OFF)
+option(WINC_CAPTURE  "SPI capture for replay"                OFF)
+option(WINC_PCAP     "Socket payloads output as packets"     OFF)
+option(WINC_NEW_JOIN "Join with newer connect message format" OFF)
+option(WINC_MESH     "Mesh networking, with a larger buffer pool" OFF)
+option(WINC_LTO      "Link-time optimisation"                OFF)
+set(WINC_SPI_BUFFLEN 1600 CACHE STRING "Largest SPI data block, and buffer pool block size")
+set(WINC_BUF_COUNT   ""   CACHE STRING "Number of buffer pool blocks, if not the default")
+set(WINC_TRACE_SIZE  4096 CACHE STRING "Trace events, a power of 2")
+
+# Link-time optimisation for the driver and application, so the platform
+# spi_xfer() can be inlined into the register and data functions
+if(WINC_LTO)
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT WINC_LTO_OK OUTPUT WINC_LTO_ERR)
+    if(WINC_LTO_OK)
+        set(CMAKE_INTERPROCEDURAL_OPTIMIZATION ON)
+    else()
+        message(WARNING "WINC_LTO: not supported by compiler: ${WINC_LTO_ERR}")
+    endif()
+endif()
+
+# Only the objects an application needs are linked from the library
+add_library(winc_driver STATIC
+    ${WINC_DRIVER_DIR}/winc_wifi.c    ${WINC_DRIVER_DIR}/winc_sock.c
+    ${WINC_DRIVER_DIR}/winc_p2p.c     ${WINC_DRIVER_DIR}/winc_gw.c
+    ${WINC_DRIVER_DIR}/winc_stats.c   ${WINC_DRIVER_DIR}/winc_trace.c
+    ${WINC_DRIVER_DIR}/winc_buf.c     ${WINC_DRIVER_DIR}/winc_capture.c
+    ${WINC_DRIVER_DIR}/winc_pcap.c)
+target_include_directories(winc_driver PUBLIC ${WINC_DRIVER_DIR})
+target_compile_definitions(winc_driver PUBLIC
+    STATS_ENABLE=$<BOOL:${WINC_STATS}>
+    TRACE_ENABLE=$<BOOL:${WINC_TRACE}>
+    CAPTURE_ENABLE=$<BOOL:${WINC_CAPTURE}>
+    PCAP_ENABLE=$<BOOL:${WINC_PCAP}>
+    NEW_JOIN=$<BOOL:${WINC_NEW_JOIN}>
+    MESH_ENABLE=$<BOOL:${WINC_MESH}>
+    SPI_BUFFLEN=${WINC_SPI_BUFFLEN}
+    TRACE_SIZE=${WINC_TRACE_SIZE})
+if(WINC_BUF_COUNT)
+    target_compile_definitions(winc_driver PUBLIC BUF_COUNT=${WINC_BUF_COUNT})
+endif()
+
+# Pico SDK, or the host replacements of its headers
+if(DEFINED PICO_SDK_VERSION_STRING)
+    target_link_libraries(winc_driver PUBLIC pico_stdlib hardware_spi)
+else()
+    target_include_directories(winc_driver PUBLIC ${WINC_DRIVER_DIR}/host/include)
+endif()
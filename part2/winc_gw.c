@@ -0,0 +1,231 @@
+// ATWINC1500/1510 WiFi module mesh gateway for the Pico 2W
+//
+// Bridges P2P mesh traffic to a collector on an infrastructure network
+// Based on original work by Jeremy P Bentham
+//
+// The ATWINC1500 can't run station and P2P modes together, so the gateway
+// normally time-slices: mesh payloads addressed to it are batched while the
+// mesh is active, then it leaves the mesh, joins the upstream network, sends
+// the batches to a UDP collector and returns. Mesh packets queued meanwhile
+// are held in the mesh transmit queues. With GW_CONCURRENT set, the upstream
+// connection is kept up and batches are sent as soon as they are ready.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_p2p.h"
+#include "winc_gw.h"
+
+static GW_STATUS gw;
+static GW_BATCH gw_batches[GW_BATCH_BUFFS];
+static int gw_head, gw_tail, gw_used;
+static int gw_sock = -1;
+static uint16_t gw_seq;
+static uint8_t gw_node;
+static char *gw_ssid, *gw_pass;
+static SOCK_ADDR gw_collector;
+
+extern int verbose;
+extern SOCKET sockets[MAX_SOCKETS];
+
+char *gw_state_strs[] = {"mesh", "joining", "flushing", "leaving", "failed"};
+
+// Change gateway state
+static void gw_set_state(int state)
+{
+    if (verbose)
+        printf("Gateway %s -> %s\n", gw_state_strs[gw.state], gw_state_strs[state]);
+    gw.state = state;
+    gw.state_time = time_us_32() / 1000;
+    gw.tries = 0;
+}
+
+// Initialise gateway, given upstream network and collector address
+bool gw_init(int fd, char *ssid, char *pass, uint32_t collector_ip, uint16_t collector_port)
+{
+    memset(&gw, 0, sizeof(gw));
+    memset(gw_batches, 0, sizeof(gw_batches));
+    gw_head = gw_tail = gw_used = 0;
+    gw_seq = 0;
+    gw_ssid = ssid;
+    gw_pass = pass;
+    gw_collector.family = IP_FAMILY;
+    gw_collector.port = swap16(collector_port);
+    gw_collector.ip = collector_ip;
+    gw.state = GW_STATE_MESH;
+    gw.state_time = time_us_32() / 1000;
+
+    gw_sock = open_sock_server(GW_LOCAL_PORT, 0, 0);
+    if (gw_sock < 0)
+    {
+        printf("No socket for gateway\n");
+        return false;
+    }
+#if GW_CONCURRENT
+    return join_net(fd, gw_ssid, gw_pass);
+#else
+    return true;
+#endif
+}
+
+// Mesh handler, queues payloads for the collector
+void gw_mesh_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    gw_queue(src_node, data, len);
+}
+
+// Add a mesh payload to the current batch, return false if dropped
+bool gw_queue(uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    GW_BATCH *bp = &gw_batches[gw_tail];
+    GW_REC_HDR rh = {src_node, 0, len};
+    int need = sizeof(GW_REC_HDR) + len;
+
+    if (need > GW_BATCH_SIZE - (int)sizeof(GW_BATCH_HDR))
+    {
+        gw.dropped++;
+        return false;
+    }
+
+    // Move on to a new batch if this one is full
+    if (bp->count && bp->len + need > GW_BATCH_SIZE)
+    {
+        if (gw_used >= GW_BATCH_BUFFS)
+        {
+            gw.dropped++;
+            if (verbose)
+                printf("Gateway buffers full, payload from node %u dropped\n", src_node);
+            return false;
+        }
+        gw_tail = (gw_tail + 1) % GW_BATCH_BUFFS;
+        bp = &gw_batches[gw_tail];
+        bp->count = 0;
+    }
+    if (!bp->count)
+    {
+        gw_used++;
+        bp->len = sizeof(GW_BATCH_HDR);
+        bp->start_time = time_us_32() / 1000;
+    }
+
+    memcpy(&bp->data[bp->len], &rh, sizeof(rh));
+    memcpy(&bp->data[bp->len + sizeof(rh)], data, len);
+    bp->len += need;
+    bp->count++;
+    gw.records++;
+    return true;
+}
+
+// Send oldest batch to the collector
+static bool gw_send_batch(int fd)
+{
+    GW_BATCH *bp = &gw_batches[gw_head];
+    GW_BATCH_HDR bh = {GW_MAGIC, gw_node, bp->count, gw_seq++, 0};
+    bool ok;
+
+    memcpy(bp->data, &bh, sizeof(bh));
+    memcpy(&sockets[gw_sock].addr, &gw_collector, sizeof(SOCK_ADDR));
+    ok = put_sock_sendto(fd, gw_sock, bp->data, bp->len);
+    if (verbose)
+        printf("Gateway batch %u, %u records, %u bytes %s\n",
+               bh.seq, bp->count, bp->len, ok ? "sent" : "failed");
+
+    bp->count = 0;
+    gw_used--;
+    if (gw_head != gw_tail)
+        gw_head = (gw_head + 1) % GW_BATCH_BUFFS;
+    gw.batches_sent += ok;
+    return ok;
+}
+
+// Check if the upstream network is usable for sending
+static bool gw_upstream_ready(void)
+{
+    return wifi_ip != 0 && gw_sock >= 0 && sockets[gw_sock].state == STATE_BOUND;
+}
+
+// Run gateway state machine, call regularly from main loop
+void gw_poll(int fd)
+{
+    uint32_t now = time_us_32() / 1000;
+    GW_BATCH *bp = &gw_batches[gw_head];
+
+    gw_node = mesh_local_node();
+    switch (gw.state)
+    {
+    case GW_STATE_MESH:
+#if GW_CONCURRENT
+        if (gw_used && gw_upstream_ready())
+            gw_set_state(GW_STATE_FLUSHING);
+#else
+        // Leave the mesh when batches are nearly full, or the oldest is too old
+        if (gw_used && (now - gw.state_time) > GW_MESH_MIN_TIME &&
+            (gw_used >= GW_BATCH_BUFFS-1 || (now - bp->start_time) > GW_FLUSH_INTERVAL))
+        {
+            mesh_disable(fd);
+            p2p_disable(fd);
+            wifi_ip = 0;
+            join_net(fd, gw_ssid, gw_pass);
+            gw_set_state(GW_STATE_JOINING);
+        }
+#endif
+        break;
+
+    case GW_STATE_JOINING:
+        if (gw_upstream_ready())
+            gw_set_state(GW_STATE_FLUSHING);
+        else if ((now - gw.state_time) > GW_JOIN_TIMEOUT)
+        {
+            printf("Gateway can't join upstream network\n");
+            gw.join_fails++;
+            gw_set_state(GW_STATE_LEAVING);
+        }
+        break;
+
+    case GW_STATE_FLUSHING:
+        // One batch per poll, so interrupts are serviced in between
+        if (gw_used && gw_upstream_ready())
+            gw_send_batch(fd);
+        else
+            gw_set_state(GW_CONCURRENT ? GW_STATE_MESH : GW_STATE_LEAVING);
+        break;
+
+    case GW_STATE_LEAVING:
+        // Disconnect once, then retry the mesh at intervals, as the module
+        // may still be taking down the station link
+        if (gw.tries && (now - gw.state_time) < GW_LEAVE_RETRY)
+            break;
+        if (gw.tries == 0)
+            hif_put(fd, GOP_DISCONNECT, NULL, 0, 0, 0, 0);
+        if (p2p_enable(fd, P2P_LISTEN_CHAN) && mesh_enable(fd))
+            gw_set_state(GW_STATE_MESH);
+        else if (++gw.tries >= GW_LEAVE_TRIES)
+        {
+            printf("Gateway can't restart mesh\n");
+            gw.leave_fails++;
+            gw_set_state(GW_STATE_FAILED);
+        }
+        else
+            gw.state_time = now;
+        break;
+
+    case GW_STATE_FAILED:
+        if ((now - gw.state_time) > GW_FAIL_RETRY)
+            gw_set_state(GW_STATE_LEAVING);
+        break;
+    }
+}
+
+// Print gateway status
+void gw_print_status(void)
+{
+    printf("Gateway %s: %u records, %u batches sent, %u dropped, %u join fails, "
+           "%u leave fails, %d buffered\n", gw_state_strs[gw.state], gw.records,
+           gw.batches_sent, gw.dropped, gw.join_fails, gw.leave_fails, gw_used);
+}
+
+// EOF
@@ -0,0 +1,74 @@
+// ATWINC1500/1510 WiFi module mesh gateway definitions for the Pico 2W
+//
+// Bridges P2P mesh traffic to a collector on an infrastructure network
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_GW_H
+#define WINC_GW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Gateway configuration
+#define GW_CONCURRENT       0      // 1 if firmware can run station and P2P together
+#define GW_BATCH_SIZE       1024   // Max bytes in one batch datagram
+#define GW_BATCH_BUFFS      4      // Batches buffered while mesh is active
+#define GW_FLUSH_INTERVAL   10000  // Max age of a batch before upstream slice (ms)
+#define GW_MESH_MIN_TIME    5000   // Min time in mesh between upstream slices (ms)
+#define GW_JOIN_TIMEOUT     15000  // Time allowed to join upstream network (ms)
+#define GW_LEAVE_RETRY      1000   // Interval between attempts to restart mesh (ms)
+#define GW_LEAVE_TRIES      5      // Attempts before waiting in failed state
+#define GW_FAIL_RETRY       30000  // Time in failed state before trying again (ms)
+#define GW_LOCAL_PORT       1030   // Local UDP port for collector traffic
+#define GW_MAGIC            0x4d47 // 'GM', start of each batch datagram
+
+// IP address in SOCK_ADDR byte order
+#define GW_IP(a, b, c, d)   ((a) | (b)<<8 | (c)<<16 | (uint32_t)(d)<<24)
+
+// Gateway states
+#define GW_STATE_MESH       0      // P2P mesh active, batching traffic
+#define GW_STATE_JOINING    1      // Joining upstream network
+#define GW_STATE_FLUSHING   2      // Sending batches to collector
+#define GW_STATE_LEAVING    3      // Returning to mesh
+#define GW_STATE_FAILED     4      // Mesh couldn't be restarted, waiting to retry
+
+// Batch datagram header
+typedef struct {
+    uint16_t magic;
+    uint8_t gw_node;       // Node ID of gateway
+    uint8_t count;         // Number of records that follow
+    uint16_t seq;
+    uint16_t x;
+} GW_BATCH_HDR;
+
+// Record header, one per mesh payload, followed by the payload
+typedef struct {
+    uint8_t src_node, x;
+    uint16_t len;
+} GW_REC_HDR;
+
+// Batch of mesh payloads awaiting upstream transfer
+typedef struct {
+    uint16_t len;          // Bytes used, including GW_BATCH_HDR
+    uint8_t count;
+    uint32_t start_time;   // Time first record was added (ms)
+    uint8_t data[GW_BATCH_SIZE];
+} GW_BATCH;
+
+// Gateway status
+typedef struct {
+    int state;
+    uint32_t state_time;   // Time of last state change, or retry (ms)
+    int tries;             // Attempts made in this state
+    uint32_t records, batches_sent, dropped, join_fails, leave_fails;
+} GW_STATUS;
+
+bool gw_init(int fd, char *ssid, char *pass, uint32_t collector_ip, uint16_t collector_port);
+void gw_poll(int fd);
+void gw_mesh_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len);
+bool gw_queue(uint8_t src_node, uint8_t *data, uint16_t len);
+void gw_print_status(void);
+
+#endif // WINC_GW_H
+
+// EOF
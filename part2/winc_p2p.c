@@ -7,6 +7,7 @@
 // Based on original work by Jeremy P Bentham
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -14,17 +15,39 @@
 #include "winc_wifi.h"
 #include "winc_sock.h"
 #include "winc_p2p.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
+#include "winc_buf.h"
 
 // Global state variables
 static bool p2p_enabled = false;
 static bool mesh_enabled = false;
 static uint8_t p2p_mode = P2P_MODE_IDLE;
+static P2P_PEER p2p_peers[P2P_MAX_PEERS];
+static uint8_t p2p_peer_hash[P2P_PEER_HASH];   // Peer index + 1, 0 if empty
+static uint8_t scan_count, scan_idx;
 static MESH_ROUTING_TABLE routing_table;
 static uint16_t mesh_seq_num = 0;
 static char local_node_name[16];
 static uint32_t last_beacon_time = 0;
+static int mesh_sock = -1;
+static MESH_HANDLER mesh_handler;
+static MESH_REASM reasm_pool[MESH_REASM_SLOTS];
+static MESH_FRAG_TX frag_tx;
+static MESH_TXQ_SLOT txq_slots[MESH_TXQ_SLOTS];
+static MESH_TXQ txqs[MESH_MAX_NODES + 1];
+static uint8_t txq_free, txq_free_count, txq_rr;
+static uint8_t mpr_map[MESH_NBR_MAP_BYTES];
+static MESH_DUP_ENTRY dup_cache[MESH_DUP_ENTRIES];
+static uint8_t dup_idx;
+static MESH_SYNC mesh_sync;
+static MESH_SUB mesh_subs[MESH_MAX_SUBS];
+
+// Weighted round-robin shares of the data classes; control is strict priority
+static const uint8_t mesh_class_weights[MESH_NUM_CLASSES] = {0, 4, 2, 1};
 
 extern int verbose, spi_fd;
+extern SOCKET sockets[MAX_SOCKETS];
 
 // Enable P2P mode on ATWINC1500
 bool p2p_enable(int fd, uint8_t channel)
@@ -44,6 +67,7 @@ bool p2p_enable(int fd, uint8_t channel)
     {
         p2p_enabled = true;
         p2p_mode = P2P_MODE_IDLE;
+        set_resp_handler(p2p_check_resp);
         if (verbose)
             printf("P2P mode enabled\n");
     }
@@ -69,6 +93,7 @@ bool p2p_disable(int fd)
     {
         p2p_enabled = false;
         p2p_mode = P2P_MODE_IDLE;
+        set_resp_handler(NULL);
         if (verbose)
             printf("P2P mode disabled\n");
     }
@@ -98,6 +123,8 @@ bool p2p_start_listen(int fd, uint8_t channel)
 // Start P2P device search/discovery
 bool p2p_start_search(int fd)
 {
+    SCAN_CMD cmd;
+
     if (!p2p_enabled)
     {
         printf("P2P mode not enabled\n");
@@ -107,12 +134,230 @@ bool p2p_start_search(int fd)
     if (verbose)
         printf("Starting P2P device search\n");
 
+    // Scan all channels; P2P group owners are found by SSID in the results
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.chan = ANY_CHAN;
+    if (!hif_put(fd, GOP_SCAN_REQ, &cmd, sizeof(cmd), 0, 0, 0))
+    {
+        printf("Failed to start P2P search\n");
+        return false;
+    }
     p2p_mode = P2P_MODE_SEARCH;
-
-    // Search is automatic in P2P mode
     return true;
 }
 
+// Handle P2P responses from the module; scan results update the peer table
+void p2p_check_resp(int fd, uint16_t gop, RESP_MSG *rmp)
+{
+    SCAN_RESULT_CMD cmd;
+    SCAN_RESULT_MSG *srp = &rmp->scan;
+
+    if (gop == GOP_SCAN_DONE)
+    {
+        scan_count = rmp->scan_done.count;
+        scan_idx = 0;
+    }
+    else if (gop == GOP_SCAN_RESULT)
+    {
+        srp->ssid[sizeof(srp->ssid) - 1] = 0;
+        if (!strncmp(srp->ssid, P2P_SSID_PREFIX, strlen(P2P_SSID_PREFIX)))
+            p2p_peer_update(srp->bssid, srp->ssid, srp->chan, srp->rssi);
+        scan_idx = srp->index + 1;
+    }
+    else
+        return;
+
+    // Fetch the next result, one at a time
+    if (scan_idx < scan_count)
+    {
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.index = scan_idx;
+        hif_put(fd, GOP_SCAN_RESULT_REQ, &cmd, sizeof(cmd), 0, 0, 0);
+    }
+    else if (p2p_mode == P2P_MODE_SEARCH)
+        p2p_mode = P2P_MODE_LISTEN;
+}
+
+// Get hash slot for a MAC address
+static int p2p_mac_hash(uint8_t *mac)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 6; i++)
+        h = (h ^ mac[i]) * 16777619u;
+    return h & (P2P_PEER_HASH - 1);
+}
+
+// Rebuild MAC hash index after a peer is replaced
+static void p2p_peer_rehash(void)
+{
+    int i, n;
+
+    memset(p2p_peer_hash, 0, sizeof(p2p_peer_hash));
+    for (i = 0; i < P2P_MAX_PEERS; i++)
+    {
+        if (p2p_peers[i].in_use)
+        {
+            for (n = p2p_mac_hash(p2p_peers[i].mac_addr); p2p_peer_hash[n];
+                 n = (n + 1) & (P2P_PEER_HASH - 1)) ;
+            p2p_peer_hash[n] = i + 1;
+        }
+    }
+}
+
+// Find peer by MAC address
+P2P_PEER *p2p_peer_find(uint8_t *mac)
+{
+    P2P_PEER *peer;
+    int n, i;
+
+    for (n = p2p_mac_hash(mac), i = 0; i < P2P_PEER_HASH && p2p_peer_hash[n];
+         n = (n + 1) & (P2P_PEER_HASH - 1), i++)
+    {
+        peer = &p2p_peers[p2p_peer_hash[n] - 1];
+        if (!memcmp(peer->mac_addr, mac, 6))
+            return peer;
+    }
+    return NULL;
+}
+
+// Find peer by device name
+P2P_PEER *p2p_peer_find_name(char *name)
+{
+    for (int i = 0; i < P2P_MAX_PEERS; i++)
+    {
+        if (p2p_peers[i].in_use && !strncmp((char *)p2p_peers[i].device_name, name,
+                                            sizeof(p2p_peers[i].device_name)))
+            return &p2p_peers[i];
+    }
+    return NULL;
+}
+
+// Add or update a peer, smoothing its RSSI. If the table is full, replace
+// the stalest peer, or the weakest if none are stale
+P2P_PEER *p2p_peer_update(uint8_t *mac, char *name, uint8_t channel, int8_t rssi)
+{
+    uint32_t now = time_us_32() / 1000;
+    P2P_PEER *peer = p2p_peer_find(mac), *old = NULL;
+    bool found = peer != NULL;
+    int i;
+
+    if (!peer)
+    {
+        for (i = 0; i < P2P_MAX_PEERS && !peer; i++)
+        {
+            if (!p2p_peers[i].in_use)
+                peer = &p2p_peers[i];
+            else if (!old)
+                old = &p2p_peers[i];
+            else
+            {
+                uint32_t age = now - p2p_peers[i].last_seen, old_age = now - old->last_seen;
+
+                if (age > P2P_PEER_TIMEOUT ? age > old_age :
+                    old_age <= P2P_PEER_TIMEOUT && p2p_peers[i].rssi_avg < old->rssi_avg)
+                    old = &p2p_peers[i];
+            }
+        }
+        peer = peer ? peer : old;
+        memset(peer, 0, sizeof(P2P_PEER));
+        memcpy(peer->mac_addr, mac, 6);
+        peer->in_use = true;
+        peer->rssi_avg = rssi * 16;
+        p2p_peer_rehash();
+    }
+    strncpy((char *)peer->device_name, name, sizeof(peer->device_name) - 1);
+    peer->channel = channel;
+    peer->rssi = rssi;
+    peer->rssi_avg += (rssi * 16 - peer->rssi_avg) >> P2P_RSSI_SHIFT;
+    peer->last_seen = now;
+    peer->count++;
+    if (!found)
+        p2p_peer_found_handler(peer);
+    return peer;
+}
+
+// Get recent peers, strongest first; return count, up to maxn
+int p2p_best_peers(P2P_PEER **peers, int maxn)
+{
+    uint32_t now = time_us_32() / 1000;
+    int i, j, n = 0, total = 0;
+
+    for (i = 0; i < P2P_MAX_PEERS; i++)
+    {
+        P2P_PEER *peer = &p2p_peers[i];
+
+        if (!peer->in_use || now - peer->last_seen > P2P_PEER_TIMEOUT)
+            continue;
+        total++;
+        if (!peers)
+            continue;
+        // Insertion sort into the caller's list
+        for (j = n; j > 0 && peers[j-1]->rssi_avg < peer->rssi_avg; j--)
+        {
+            if (j < maxn)
+                peers[j] = peers[j-1];
+        }
+        if (j < maxn)
+        {
+            peers[j] = peer;
+            n = MIN(n + 1, maxn);
+        }
+    }
+    return peers ? n : total;
+}
+
+// Print peer table, strongest first
+void p2p_print_peers(void)
+{
+    P2P_PEER *peers[P2P_MAX_PEERS];
+    uint32_t now = time_us_32() / 1000;
+    int i, n = p2p_best_peers(peers, P2P_MAX_PEERS);
+
+    printf("P2P peers: %d\n", n);
+    for (i = 0; i < n; i++)
+    {
+        printf("  %02X:%02X:%02X:%02X:%02X:%02X  chan %2u  RSSI %4d (avg %4d)  %lus ago  %s\n",
+               peers[i]->mac_addr[0], peers[i]->mac_addr[1], peers[i]->mac_addr[2],
+               peers[i]->mac_addr[3], peers[i]->mac_addr[4], peers[i]->mac_addr[5],
+               peers[i]->channel, peers[i]->rssi, peers[i]->rssi_avg / 16,
+               (unsigned long)((now - peers[i]->last_seen) / 1000), peers[i]->device_name);
+    }
+}
+
+// Request connection to a peer by name, or the strongest recent peer if
+// no name is given. Channel may be P2P_ANY_CHAN to use the peer's channel
+bool p2p_connect(int fd, char *device_name, uint8_t channel)
+{
+    P2P_CONN_REQ req;
+    P2P_PEER *peer = NULL;
+
+    if (!p2p_enabled)
+    {
+        printf("P2P mode not enabled\n");
+        return false;
+    }
+    if (device_name && *device_name)
+        peer = p2p_peer_find_name(device_name);
+    else if (p2p_best_peers(&peer, 1) == 0)
+    {
+        printf("No P2P peers to connect to\n");
+        return false;
+    }
+
+    memset(&req, 0, sizeof(req));
+    strncpy((char *)req.device_name, peer ? (char *)peer->device_name : device_name,
+            sizeof(req.device_name) - 1);
+    req.listen_channel = P2P_LISTEN_CHAN;
+    req.operating_channel = channel != P2P_ANY_CHAN ? channel :
+                            peer ? peer->channel : P2P_LISTEN_CHAN;
+    if (verbose)
+        printf("P2P connect to %s on channel %u, RSSI %d\n", req.device_name,
+               req.operating_channel, peer ? peer->rssi_avg / 16 : 0);
+
+    return hif_put(fd, GOP_P2P_CONN_REQ, &req, sizeof(req), 0, 0, 0);
+}
+
 // Connect to a P2P peer using WPS Push Button Configuration
 bool p2p_connect_wps_pbc(int fd)
 {
@@ -128,6 +373,10 @@ bool p2p_connect_wps_pbc(int fd)
     if (verbose)
         printf("Starting P2P connection with WPS-PBC\n");
 
+    // Aim at the strongest peer, if any have been found
+    if (p2p_best_peers(NULL, 0) > 0)
+        p2p_connect(fd, NULL, P2P_ANY_CHAN);
+
     memset(&req, 0, sizeof(req));
     req.trigger_type = WPS_PBC;
 
@@ -154,6 +403,10 @@ bool p2p_connect_wps_pin(int fd, uint8_t *pin)
     if (verbose)
         printf("Starting P2P connection with WPS-PIN\n");
 
+    // Aim at the strongest peer, if any have been found
+    if (p2p_best_peers(NULL, 0) > 0)
+        p2p_connect(fd, NULL, P2P_ANY_CHAN);
+
     memset(&req, 0, sizeof(req));
     req.trigger_type = WPS_PIN;
     memcpy(req.pin, pin, 8);
@@ -171,6 +424,12 @@ bool mesh_init(int fd, uint8_t node_id, char *node_name)
 {
     if (verbose)
         printf("Initializing mesh network, node ID: %u, name: %s\n", node_id, node_name);
+    if (BUF_COUNT < MESH_TXQ_SLOTS + 2)
+    {
+        printf("Mesh needs %u buffer blocks, has %u: build with MESH_ENABLE\n",
+               MESH_TXQ_SLOTS + 2, BUF_COUNT);
+        return false;
+    }
 
     memset(&routing_table, 0, sizeof(routing_table));
     routing_table.local_node_id = node_id;
@@ -181,6 +440,34 @@ bool mesh_init(int fd, uint8_t node_id, char *node_name)
 
     mesh_seq_num = 0;
     last_beacon_time = 0;
+    memset(reasm_pool, 0, sizeof(reasm_pool));
+    frag_tx.in_use = false;
+    memset(mpr_map, 0, sizeof(mpr_map));
+    memset(dup_cache, 0, sizeof(dup_cache));
+    dup_idx = 0;
+
+    // Until a lower node ID is heard, this node is the time root
+    memset(&mesh_sync, 0, sizeof(mesh_sync));
+    mesh_sync.root = mesh_sync.parent = node_id;
+    mesh_sync.lost_root = MESH_BCAST_NODE;
+    memset(mesh_subs, 0, sizeof(mesh_subs));
+
+    // All queue buffers on the free list, all queues empty
+    for (int i = 0; i < MESH_TXQ_SLOTS; i++)
+    {
+        buf_free(txq_slots[i].data);
+        txq_slots[i].data = NULL;
+        txq_slots[i].next = i+1 < MESH_TXQ_SLOTS ? i+1 : MESH_TXQ_NONE;
+    }
+    txq_free = 0;
+    txq_free_count = MESH_TXQ_SLOTS;
+    memset(txqs, MESH_TXQ_NONE, sizeof(txqs));
+    for (int i = 0; i <= MESH_MAX_NODES; i++)
+    {
+        txqs[i].depth = 0;
+        memcpy(txqs[i].credit, mesh_class_weights, sizeof(txqs[i].credit));
+    }
+    txq_rr = 0;
 
     return true;
 }
@@ -217,6 +504,71 @@ bool mesh_disable(int fd)
     return true;
 }
 
+// Hash a topic name (FNV-1a); zero is kept for unused subscriptions
+uint32_t mesh_topic_hash(char *topic)
+{
+    uint32_t h = 2166136261u;
+
+    while (*topic)
+        h = (h ^ (uint8_t)*topic++) * 16777619u;
+    return h ? h : 1;
+}
+
+// Get bit number in topic Bloom filter, for nth hash of topic
+static int mesh_topic_bit(uint32_t topic, int n)
+{
+    return (topic >> (n * 11)) % (MESH_TOPIC_BYTES * 8);
+}
+
+// Add topic to Bloom filter
+static void mesh_topic_add(uint8_t *filter, uint32_t topic)
+{
+    for (int n = 0; n < MESH_TOPIC_HASHES; n++)
+        NBR_MAP_SET(filter, mesh_topic_bit(topic, n));
+}
+
+// Check if topic may be in Bloom filter
+static bool mesh_topic_test(uint8_t *filter, uint32_t topic)
+{
+    for (int n = 0; n < MESH_TOPIC_HASHES; n++)
+    {
+        if (!NBR_MAP_TEST(filter, mesh_topic_bit(topic, n)))
+            return false;
+    }
+    return true;
+}
+
+// Add time sync fields to beacon. The root counts its beacons, so others can
+// tell it is alive; one child that takes time from us has its latest beacon
+// echoed, with the arrival time, which becomes the hold time when sent
+static void mesh_sync_beacon(MESH_BEACON *beacon)
+{
+    static int next;
+    int i, n = routing_table.node_count;
+
+    if (mesh_sync.root == routing_table.local_node_id)
+        mesh_sync.seq++;
+    beacon->sync_root = mesh_sync.root;
+    beacon->sync_hops = mesh_sync.hops;
+    beacon->sync_parent = mesh_sync.parent;
+    beacon->sync_seq = mesh_sync.seq;
+    beacon->echo_node = MESH_BCAST_NODE;
+    for (i = 0; i < n; i++)
+    {
+        MESH_NODE *node = &routing_table.nodes[(next + i) % n];
+
+        if (node->echo_due)
+        {
+            node->echo_due = false;
+            beacon->echo_node = node->node_id;
+            beacon->echo_time = node->echo_time;
+            beacon->echo_hold = mesh_local_to_mesh(node->echo_rx);
+            next = (next + i + 1) % n;
+            break;
+        }
+    }
+}
+
 // Send mesh beacon to announce presence
 bool mesh_send_beacon(int fd)
 {
@@ -234,53 +586,201 @@ bool mesh_send_beacon(int fd)
     beacon.hdr.dst_node = 0xFF; // Broadcast
     beacon.hdr.hop_count = 0;
     beacon.hdr.seq_num = mesh_seq_num++;
-    beacon.hdr.payload_len = sizeof(MESH_BEACON) - sizeof(MESH_PKT_HDR);
+    beacon.hdr.flow_id = 0;
+    beacon.hdr.tclass = MESH_CLASS_CTRL;
 
     // Fill beacon data
     beacon.node_id = routing_table.local_node_id;
     strncpy((char *)beacon.node_name, local_node_name, sizeof(beacon.node_name) - 1);
 
-    // Add active neighbors to beacon
-    for (i = 0; i < routing_table.node_count && neighbor_idx < MESH_MAX_NODES; i++)
+    // Add active neighbors to beacon, and those chosen as relays
+    beacon.nbr_encoding = MESH_NBR_ENCODING;
+    mesh_compute_mpr();
+    for (i = 0; i < routing_table.node_count; i++)
     {
+        uint8_t id = routing_table.nodes[i].node_id;
+
         if (routing_table.nodes[i].is_active && routing_table.nodes[i].hop_count == 1)
         {
-            beacon.neighbors[neighbor_idx++] = routing_table.nodes[i].node_id;
+#if MESH_NBR_ENCODING == MESH_NBR_LIST
+            if (neighbor_idx >= MESH_NBR_SET_BYTES)
+                break;
+            beacon.neighbors[neighbor_idx] = id;
+            if (NBR_MAP_TEST(mpr_map, id))
+                beacon.mprs[beacon.mpr_count] = id;
+#else
+            mesh_nbrset_add(beacon.neighbors, id);
+            if (NBR_MAP_TEST(mpr_map, id))
+                mesh_nbrset_add(beacon.mprs, id);
+#endif
+            beacon.mpr_count += NBR_MAP_TEST(mpr_map, id);
+            neighbor_idx++;
         }
     }
     beacon.neighbor_count = neighbor_idx;
 
+    // Routes to nodes further away, which neighbors can extend by a hop. A
+    // Bloom filter only confirms nodes a receiver already knows, so then
+    // direct neighbors are sent as routes too, for it to learn of them
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        MESH_NODE *node = &routing_table.nodes[i];
+
+        if (node->is_active && node->hop_count >= (MESH_NBR_ENCODING == MESH_NBR_BLOOM ? 1 : 2) &&
+            node->hop_count < MESH_MAX_HOPS)
+        {
+            MESH_ROUTE_ENTRY *rp = &beacon.routes[beacon.route_count++];
+
+            rp->node_id = node->node_id;
+            rp->metric = node->hop_count;
+            rp->next_hop = node->next_hop;
+        }
+    }
+    beacon.set_len = MESH_NBR_SET_BYTES;
+    beacon.hdr.payload_len = offsetof(MESH_BEACON, routes) - sizeof(MESH_PKT_HDR) +
+                             beacon.route_count * sizeof(MESH_ROUTE_ENTRY);
+    mesh_sync_beacon(&beacon);
+
+    // Own subscriptions, then those advertised by neighbors, one level further
+    for (i = 0; i < MESH_MAX_SUBS; i++)
+    {
+        if (mesh_subs[i].topic)
+            mesh_topic_add(beacon.topics[0], mesh_subs[i].topic);
+    }
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        MESH_NODE *node = &routing_table.nodes[i];
+
+        if (node->is_active && node->hop_count == 1)
+        {
+            for (int lev = 1; lev < MESH_TOPIC_LEVELS; lev++)
+            {
+                for (int n = 0; n < MESH_TOPIC_BYTES; n++)
+                    beacon.topics[lev][n] |= node->topics[lev-1][n];
+            }
+        }
+    }
+
     if (verbose > 1)
         printf("Sending mesh beacon, neighbors: %u\n", beacon.neighbor_count);
 
-    // Send beacon via P2P broadcast
-    // Note: This uses UDP broadcast on the P2P network
-    // You'll need to set up a UDP socket for mesh communication
-
     last_beacon_time = time_us_32() / 1000;
 
-    return true;
+    // Send beacon via UDP broadcast on the P2P network
+    return mesh_xmit(fd, MESH_BCAST_NODE, &beacon.hdr, &beacon.node_id);
+}
+
+// Get routing table entry of a node
+static MESH_NODE *mesh_get_node(uint8_t node_id)
+{
+    uint8_t i;
+
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        if (routing_table.nodes[i].node_id == node_id)
+            return &routing_table.nodes[i];
+    }
+    return NULL;
+}
+
+// Get minimum gap between packets to a node, given its allowed rate
+static uint32_t mesh_rate_gap(MESH_NODE *node)
+{
+    return node && node->tx_rate ? 1000000 / node->tx_rate : 0;
+}
+
+// Send data through mesh network, fragmenting if necessary
+MESH_SEND_RESULT mesh_send_data(int fd, uint8_t dst_node, uint8_t *data, uint16_t len)
+{
+    return mesh_send_flow(fd, dst_node, 0, MESH_CLASS_NORMAL, data, len);
 }
 
-// Send data through mesh network
-bool mesh_send_data(int fd, uint8_t dst_node, uint8_t *data, uint16_t len)
+// Send data for a given flow and traffic class
+// Packets of one flow always take the same path
+MESH_SEND_RESULT mesh_send_flow(int fd, uint8_t dst_node, uint8_t flow_id, uint8_t tclass,
+                                uint8_t *data, uint16_t len)
 {
     MESH_PKT_HDR hdr;
+    MESH_NODE *node;
+    uint32_t now = time_us_32();
     int next_hop;
 
     if (!mesh_enabled)
     {
         printf("Mesh networking not enabled\n");
-        return false;
+        return MESH_SEND_FAIL;
+    }
+
+    if (len > MESH_MAX_PAYLOAD)
+    {
+        printf("Mesh payload too large (%u bytes)\n", len);
+        return MESH_SEND_FAIL;
+    }
+
+    // Broadcasts are flooded through the relays, and aren't fragmented
+    if (dst_node == MESH_BCAST_NODE)
+    {
+        if (len > MESH_MAX_DGRAM - sizeof(MESH_PKT_HDR))
+        {
+            printf("Mesh broadcast too large (%u bytes)\n", len);
+            return MESH_SEND_FAIL;
+        }
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_type = MESH_MSG_DATA;
+        hdr.src_node = routing_table.local_node_id;
+        hdr.dst_node = MESH_BCAST_NODE;
+        hdr.seq_num = mesh_seq_num++;
+        hdr.payload_len = len;
+        hdr.flow_id = flow_id;
+        hdr.tclass = tclass;
+        mesh_is_duplicate(&hdr);
+        return mesh_xmit(fd, MESH_BCAST_NODE, &hdr, data) ? MESH_SEND_OK : MESH_SEND_FAIL;
     }
 
     // Find route to destination
-    next_hop = mesh_find_route(dst_node);
+    next_hop = mesh_find_route_flow(dst_node, routing_table.local_node_id, flow_id);
 
     if (next_hop < 0)
     {
         printf("No route to destination node %u\n", dst_node);
-        return false;
+        return MESH_SEND_FAIL;
+    }
+
+    // Hold back if sending faster than the path to this node allows
+    node = mesh_get_node(dst_node);
+    if (node && node->tx_time && now - node->tx_time < mesh_rate_gap(node))
+    {
+        if (verbose > 1)
+            printf("Rate limit to node %u, %u packets/s\n", dst_node, node->tx_rate);
+        return MESH_SEND_RATE_LIMITED;
+    }
+
+    // Payloads that don't fit in one datagram are paced out as fragments
+    if (len > MESH_MAX_DGRAM - sizeof(MESH_PKT_HDR))
+    {
+        if (frag_tx.in_use)
+        {
+            if (verbose)
+                printf("Fragmented send already in progress\n");
+            return MESH_SEND_BUSY;
+        }
+        frag_tx.in_use = true;
+        frag_tx.dst_node = dst_node;
+        frag_tx.flow_id = flow_id;
+        frag_tx.tclass = tclass;
+        frag_tx.frag_id = mesh_seq_num;
+        frag_tx.total_len = len;
+        frag_tx.index = 0;
+        frag_tx.count = (len + MESH_FRAG_PAYLOAD - 1) / MESH_FRAG_PAYLOAD;
+        memcpy(frag_tx.data, data, len);
+
+        if (verbose)
+            printf("Sending mesh data to node %u in %u fragments\n", dst_node, frag_tx.count);
+
+        mesh_frag_poll(fd);
+        if (node)
+            node->tx_time = now;
+        return MESH_SEND_OK;
     }
 
     // Build packet header
@@ -290,14 +790,50 @@ bool mesh_send_data(int fd, uint8_t dst_node, uint8_t *data, uint16_t len)
     hdr.hop_count = 0;
     hdr.seq_num = mesh_seq_num++;
     hdr.payload_len = len;
+    hdr.flow_id = flow_id;
+    hdr.tclass = tclass;
+    hdr.flags = hdr.last_hop = 0;
 
     if (verbose)
         printf("Sending mesh data to node %u via next hop %d\n", dst_node, next_hop);
 
+    if (node)
+        node->tx_time = now;
+
     // Send packet to next hop
-    // This would use the socket interface to send to the next hop node
+    return mesh_xmit(fd, next_hop, &hdr, data) ? MESH_SEND_OK : MESH_SEND_FAIL;
+}
 
-    return true;
+// Get time in us until data can be sent to a node within its rate limit
+uint32_t mesh_send_wait(uint8_t dst_node)
+{
+    MESH_NODE *node = mesh_get_node(dst_node);
+    uint32_t gap = mesh_rate_gap(node), elapsed;
+
+    if (!node || !node->tx_time)
+        return 0;
+    elapsed = time_us_32() - node->tx_time;
+    return elapsed < gap ? gap - elapsed : 0;
+}
+
+// Check if a fragmented send is still in progress
+bool mesh_tx_busy(void)
+{
+    return frag_tx.in_use;
+}
+
+// Update average end-to-end latency from the source of a packet delivered here
+static void mesh_path_latency(MESH_PKT_HDR *pkt)
+{
+    MESH_NODE *node = mesh_get_node(pkt->src_node);
+    int32_t lat;
+
+    if (node && (pkt->flags & MESH_FLAG_ORIG_SYNC) && mesh_synced() &&
+        node->sync_root == mesh_sync.root)
+    {
+        lat = (int32_t)(mesh_time_us() - pkt->orig_time);
+        node->path_latency = node->path_latency ? node->path_latency + (lat - node->path_latency) / 8 : lat;
+    }
 }
 
 // Route a packet through the mesh network
@@ -305,11 +841,26 @@ bool mesh_route_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
 {
     int next_hop;
 
+    // Broadcasts are delivered here, and may be relayed
+    if (pkt->dst_node == MESH_BCAST_NODE)
+        return mesh_flood_packet(fd, pkt, data);
+
     // Check if packet is for this node
     if (pkt->dst_node == routing_table.local_node_id)
     {
         // Handle packet locally
-        mesh_data_handler(fd, data, pkt->payload_len);
+        if (pkt->msg_type == MESH_MSG_CONGEST)
+        {
+            mesh_congest_input((MESH_CONGEST_MSG *)pkt);
+            return true;
+        }
+        if (pkt->flags & MESH_FLAG_CE)
+            mesh_send_congest(fd, pkt->src_node, pkt->dst_node, 0);
+        mesh_path_latency(pkt);
+        if (pkt->msg_type == MESH_MSG_FRAG)
+            mesh_frag_input(fd, pkt, data);
+        else
+            mesh_data_handler(fd, pkt->src_node, data, pkt->payload_len);
         return true;
     }
 
@@ -318,16 +869,18 @@ bool mesh_route_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
     {
         if (verbose)
             printf("Packet exceeded max hops, dropping\n");
+        STATS_INC(mesh.dropped);
         return false;
     }
 
     // Find next hop
-    next_hop = mesh_find_route(pkt->dst_node);
+    next_hop = mesh_find_route_flow(pkt->dst_node, pkt->src_node, pkt->flow_id);
 
     if (next_hop < 0)
     {
         if (verbose)
             printf("No route to node %u, dropping packet\n", pkt->dst_node);
+        STATS_INC(mesh.dropped);
         return false;
     }
 
@@ -337,23 +890,44 @@ bool mesh_route_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
     if (verbose > 1)
         printf("Routing packet to node %u via hop %d\n", pkt->dst_node, next_hop);
 
-    // Forward packet
-    // This would use the socket interface
-
+    // Forward packet; fragments are relayed as-is, only reassembled at destination
+    if (!mesh_xmit(fd, next_hop, pkt, data))
+        return false;
+    STATS_INC(mesh.forwarded);
     return true;
 }
 
-// Update routing table from received beacon
-void mesh_update_routing_table(MESH_BEACON *beacon)
+// Recalculate best metric and primary next hop of a node
+static void mesh_node_refresh(MESH_NODE *node)
+{
+    uint8_t i;
+
+    node->hop_count = 255;
+    for (i = 0; i < node->hop_n; i++)
+    {
+        if (node->hops[i].metric < node->hop_count)
+        {
+            node->hop_count = node->hops[i].metric;
+            node->next_hop = node->hops[i].node_id;
+        }
+    }
+    node->is_active = node->hop_n > 0;
+}
+
+// Add or refresh a next hop for a destination node
+static void mesh_add_route(uint8_t dst_node, uint8_t via, uint8_t metric, uint32_t now)
 {
     uint8_t i;
     MESH_NODE *node = NULL;
-    uint32_t current_time = time_us_32() / 1000;
+    MESH_NEXT_HOP *hop = NULL;
+
+    if (dst_node == routing_table.local_node_id || metric > MESH_MAX_HOPS)
+        return;
 
     // Find existing node or add new one
     for (i = 0; i < routing_table.node_count; i++)
     {
-        if (routing_table.nodes[i].node_id == beacon->node_id)
+        if (routing_table.nodes[i].node_id == dst_node)
         {
             node = &routing_table.nodes[i];
             break;
@@ -364,91 +938,1259 @@ void mesh_update_routing_table(MESH_BEACON *beacon)
     if (!node && routing_table.node_count < MESH_MAX_NODES)
     {
         node = &routing_table.nodes[routing_table.node_count++];
-        node->node_id = beacon->node_id;
+        memset(node, 0, sizeof(MESH_NODE));
+        node->node_id = dst_node;
+        node->tx_rate = MESH_RATE_MAX;
     }
+    if (!node)
+        return;
 
-    if (node)
+    // Find existing next hop, or a free slot, or a worse one to replace
+    for (i = 0; i < node->hop_n && !hop; i++)
     {
-        // Update node information
-        node->hop_count = beacon->hdr.hop_count + 1;
-        node->last_update = current_time;
-        node->is_active = true;
+        if (node->hops[i].node_id == via)
+            hop = &node->hops[i];
+    }
+    if (!hop && node->hop_n < MESH_MAX_NEXT_HOPS)
+        hop = &node->hops[node->hop_n++];
+    for (i = 0; i < node->hop_n && !hop; i++)
+    {
+        if (node->hops[i].metric > metric)
+            hop = &node->hops[i];
+    }
 
-        // If this is a direct neighbor (hop_count == 1), it's our next hop
-        if (node->hop_count == 1)
-        {
-            node->next_hop = beacon->node_id;
-        }
+    if (hop)
+    {
+        hop->node_id = via;
+        hop->metric = metric;
+        hop->last_update = now;
+        node->last_update = now;
+        mesh_node_refresh(node);
 
         if (verbose > 1)
-            printf("Updated routing table: node %u, hops %u\n",
-                   node->node_id, node->hop_count);
+            printf("Updated routing table: node %u via %u, hops %u\n",
+                   dst_node, via, metric);
     }
 }
 
-// Find route to destination node
-int mesh_find_route(uint8_t dst_node)
+// Update routing table from received beacon
+void mesh_update_routing_table(MESH_BEACON *beacon)
 {
-    uint8_t i;
-    MESH_NODE *best_node = NULL;
-    uint8_t min_hops = 255;
+    MESH_NODE *node;
+    MESH_ROUTE_ENTRY *rp;
+    uint8_t map[MESH_NBR_MAP_BYTES], mprs[MESH_NBR_MAP_BYTES];
+    uint8_t *bp = (uint8_t *)beacon;
+    uint32_t current_time = time_us_32() / 1000;
+    int id, setlen = beacon->set_len, len = sizeof(MESH_PKT_HDR) + beacon->hdr.payload_len;
+    int oset = offsetof(MESH_BEACON, neighbors) + 2*setlen;
+
+    // Sender is a direct neighbor
+    mesh_add_route(beacon->node_id, beacon->node_id, beacon->hdr.hop_count + 1, current_time);
+
+    // Decode its neighbor and relay sets, at the sender's set length, if
+    // present; a list can be any length, other encodings have a fixed size
+    memset(map, 0, sizeof(map));
+    memset(mprs, 0, sizeof(mprs));
+    if (oset <= len && (beacon->nbr_encoding == MESH_NBR_LIST ?
+        MAX(beacon->neighbor_count, beacon->mpr_count) <= setlen :
+        setlen && setlen == mesh_nbrset_size(beacon->nbr_encoding)))
+    {
+        mesh_nbrset_decode(beacon->nbr_encoding, beacon->neighbors, beacon->neighbor_count, map);
+        mesh_nbrset_decode(beacon->nbr_encoding, beacon->neighbors + setlen, beacon->mpr_count, mprs);
+    }
 
-    // Find node with minimum hop count
-    for (i = 0; i < routing_table.node_count; i++)
+    // Keep its neighbor set for two-hop queries, and whether we relay for it
+    if ((node = mesh_get_node(beacon->node_id)) != NULL)
     {
-        if (routing_table.nodes[i].node_id == dst_node &&
-            routing_table.nodes[i].is_active &&
-            routing_table.nodes[i].hop_count < min_hops)
+        memcpy(node->nbr_map, map, sizeof(map));
+        node->mpr_selector = NBR_MAP_TEST(mprs, routing_table.local_node_id);
+        node->sync_root = beacon->sync_root;
+        memcpy(node->topics, beacon->topics, sizeof(node->topics));
+    }
+
+    // Its neighbors are reachable through it. A Bloom filter can give
+    // false positives, so it only adds routes to nodes already known
+    for (id = 0; id < MESH_BCAST_NODE; id++)
+    {
+        if (NBR_MAP_TEST(map, id) && id != beacon->node_id &&
+            (beacon->nbr_encoding != MESH_NBR_BLOOM || mesh_get_node(id)))
+            mesh_add_route(id, beacon->node_id, beacon->hdr.hop_count + 2, current_time);
+    }
+
+    // Routes it has learned, a count then entries after the sets, are one hop
+    // longer through it, unless they go through us; routes longer than
+    // MESH_MAX_HOPS are ignored, so a loop that forms when a node is lost dies out
+    if (oset < len && oset + 1 + bp[oset] * (int)sizeof(MESH_ROUTE_ENTRY) <= len)
+    {
+        for (id = 0, rp = (MESH_ROUTE_ENTRY *)&bp[oset + 1]; id < bp[oset]; id++, rp++)
         {
-            best_node = &routing_table.nodes[i];
-            min_hops = routing_table.nodes[i].hop_count;
+            if (rp->next_hop != routing_table.local_node_id && rp->node_id != beacon->node_id)
+                mesh_add_route(rp->node_id, beacon->node_id,
+                               beacon->hdr.hop_count + 1 + rp->metric, current_time);
         }
     }
+}
 
-    if (best_node)
-        return best_node->next_hop;
+// Get Bloom filter bit number for one of the hashes of a node ID
+static int mesh_bloom_bit(uint8_t node_id, int n)
+{
+    uint32_t h1 = node_id * 2654435761u, h2 = (node_id * 40503u) | 1;
 
-    return -1;
+    return ((h1 >> 16) + n * h2) % (MESH_BLOOM_BYTES * 8);
 }
 
-// Handle received mesh beacon
-void mesh_beacon_handler(int fd)
+// Add node ID to a neighbor set, in the local beacon encoding
+void mesh_nbrset_add(uint8_t *set, uint8_t node_id)
 {
-    uint32_t current_time = time_us_32() / 1000;
-    uint8_t i;
+#if MESH_NBR_ENCODING == MESH_NBR_BLOOM
+    for (int n = 0; n < MESH_BLOOM_HASHES; n++)
+        NBR_MAP_SET(set, mesh_bloom_bit(node_id, n));
+#else
+    NBR_MAP_SET(set, node_id);
+#endif
+}
 
-    if (!mesh_enabled)
-        return;
+// Get size of a neighbor set in beacon, given its encoding
+int mesh_nbrset_size(uint8_t encoding)
+{
+    return encoding == MESH_NBR_LIST ? MESH_MAX_NODES :
+           encoding == MESH_NBR_BITMAP ? MESH_NBR_MAP_BYTES :
+           encoding == MESH_NBR_BLOOM ? MESH_BLOOM_BYTES : 0;
+}
 
-    // Clean up stale routes
-    for (i = 0; i < routing_table.node_count; i++)
+// Decode beacon neighbor set, of any encoding, into a node ID bitmap
+void mesh_nbrset_decode(uint8_t encoding, uint8_t *set, int count, uint8_t *map)
+{
+    int i, id, n;
+
+    memset(map, 0, MESH_NBR_MAP_BYTES);
+    if (encoding == MESH_NBR_LIST)
+    {
+        for (i = 0; i < count && i < MESH_MAX_NODES; i++)
+            NBR_MAP_SET(map, set[i]);
+    }
+    else if (encoding == MESH_NBR_BITMAP)
+    {
+        memcpy(map, set, MESH_NBR_MAP_BYTES);
+    }
+    else if (encoding == MESH_NBR_BLOOM)
     {
-        if (routing_table.nodes[i].is_active &&
-            (current_time - routing_table.nodes[i].last_update) > MESH_ROUTE_TIMEOUT)
+        for (id = 0; id < MESH_BCAST_NODE; id++)
         {
-            routing_table.nodes[i].is_active = false;
-            if (verbose)
-                printf("Route to node %u timed out\n", routing_table.nodes[i].node_id);
+            for (n = 0; n < MESH_BLOOM_HASHES && NBR_MAP_TEST(set, mesh_bloom_bit(id, n)); n++) ;
+            if (n == MESH_BLOOM_HASHES)
+                NBR_MAP_SET(map, id);
         }
     }
+}
 
-    // Send periodic beacons
+// Check if a node advertises another as its direct neighbor
+bool mesh_is_neighbor_of(uint8_t node_id, uint8_t other)
+{
+    MESH_NODE *node = mesh_get_node(node_id);
+
+    return node && node->is_active && node->hop_count == 1 && NBR_MAP_TEST(node->nbr_map, other);
+}
+
+// Get direct neighbors that can reach a node in one more hop, return count
+int mesh_two_hop_via(uint8_t dst_node, uint8_t *via, int maxn)
+{
+    int i, n = 0;
+
+    for (i = 0; i < routing_table.node_count && n < maxn; i++)
+    {
+        if (routing_table.nodes[i].node_id != dst_node &&
+            mesh_is_neighbor_of(routing_table.nodes[i].node_id, dst_node))
+            via[n++] = routing_table.nodes[i].node_id;
+    }
+    return n;
+}
+
+// Choose multipoint relays: the smallest set of neighbors that covers all
+// two-hop neighbors, found greedily as in OLSR. Return number chosen
+int mesh_compute_mpr(void)
+{
+    uint8_t n2[MESH_NBR_MAP_BYTES], cover[MESH_NBR_MAP_BYTES];
+    MESH_NODE *node, *best;
+    int i, id, n, count, best_n, nmpr = 0;
+
+    // Two-hop neighbors: heard by a neighbor, but not ourselves or a neighbor.
+    // They must be known active nodes, as a Bloom filter gives false positives
+    memset(n2, 0, sizeof(n2));
+    memset(mpr_map, 0, sizeof(mpr_map));
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        node = &routing_table.nodes[i];
+        if (node->is_active && node->hop_count == 1)
+        {
+            for (id = 0; id < MESH_NBR_MAP_BYTES; id++)
+                n2[id] |= node->nbr_map[id];
+        }
+    }
+    for (id = 0; id < MESH_BCAST_NODE; id++)
+    {
+        node = mesh_get_node(id);
+        if (id == routing_table.local_node_id || !node || !node->is_active || node->hop_count == 1)
+            n2[id >> 3] &= ~(1 << (id & 7));
+    }
+
+    // Neighbors that are the only way to reach some two-hop node
+    for (id = 0; id < MESH_BCAST_NODE; id++)
+    {
+        if (NBR_MAP_TEST(n2, id))
+        {
+            for (i = 0, n = 0, best = NULL; i < routing_table.node_count; i++)
+            {
+                if (mesh_is_neighbor_of(routing_table.nodes[i].node_id, id))
+                {
+                    best = &routing_table.nodes[i];
+                    n++;
+                }
+            }
+            if (n == 1 && !NBR_MAP_TEST(mpr_map, best->node_id))
+            {
+                NBR_MAP_SET(mpr_map, best->node_id);
+                nmpr++;
+            }
+        }
+    }
+
+    // Remove two-hop nodes covered so far, then add the neighbor
+    // covering most of the remainder, until all are covered
+    do {
+        for (i = 0; i < routing_table.node_count; i++)
+        {
+            node = &routing_table.nodes[i];
+            if (NBR_MAP_TEST(mpr_map, node->node_id))
+            {
+                for (id = 0; id < MESH_NBR_MAP_BYTES; id++)
+                    n2[id] &= ~node->nbr_map[id];
+            }
+        }
+        best = NULL;
+        best_n = 0;
+        for (i = 0; i < routing_table.node_count; i++)
+        {
+            node = &routing_table.nodes[i];
+            if (!node->is_active || node->hop_count != 1 || NBR_MAP_TEST(mpr_map, node->node_id))
+                continue;
+            for (id = 0, count = 0; id < MESH_NBR_MAP_BYTES; id++)
+            {
+                cover[id] = n2[id] & node->nbr_map[id];
+                for (n = cover[id]; n; n &= n - 1)
+                    count++;
+            }
+            if (count > best_n)
+            {
+                best = node;
+                best_n = count;
+            }
+        }
+        if (best)
+        {
+            NBR_MAP_SET(mpr_map, best->node_id);
+            nmpr++;
+        }
+    } while (best);
+    return nmpr;
+}
+
+// Find the duplicate cache entry of a broadcast, adding one if not seen before
+static MESH_DUP_ENTRY *mesh_dup_entry(MESH_PKT_HDR *hdr, bool *seen)
+{
+    uint32_t now = time_us_32() / 1000;
+    MESH_DUP_ENTRY *dp;
+    int i;
+
+    for (i = 0; i < MESH_DUP_ENTRIES; i++)
+    {
+        dp = &dup_cache[i];
+        if (dp->time && dp->src_node == hdr->src_node &&
+            dp->seq_num == hdr->seq_num && now - dp->time < MESH_DUP_TIMEOUT)
+        {
+            *seen = true;
+            return dp;
+        }
+    }
+    dp = &dup_cache[dup_idx];
+    dp->src_node = hdr->src_node;
+    dp->seq_num = hdr->seq_num;
+    dp->relayed = false;
+    dp->time = now ? now : 1;
+    dup_idx = (dup_idx + 1) % MESH_DUP_ENTRIES;
+    *seen = false;
+    return dp;
+}
+
+// Check if a broadcast has been seen before, remember it if not
+bool mesh_is_duplicate(MESH_PKT_HDR *hdr)
+{
+    bool seen;
+
+    mesh_dup_entry(hdr, &seen);
+    return seen;
+}
+
+// Deliver a received broadcast, and relay it if the node we heard it from
+// chose us as one of its multipoint relays. As in OLSR, that applies to any
+// copy until it has been relayed, as the first copy may come from a node
+// that didn't choose us
+bool mesh_flood_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
+{
+    MESH_NODE *prev = mesh_get_node(pkt->last_hop);
+    bool seen, relay;
+    MESH_DUP_ENTRY *dp = mesh_dup_entry(pkt, &seen);
+
+    relay = prev && prev->mpr_selector && !dp->relayed && pkt->hop_count + 1 < MESH_MAX_HOPS;
+    dp->relayed |= relay;
+    if (seen)
+    {
+        if (verbose > 1)
+            printf("Duplicate broadcast from node %u seq %u\n", pkt->src_node, pkt->seq_num);
+        STATS_INC(mesh.duplicates);
+    }
+    else if (pkt->msg_type == MESH_MSG_DATA)
+        mesh_data_handler(fd, pkt->src_node, data, pkt->payload_len);
+
+    if (!relay)
+        return !seen;
+
+    pkt->hop_count++;
+    if (verbose > 1)
+        printf("Relaying broadcast from node %u seq %u\n", pkt->src_node, pkt->seq_num);
+    if (!mesh_xmit(fd, MESH_BCAST_NODE, pkt, data))
+        return false;
+    STATS_INC(mesh.forwarded);
+    return true;
+}
+
+// Check if two of our neighbors can't hear each other (hidden nodes)
+bool mesh_hidden_pair(uint8_t node_a, uint8_t node_b)
+{
+    MESH_NODE *a = mesh_get_node(node_a), *b = mesh_get_node(node_b);
+
+    return node_a != node_b && a && b && a->is_active && b->is_active &&
+           a->hop_count == 1 && b->hop_count == 1 &&
+           !NBR_MAP_TEST(a->nbr_map, node_b) && !NBR_MAP_TEST(b->nbr_map, node_a);
+}
+
+// Find route to destination node
+int mesh_find_route(uint8_t dst_node)
+{
+    return mesh_find_route_flow(dst_node, routing_table.local_node_id, 0);
+}
+
+// Find route for a flow, hashing it across equal-cost next hops
+int mesh_find_route_flow(uint8_t dst_node, uint8_t src_node, uint8_t flow_id)
+{
+    uint8_t i, n = 0, best[MESH_MAX_NEXT_HOPS];
+    MESH_NODE *node = NULL;
+    uint32_t hash = 2166136261u;
+
+    for (i = 0; i < routing_table.node_count && !node; i++)
+    {
+        if (routing_table.nodes[i].node_id == dst_node &&
+            routing_table.nodes[i].is_active)
+            node = &routing_table.nodes[i];
+    }
+    if (!node)
+        return -1;
+
+    // Collect next hops with the best metric
+    for (i = 0; i < node->hop_n; i++)
+    {
+        if (node->hops[i].metric == node->hop_count)
+            best[n++] = node->hops[i].node_id;
+    }
+    if (n < 2)
+        return node->next_hop;
+
+    // FNV-1a hash of the flow selects one of them
+    hash = (hash ^ src_node) * 16777619u;
+    hash = (hash ^ dst_node) * 16777619u;
+    hash = (hash ^ flow_id) * 16777619u;
+    return best[hash % n];
+}
+
+// Handle received mesh beacon
+void mesh_beacon_handler(int fd)
+{
+    uint32_t current_time = time_us_32() / 1000;
+    uint8_t i, j;
+
+    if (!mesh_enabled)
+        return;
+
+    // Clean up stale next hops, and routes with none left
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        MESH_NODE *node = &routing_table.nodes[i];
+
+        for (j = 0; j < node->hop_n; )
+        {
+            if ((current_time - node->hops[j].last_update) > MESH_ROUTE_TIMEOUT)
+                node->hops[j] = node->hops[--node->hop_n];
+            else
+                j++;
+        }
+        if (node->is_active)
+        {
+            mesh_node_refresh(node);
+            if (!node->is_active && verbose)
+                printf("Route to node %u timed out\n", node->node_id);
+        }
+    }
+
+    // Discard stale reassemblies
+    for (i = 0; i < MESH_REASM_SLOTS; i++)
+    {
+        if (reasm_pool[i].in_use &&
+            (current_time - reasm_pool[i].start_time) > MESH_REASM_TIMEOUT)
+        {
+            reasm_pool[i].in_use = false;
+            if (verbose)
+                printf("Reassembly from node %u timed out\n", reasm_pool[i].src_node);
+        }
+    }
+
+    // Recover source rates that have not seen congestion recently
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        MESH_NODE *node = &routing_table.nodes[i];
+
+        if (node->tx_rate < MESH_RATE_MAX &&
+            (current_time - node->rate_time) > MESH_RATE_RECOVER)
+        {
+            node->tx_rate = MIN(node->tx_rate + MESH_RATE_STEP, MESH_RATE_MAX);
+            node->rate_time = current_time;
+        }
+    }
+
+    // Check time root and parent are still being heard
+    mesh_sync_poll();
+
+    // Pace out any pending fragments
+    mesh_frag_poll(fd);
+
+    // Send periodic beacons
     if ((current_time - last_beacon_time) > MESH_BEACON_INTERVAL)
     {
         mesh_send_beacon(fd);
     }
+
+    // Drain the transmit queues
+    mesh_txq_poll(fd);
 }
 
 // Handle received mesh data
-void mesh_data_handler(int fd, uint8_t *data, uint16_t len)
+void mesh_data_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len)
 {
+    STATS_INC(mesh.delivered);
     if (verbose)
     {
-        printf("Received mesh data, length: %u\n", len);
-        dump_hex(data, len, 16, "  ");
+        printf("Received mesh data from node %u, length: %u\n", src_node, len);
+        if (verbose > 1)
+            dump_hex(data, len, 16, "  ");
+    }
+
+    if (mesh_handler)
+        mesh_handler(fd, src_node, data, len);
+}
+
+// Set application handler for received mesh data
+void mesh_set_handler(MESH_HANDLER handler)
+{
+    mesh_handler = handler;
+}
+
+// Open UDP socket for mesh traffic, return socket number, -ve if error
+int mesh_open_sock(uint16_t port)
+{
+    mesh_sock = open_sock_server(port, 0, mesh_sock_handler);
+    return mesh_sock;
+}
+
+// Handle a mesh datagram, in a pool block so it can be relayed without copying
+static void mesh_input(int fd, uint8_t sock, uint8_t *buff, int rxlen, uint32_t rx_time)
+{
+    MESH_PKT_HDR *hp = (MESH_PKT_HDR *)buff;
+    uint8_t *data = &buff[sizeof(MESH_PKT_HDR)];
+    MESH_NODE *node;
+    int i;
+
+    // Ignore our own broadcasts, and truncated packets
+    if (hp->src_node == routing_table.local_node_id ||
+        hp->payload_len > rxlen - sizeof(MESH_PKT_HDR))
+        return;
+    STATS_INC(mesh.rx_pkts);
+    STATS_ADD(mesh.rx_bytes, rxlen);
+
+    // One-way latency from the sending neighbor, if both share a time base
+    node = mesh_get_node(hp->last_hop);
+    if (node && (hp->flags & MESH_FLAG_TX_SYNC) && mesh_synced() &&
+        node->sync_root == mesh_sync.root)
+    {
+        int32_t lat = (int32_t)(mesh_local_to_mesh(rx_time) - hp->tx_time);
+        STATS_VALUE(HIST_HOP_LATENCY, lat < 0 ? 0 : lat);
+        node->hop_latency = node->hop_latency ? node->hop_latency + (lat - node->hop_latency) / 8 : lat;
     }
 
-    // Application-specific data handling would go here
+    if (hp->msg_type == MESH_MSG_BEACON && rxlen >= (int)offsetof(MESH_BEACON, neighbors))
+    {
+        mesh_update_routing_table((MESH_BEACON *)buff);
+        mesh_sync_input((MESH_BEACON *)buff, rx_time);
+
+        // Remember neighbor's address, for unicast to next hop
+        for (i = 0; i < routing_table.node_count; i++)
+        {
+            if (routing_table.nodes[i].node_id == hp->src_node)
+                memcpy(&routing_table.nodes[i].addr, &sockets[sock].addr, sizeof(SOCK_ADDR));
+        }
+    }
+    else if (hp->msg_type == MESH_MSG_PUBLISH && hp->payload_len >= sizeof(MESH_PUB_HDR))
+    {
+        mesh_pub_input(fd, hp, data);
+    }
+    else if (hp->msg_type == MESH_MSG_DATA || hp->msg_type == MESH_MSG_FRAG ||
+             (hp->msg_type == MESH_MSG_CONGEST && rxlen >= (int)sizeof(MESH_CONGEST_MSG)))
+    {
+        mesh_route_packet(fd, hp, data);
+    }
+}
+
+// Socket handler for incoming mesh datagrams
+void mesh_sock_handler(int fd, uint8_t sock, int rxlen)
+{
+    uint32_t rx_time = time_us_32();
+    uint8_t *buff;
+
+    if (!mesh_enabled || rxlen < (int)sizeof(MESH_PKT_HDR) || rxlen > MESH_MAX_DGRAM ||
+        (buff = buf_alloc()) == NULL)
+        return;
+    if (get_sock_data(fd, sock, buff, rxlen))
+        mesh_input(fd, sock, buff, rxlen, rx_time);
+    buf_free(buff);
+}
+
+// Get traffic class of a packet; only control messages use the control class
+static uint8_t mesh_pkt_class(MESH_PKT_HDR *hdr)
+{
+    if (hdr->msg_type != MESH_MSG_DATA && hdr->msg_type != MESH_MSG_FRAG &&
+        hdr->msg_type != MESH_MSG_PUBLISH)
+        return MESH_CLASS_CTRL;
+    if (hdr->tclass == MESH_CLASS_CTRL || hdr->tclass >= MESH_NUM_CLASSES)
+        return MESH_CLASS_NORMAL;
+    return hdr->tclass;
+}
+
+// Get a free queue buffer, keeping some in reserve for control traffic.
+// The packet is in the given pool block if any, else a new one
+static MESH_TXQ_SLOT *mesh_txq_alloc(uint8_t tclass, uint8_t *buff)
+{
+    MESH_TXQ_SLOT *sp;
+
+    if (txq_free == MESH_TXQ_NONE ||
+        (tclass != MESH_CLASS_CTRL && txq_free_count <= MESH_TXQ_CTRL_SLOTS) ||
+        (buff = buff ? buf_ref(buff) : buf_alloc()) == NULL)
+        return NULL;
+    sp = &txq_slots[txq_free];
+    sp->data = buff;
+    txq_free = sp->next;
+    txq_free_count--;
+    return sp;
+}
+
+// Return a queue buffer to the free list, and its block to the pool
+static void mesh_txq_release(MESH_TXQ_SLOT *sp)
+{
+    buf_free(sp->data);
+    sp->data = NULL;
+    sp->next = txq_free;
+    txq_free = sp - txq_slots;
+    txq_free_count++;
+}
+
+// Find the queue for a next hop, or claim an empty one
+static MESH_TXQ *mesh_txq_find(uint8_t next_hop, bool create)
+{
+    MESH_TXQ *qp = NULL;
+    int i;
+
+    for (i = 0; i <= MESH_MAX_NODES; i++)
+    {
+        if (txqs[i].depth && txqs[i].next_hop == next_hop)
+            return &txqs[i];
+        if (!qp && !txqs[i].depth)
+            qp = &txqs[i];
+    }
+    if (qp && create)
+    {
+        qp->next_hop = next_hop;
+        return qp;
+    }
+    return NULL;
+}
+
+// Add a filled buffer to the tail of a next hop's queue for its class
+static bool mesh_txq_push(MESH_TXQ_SLOT *sp, uint8_t next_hop, uint8_t tclass)
+{
+    MESH_TXQ *qp = mesh_txq_find(next_hop, true);
+    uint8_t idx = sp - txq_slots;
+
+    if (!qp)
+    {
+        mesh_txq_release(sp);
+        return false;
+    }
+    // Mark data if the queue to this next hop is building up
+    if (tclass != MESH_CLASS_CTRL &&
+        (qp->depth >= MESH_CONGEST_DEPTH || txq_free_count <= MESH_TXQ_CTRL_SLOTS))
+    {
+        ((MESH_PKT_HDR *)sp->data)->flags |= MESH_FLAG_CE;
+        STATS_INC(mesh.ce_marked);
+    }
+    sp->next_hop = next_hop;
+    sp->next = MESH_TXQ_NONE;
+    if (qp->head[tclass] == MESH_TXQ_NONE)
+        qp->head[tclass] = idx;
+    else
+        txq_slots[qp->tail[tclass]].next = idx;
+    qp->tail[tclass] = idx;
+    qp->depth++;
+    return true;
+}
+
+// Choose class to send from a queue: control first, then weighted round-robin
+static int mesh_txq_class(MESH_TXQ *qp)
+{
+    int pass, c;
+
+    if (qp->head[MESH_CLASS_CTRL] != MESH_TXQ_NONE)
+        return MESH_CLASS_CTRL;
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (c = MESH_CLASS_CTRL+1; c < MESH_NUM_CLASSES; c++)
+        {
+            if (qp->head[c] != MESH_TXQ_NONE && qp->credit[c])
+            {
+                qp->credit[c]--;
+                return c;
+            }
+        }
+        for (c = MESH_CLASS_CTRL+1; c < MESH_NUM_CLASSES; c++)
+            qp->credit[c] = mesh_class_weights[c];
+    }
+    return -1;
+}
+
+// Queue a mesh packet for next hop node, or broadcast
+bool mesh_xmit(int fd, uint8_t next_hop, MESH_PKT_HDR *hdr, uint8_t *data)
+{
+    MESH_TXQ_SLOT *sp;
+    MESH_PKT_HDR *hp;
+    uint8_t tclass = mesh_pkt_class(hdr);
+    int len = sizeof(MESH_PKT_HDR) + hdr->payload_len;
+    // A packet already in a pool block that nothing else holds is queued in place
+    bool in_place = buf_refs((uint8_t *)hdr) == 1 && data == (uint8_t *)(hdr + 1);
+
+    if (mesh_sock < 0 || len > MESH_MAX_DGRAM)
+        return false;
+    if ((sp = mesh_txq_alloc(tclass, in_place ? (uint8_t *)hdr : NULL)) == NULL)
+    {
+        if (verbose)
+            printf("Mesh Tx queue full, class %u packet to %u dropped\n", tclass, next_hop);
+        STATS_INC(mesh.dropped);
+        // Tell the source of relayed data to slow down
+        if (tclass != MESH_CLASS_CTRL && hdr->src_node != routing_table.local_node_id)
+            mesh_send_congest(fd, hdr->src_node, hdr->dst_node, mesh_txq_depth(next_hop));
+        return false;
+    }
+    if (in_place)
+        STATS_INC(buf.shared);
+    else
+        memcpy(sp->data, hdr, sizeof(MESH_PKT_HDR));
+    hp = (MESH_PKT_HDR *)sp->data;
+    hp->last_hop = routing_table.local_node_id;
+    if (hp->src_node == routing_table.local_node_id && hp->hop_count == 0)
+    {
+        hp->orig_time = mesh_time_us();
+        hp->flags = (hp->flags & ~MESH_FLAG_ORIG_SYNC) | (mesh_synced() ? MESH_FLAG_ORIG_SYNC : 0);
+    }
+    if (!in_place)
+        memcpy(&sp->data[sizeof(MESH_PKT_HDR)], data, hdr->payload_len);
+    sp->len = len;
+    return mesh_txq_push(sp, next_hop, tclass);
+}
+
+// Send a mesh datagram to next hop node, or broadcast
+static bool mesh_xmit_now(int fd, uint8_t next_hop, uint8_t *buff, int len)
+{
+    SOCKET *sp = &sockets[mesh_sock];
+    MESH_PKT_HDR *hp = (MESH_PKT_HDR *)buff;
+    int i;
+
+    if (next_hop == MESH_BCAST_NODE)
+    {
+        sp->addr.family = IP_FAMILY;
+        sp->addr.port = swap16(sp->localport);
+        sp->addr.ip = 0xffffffff;
+    }
+    else
+    {
+        for (i = 0; i < routing_table.node_count; i++)
+        {
+            if (routing_table.nodes[i].node_id == next_hop && routing_table.nodes[i].addr.ip)
+                break;
+        }
+        if (i >= routing_table.node_count)
+        {
+            if (verbose)
+                printf("No address for next hop %u\n", next_hop);
+            return false;
+        }
+        memcpy(&sp->addr, &routing_table.nodes[i].addr, sizeof(SOCK_ADDR));
+    }
+
+    // Timestamp as late as possible, for sync and latency measurement
+    hp->tx_time = mesh_time_us();
+    hp->flags = (hp->flags & ~MESH_FLAG_TX_SYNC) | (mesh_synced() ? MESH_FLAG_TX_SYNC : 0);
+    if (hp->msg_type == MESH_MSG_BEACON && ((MESH_BEACON *)buff)->echo_node != MESH_BCAST_NODE)
+        ((MESH_BEACON *)buff)->echo_hold = hp->tx_time - ((MESH_BEACON *)buff)->echo_hold;
+    if (!put_sock_sendto(fd, mesh_sock, buff, len))
+        return false;
+    STATS_INC(mesh.tx_pkts);
+    STATS_ADD(mesh.tx_bytes, len);
+    return true;
+}
+
+// Send queued packets, visiting next hops in turn
+void mesh_txq_poll(int fd)
+{
+    MESH_TXQ *qp;
+    MESH_TXQ_SLOT *sp;
+    int n, tries, c;
+
+    // Hold packets while the mesh is paused (e.g. gateway on upstream network)
+    if (!mesh_enabled)
+        return;
+
+    for (n = 0, tries = 0; n < MESH_TXQ_BURST && tries <= MESH_MAX_NODES; )
+    {
+        qp = &txqs[txq_rr];
+        txq_rr = txq_rr < MESH_MAX_NODES ? txq_rr + 1 : 0;
+        if (!qp->depth || (c = mesh_txq_class(qp)) < 0)
+        {
+            tries++;
+            continue;
+        }
+        sp = &txq_slots[qp->head[c]];
+        qp->head[c] = sp->next;
+        qp->depth--;
+        mesh_xmit_now(fd, sp->next_hop, sp->data, sp->len);
+        mesh_txq_release(sp);
+        n++;
+        tries = 0;
+    }
+}
+
+// Send congestion notice to source of a flow, unless one was sent recently
+bool mesh_send_congest(int fd, uint8_t src_node, uint8_t dst_node, uint8_t depth)
+{
+    MESH_CONGEST_MSG msg;
+    MESH_NODE *node = mesh_get_node(src_node);
+    uint32_t now = time_us_32() / 1000;
+    int next_hop;
+
+    if (!node || (node->congest_time && now - node->congest_time < MESH_CONGEST_HOLDOFF) ||
+        (next_hop = mesh_find_route(src_node)) < 0)
+        return false;
+    node->congest_time = now;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.hdr.msg_type = MESH_MSG_CONGEST;
+    msg.hdr.src_node = routing_table.local_node_id;
+    msg.hdr.dst_node = src_node;
+    msg.hdr.seq_num = mesh_seq_num++;
+    msg.hdr.payload_len = sizeof(MESH_CONGEST_MSG) - sizeof(MESH_PKT_HDR);
+    msg.hdr.tclass = MESH_CLASS_CTRL;
+    msg.dst_node = dst_node;
+    msg.depth = depth;
+
+    if (verbose > 1)
+        printf("Congestion notice to node %u for flows to %u\n", src_node, dst_node);
+    return mesh_xmit(fd, next_hop, &msg.hdr, &msg.dst_node);
+}
+
+// Halve the source rate towards a congested destination
+void mesh_congest_input(MESH_CONGEST_MSG *msg)
+{
+    MESH_NODE *node = mesh_get_node(msg->dst_node);
+
+    if (node)
+    {
+        node->tx_rate = MAX(node->tx_rate / 2, MESH_RATE_MIN);
+        node->rate_time = time_us_32() / 1000;
+        if (verbose)
+            printf("Congestion reported by node %u, rate to node %u now %u packets/s\n",
+                   msg->hdr.src_node, msg->dst_node, node->tx_rate);
+    }
+}
+
+// Return number of packets queued for a next hop
+int mesh_txq_depth(uint8_t next_hop)
+{
+    MESH_TXQ *qp = mesh_txq_find(next_hop, false);
+
+    return qp && qp->next_hop == next_hop ? qp->depth : 0;
+}
+
+// Handle a fragment addressed to this node
+void mesh_frag_input(int fd, MESH_PKT_HDR *hdr, uint8_t *data)
+{
+    MESH_FRAG_HDR *fh = (MESH_FRAG_HDR *)data;
+    MESH_REASM *rp = NULL;
+    uint32_t now = time_us_32() / 1000, oset;
+    int i, dlen = hdr->payload_len - sizeof(MESH_FRAG_HDR);
+
+    // Find matching reassembly
+    for (i = 0; i < MESH_REASM_SLOTS && !rp; i++)
+    {
+        if (reasm_pool[i].in_use && reasm_pool[i].src_node == hdr->src_node &&
+            reasm_pool[i].frag_id == fh->frag_id)
+            rp = &reasm_pool[i];
+    }
+
+    // Validate fragment geometry: all but the last are full, and the last
+    // ends the payload; if not, the datagram is discarded
+    oset = (uint32_t)fh->index * MESH_FRAG_PAYLOAD;
+    if (dlen <= 0 || fh->count == 0 || fh->count > MESH_MAX_FRAGS ||
+        fh->index >= fh->count || fh->total_len > MESH_MAX_PAYLOAD ||
+        oset + dlen > fh->total_len ||
+        (fh->index < fh->count-1 ? dlen != MESH_FRAG_PAYLOAD : oset + dlen != fh->total_len) ||
+        (rp && (rp->count != fh->count || rp->total_len != fh->total_len)))
+    {
+        if (verbose)
+            printf("Bad fragment from node %u\n", hdr->src_node);
+        if (rp)
+            rp->in_use = false;
+        return;
+    }
+
+    // Or claim a free (or expired) slot
+    for (i = 0; i < MESH_REASM_SLOTS && !rp; i++)
+    {
+        if (!reasm_pool[i].in_use ||
+            (now - reasm_pool[i].start_time) > MESH_REASM_TIMEOUT)
+        {
+            rp = &reasm_pool[i];
+            rp->in_use = true;
+            rp->src_node = hdr->src_node;
+            rp->frag_id = fh->frag_id;
+            rp->count = fh->count;
+            rp->total_len = fh->total_len;
+            rp->rx_mask = 0;
+            rp->start_time = now;
+        }
+    }
+    if (!rp)
+    {
+        if (verbose)
+            printf("No reassembly buffer, fragment from node %u dropped\n", hdr->src_node);
+        return;
+    }
+    memcpy(&rp->data[oset], &data[sizeof(MESH_FRAG_HDR)], dlen);
+    rp->rx_mask |= 1UL << fh->index;
+
+    if (verbose > 1)
+        printf("Fragment %u/%u from node %u\n", fh->index+1, fh->count, hdr->src_node);
+
+    // Deliver when all fragments are present
+    if (rp->rx_mask == (rp->count >= 32 ? 0xffffffff : (1UL << rp->count) - 1))
+    {
+        rp->in_use = false;
+        mesh_data_handler(fd, rp->src_node, rp->data, rp->total_len);
+    }
+}
+
+// Send next fragment of outgoing payload, if pacing interval has elapsed
+void mesh_frag_poll(int fd)
+{
+    MESH_TXQ_SLOT *sp;
+    MESH_PKT_HDR *hp;
+    MESH_FRAG_HDR *fh;
+    uint32_t oset, gap;
+    int next_hop, dlen;
+
+    if (!frag_tx.in_use)
+        return;
+
+    // Fragments are paced at the allowed rate to the destination
+    gap = MAX(MESH_FRAG_GAP_US, mesh_rate_gap(mesh_get_node(frag_tx.dst_node)));
+    if (frag_tx.index > 0 && !ustimeout(&frag_tx.tim, gap))
+        return;
+
+    // Route may have changed since the last fragment
+    next_hop = mesh_find_route_flow(frag_tx.dst_node, routing_table.local_node_id, frag_tx.flow_id);
+    if (next_hop < 0)
+    {
+        printf("Route to node %u lost, fragmented send aborted\n", frag_tx.dst_node);
+        frag_tx.in_use = false;
+        return;
+    }
+
+    // Wait for a queue buffer if the queues are full
+    if ((sp = mesh_txq_alloc(frag_tx.tclass, NULL)) == NULL)
+        return;
+
+    oset = (uint32_t)frag_tx.index * MESH_FRAG_PAYLOAD;
+    dlen = MIN(MESH_FRAG_PAYLOAD, frag_tx.total_len - oset);
+
+    // Build fragment in place in the queue buffer
+    hp = (MESH_PKT_HDR *)sp->data;
+    fh = (MESH_FRAG_HDR *)&sp->data[sizeof(MESH_PKT_HDR)];
+    fh->frag_id = frag_tx.frag_id;
+    fh->index = frag_tx.index;
+    fh->count = frag_tx.count;
+    fh->total_len = frag_tx.total_len;
+    fh->x = 0;
+    memcpy(&sp->data[sizeof(MESH_PKT_HDR) + sizeof(MESH_FRAG_HDR)], &frag_tx.data[oset], dlen);
+
+    hp->msg_type = MESH_MSG_FRAG;
+    hp->src_node = routing_table.local_node_id;
+    hp->dst_node = frag_tx.dst_node;
+    hp->hop_count = 0;
+    hp->seq_num = mesh_seq_num++;
+    hp->payload_len = sizeof(MESH_FRAG_HDR) + dlen;
+    hp->flow_id = frag_tx.flow_id;
+    hp->tclass = frag_tx.tclass;
+    hp->flags = 0;
+    hp->last_hop = routing_table.local_node_id;
+    sp->len = sizeof(MESH_PKT_HDR) + hp->payload_len;
+
+    if (!mesh_txq_push(sp, next_hop, mesh_pkt_class(hp)) && verbose)
+        printf("Fragment %u to node %u failed\n", frag_tx.index+1, frag_tx.dst_node);
+    ustimeout(&frag_tx.tim, 0);
+
+    if (++frag_tx.index >= frag_tx.count)
+        frag_tx.in_use = false;
+}
+
+// Subscribe to topic, with handler for its data (NULL for default handler)
+bool mesh_subscribe(char *topic, MESH_HANDLER handler)
+{
+    uint32_t h = mesh_topic_hash(topic);
+    int i, n = -1;
+
+    for (i = 0; i < MESH_MAX_SUBS; i++)
+    {
+        if (mesh_subs[i].topic == h)
+            n = i;
+        else if (!mesh_subs[i].topic && n < 0)
+            n = i;
+    }
+    if (n < 0)
+    {
+        printf("Too many mesh subscriptions\n");
+        return false;
+    }
+    if (verbose)
+        printf("Subscribed to topic '%s'\n", topic);
+    mesh_subs[n].topic = h;
+    mesh_subs[n].handler = handler;
+    return true;
+}
+
+// Unsubscribe from topic; neighbors learn of it at the next beacon
+bool mesh_unsubscribe(char *topic)
+{
+    uint32_t h = mesh_topic_hash(topic);
+
+    for (int i = 0; i < MESH_MAX_SUBS; i++)
+    {
+        if (mesh_subs[i].topic == h)
+        {
+            mesh_subs[i].topic = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Deliver published data if subscribed, and forward it to any neighbors
+// with subscribers on their side. Return number of neighbors sent to
+static int mesh_pub_forward(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
+{
+    MESH_PUB_HDR *php = (MESH_PUB_HDR *)data;
+    MESH_NODE *node;
+    int i, lev, n = 0;
+
+    for (i = 0; i < MESH_MAX_SUBS; i++)
+    {
+        if (mesh_subs[i].topic && mesh_subs[i].topic == php->topic)
+        {
+            if (mesh_subs[i].handler)
+            {
+                STATS_INC(mesh.delivered);
+                mesh_subs[i].handler(fd, pkt->src_node, data + sizeof(MESH_PUB_HDR),
+                                     pkt->payload_len - sizeof(MESH_PUB_HDR));
+            }
+            else
+                mesh_data_handler(fd, pkt->src_node, data + sizeof(MESH_PUB_HDR),
+                                  pkt->payload_len - sizeof(MESH_PUB_HDR));
+        }
+    }
+    if (pkt->hop_count + 1 >= MESH_MAX_HOPS)
+        return 0;
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        node = &routing_table.nodes[i];
+        if (!node->is_active || node->hop_count != 1 || node->node_id == pkt->src_node ||
+            (pkt->hop_count && node->node_id == pkt->last_hop))
+            continue;
+        // Only levels within the remaining hop count are of interest
+        for (lev = 0; lev < MESH_TOPIC_LEVELS && pkt->hop_count + 1 + lev <= MESH_MAX_HOPS; lev++)
+        {
+            if (mesh_topic_test(node->topics[lev], php->topic))
+                break;
+        }
+        if (lev < MESH_TOPIC_LEVELS && pkt->hop_count + 1 + lev <= MESH_MAX_HOPS)
+        {
+            MESH_PKT_HDR hdr = *pkt;
+
+            hdr.hop_count++;
+            if (mesh_xmit(fd, node->node_id, &hdr, data))
+                n++;
+        }
+    }
+    return n;
+}
+
+// Publish data on a topic, to all nodes that have subscribed to it
+bool mesh_publish(int fd, char *topic, uint8_t *data, uint16_t len)
+{
+    MESH_PKT_HDR hdr;
+    uint8_t *buff;
+    MESH_PUB_HDR *php;
+
+    if (!mesh_enabled)
+        return false;
+    if (len > MESH_MAX_DGRAM - sizeof(MESH_PKT_HDR) - sizeof(MESH_PUB_HDR))
+    {
+        printf("Mesh publish too large (%u bytes)\n", len);
+        return false;
+    }
+    if ((buff = buf_alloc()) == NULL)
+        return false;
+    php = (MESH_PUB_HDR *)buff;
+    php->topic = mesh_topic_hash(topic);
+    memcpy(&buff[sizeof(MESH_PUB_HDR)], data, len);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_type = MESH_MSG_PUBLISH;
+    hdr.src_node = routing_table.local_node_id;
+    hdr.dst_node = MESH_BCAST_NODE;
+    hdr.seq_num = mesh_seq_num++;
+    hdr.payload_len = sizeof(MESH_PUB_HDR) + len;
+    hdr.tclass = MESH_CLASS_NORMAL;
+    mesh_is_duplicate(&hdr);
+
+    if (verbose > 1)
+        printf("Publishing %u bytes on topic '%s'\n", len, topic);
+    mesh_pub_forward(fd, &hdr, buff);
+    buf_free(buff);
+    return true;
+}
+
+// Handle published data received from a neighbor
+void mesh_pub_input(int fd, MESH_PKT_HDR *pkt, uint8_t *data)
+{
+    // Filters may overlap, so the same data can arrive by several paths
+    if (mesh_is_duplicate(pkt))
+    {
+        STATS_INC(mesh.duplicates);
+        return;
+    }
+    STATS_ADD(mesh.forwarded, mesh_pub_forward(fd, pkt, data));
+}
+
+// Clear regression table, keeping current estimate until new points arrive
+static void mesh_sync_reset(uint8_t root, uint8_t parent, uint8_t hops)
+{
+    if (verbose && (root != mesh_sync.root || parent != mesh_sync.parent))
+        printf("Time sync: root %u via %u, %u hops\n", root, parent, hops);
+    mesh_sync.root = root;
+    mesh_sync.parent = parent;
+    mesh_sync.hops = hops;
+    mesh_sync.count = mesh_sync.idx = 0;
+    mesh_sync.delay = 0;
+}
+
+// Fit offset against local time by least squares, to get offset and skew
+static void mesh_sync_fit(void)
+{
+    int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, n = mesh_sync.count;
+    int32_t x, y, newest = (mesh_sync.idx + MESH_SYNC_ENTRIES - 1) % MESH_SYNC_ENTRIES;
+    uint32_t err;
+    int i;
+
+    // Times in ms relative to newest entry, offsets in us relative to its offset
+    mesh_sync.ref = mesh_sync.local[newest];
+    for (i = 0; i < n; i++)
+    {
+        x = (int32_t)(mesh_sync.local[i] - mesh_sync.ref) / 1000;
+        y = mesh_sync.offset[i] - mesh_sync.offset[newest];
+        sx += x;
+        sy += y;
+        sxx += (int64_t)x * x;
+        sxy += (int64_t)x * y;
+    }
+    // Slope of 1 us per ms is 10^6 ppb; intercept is at the newest entry
+    mesh_sync.skew_ppb = n > 1 && n*sxx != sx*sx ?
+        (int32_t)((n*sxy - sx*sy) * 1000000 / (n*sxx - sx*sx)) : 0;
+    mesh_sync.ref_offset = mesh_sync.offset[newest] +
+        (int32_t)((sy - sx * mesh_sync.skew_ppb / 1000000) / n);
+
+    // Largest residual of the fit
+    mesh_sync.error = 0;
+    for (i = 0; i < n; i++)
+    {
+        y = (int32_t)(mesh_local_to_mesh(mesh_sync.local[i]) - mesh_sync.local[i]) - mesh_sync.offset[i];
+        err = y < 0 ? -y : y;
+        mesh_sync.error = MAX(mesh_sync.error, err);
+    }
+}
+
+// Take time from a neighbor's beacon; its tx_time was stamped just before sending
+void mesh_sync_input(MESH_BEACON *beacon, uint32_t rx_time)
+{
+    uint32_t now = rx_time / 1000;
+    uint8_t sender = beacon->node_id, local = routing_table.local_node_id;
+    MESH_NODE *node = mesh_get_node(sender);
+    int32_t err, delay;
+    int i;
+
+    if (beacon->sync_hops == MESH_SYNC_NONE || !(beacon->hdr.flags & MESH_FLAG_TX_SYNC))
+        return;
+
+    // A child's beacon is echoed in our next one, to measure the delay
+    if (node && beacon->sync_parent == local && beacon->sync_root == mesh_sync.root)
+    {
+        node->echo_due = true;
+        node->echo_time = beacon->hdr.tx_time;
+        node->echo_rx = rx_time;
+    }
+
+    // Ignore news of a lost root for a while, unless heard from the root itself
+    if (beacon->sync_root == mesh_sync.lost_root && sender != beacon->sync_root &&
+        now - mesh_sync.lost_time < MESH_SYNC_TIMEOUT &&
+        !MESH_SEQ_NEWER(beacon->sync_seq, mesh_sync.lost_seq))
+        return;
+
+    // Lower root wins; otherwise prefer an up-to-date parent nearer the root
+    if (beacon->sync_root < mesh_sync.root)
+    {
+        mesh_sync_reset(beacon->sync_root, sender, beacon->sync_hops + 1);
+        mesh_sync.seq = beacon->sync_seq - 1;
+    }
+    else if (beacon->sync_root == mesh_sync.root && sender != mesh_sync.parent &&
+             beacon->sync_hops + 1 < mesh_sync.hops &&
+             !MESH_SEQ_NEWER(mesh_sync.seq, beacon->sync_seq))
+        mesh_sync_reset(beacon->sync_root, sender, beacon->sync_hops + 1);
+    if (beacon->sync_root != mesh_sync.root || mesh_sync.root == local)
+        return;
+
+    // Only a new beacon count shows the root is alive, as neighbors can
+    // otherwise keep repeating an old one to each other
+    if (MESH_SEQ_NEWER(beacon->sync_seq, mesh_sync.seq) || sender == mesh_sync.root)
+    {
+        mesh_sync.seq = beacon->sync_seq;
+        mesh_sync.root_time = now;
+    }
+    if (sender != mesh_sync.parent)
+        return;
+
+    // Round trip to parent and back, less its hold time, in our mesh time.
+    // Offsets are corrected for half of it, including those already taken
+    if (beacon->echo_node == local && mesh_sync.count)
+    {
+        delay = (int32_t)(mesh_local_to_mesh(rx_time) - beacon->echo_time - beacon->echo_hold) / 2;
+        if (delay > 0 && delay < MESH_SYNC_MAX_RTT / 2)
+        {
+            delay = mesh_sync.delay ? mesh_sync.delay + (delay - mesh_sync.delay) / 4 : delay;
+            for (i = 0; i < mesh_sync.count; i++)
+                mesh_sync.offset[i] += delay - mesh_sync.delay;
+            mesh_sync.delay = delay;
+            mesh_sync_fit();
+        }
+    }
+
+    // Check prediction before adding new point, as a measure of accuracy
+    if (mesh_sync.count)
+    {
+        err = (int32_t)(mesh_local_to_mesh(rx_time) - beacon->hdr.tx_time - mesh_sync.delay);
+        mesh_sync.last_error = err < 0 ? -err : err;
+        STATS_VALUE(HIST_SYNC_ERROR, mesh_sync.last_error);
+        TRACE_INSTANT(TR_MESH_SYNC, MIN(mesh_sync.last_error, 0xffff));
+    }
+    mesh_sync.local[mesh_sync.idx] = rx_time;
+    mesh_sync.offset[mesh_sync.idx] = (int32_t)(beacon->hdr.tx_time + mesh_sync.delay - rx_time);
+    mesh_sync.idx = (mesh_sync.idx + 1) % MESH_SYNC_ENTRIES;
+    mesh_sync.count = MIN(mesh_sync.count + 1, MESH_SYNC_ENTRIES);
+    mesh_sync.hops = beacon->sync_hops + 1;
+    mesh_sync.parent_time = now;
+    STATS_INC(mesh.sync_samples);
+    mesh_sync_fit();
+}
+
+// Drop parent or root if they have gone silent
+void mesh_sync_poll(void)
+{
+    uint32_t now = time_us_32() / 1000;
+    uint8_t local = routing_table.local_node_id;
+
+    if (mesh_sync.root == local)
+        return;
+    if (now - mesh_sync.root_time > MESH_SYNC_TIMEOUT)
+    {
+        mesh_sync.lost_root = mesh_sync.root;
+        mesh_sync.lost_seq = mesh_sync.seq;
+        mesh_sync.lost_time = now;
+        STATS_INC(mesh.sync_resets);
+        mesh_sync_reset(local, local, 0);
+    }
+    else if (mesh_sync.hops != MESH_SYNC_NONE && now - mesh_sync.parent_time > MESH_SYNC_TIMEOUT)
+    {
+        STATS_INC(mesh.sync_resets);
+        mesh_sync_reset(mesh_sync.root, local, MESH_SYNC_NONE);
+    }
+}
+
+// Check if mesh time is valid: either we are the root, or tracking it
+bool mesh_synced(void)
+{
+    return mesh_sync.root == routing_table.local_node_id ||
+           (mesh_sync.hops != MESH_SYNC_NONE && mesh_sync.count > 0);
+}
+
+// Convert local time to mesh time (us)
+uint32_t mesh_local_to_mesh(uint32_t local)
+{
+    if (mesh_sync.root == routing_table.local_node_id)
+        return local;
+    return local + mesh_sync.ref_offset +
+           (int32_t)((int64_t)(int32_t)(local - mesh_sync.ref) * mesh_sync.skew_ppb / 1000000000);
+}
+
+// Get current mesh time (us)
+uint32_t mesh_time_us(void)
+{
+    return mesh_local_to_mesh(time_us_32());
+}
+
+// Get time synchronisation state, for status reports
+MESH_SYNC *mesh_sync_status(void)
+{
+    return &mesh_sync;
 }
 
 // Print routing table for debugging
@@ -459,19 +2201,58 @@ void mesh_print_routing_table(void)
     printf("\n=== Mesh Routing Table ===\n");
     printf("Local Node ID: %u (%s)\n", routing_table.local_node_id, local_node_name);
     printf("Active Nodes: %u\n", routing_table.node_count);
-    printf("Node ID  Hops  Next Hop  Active\n");
-    printf("-------  ----  --------  ------\n");
+    printf("Node ID  Hops  Next Hop  Active  Rate  Queue  Hop us  Path us  Alternates\n");
+    printf("-------  ----  --------  ------  ----  -----  ------  -------  ----------\n");
 
     for (i = 0; i < routing_table.node_count; i++)
     {
         MESH_NODE *node = &routing_table.nodes[i];
-        printf("   %3u    %2u      %3u      %s\n",
+        printf("   %3u    %2u      %3u      %-3s   %4u    %2d  %6ld  %7ld  ",
                node->node_id,
                node->hop_count,
                node->next_hop,
-               node->is_active ? "Yes" : "No");
+               node->is_active ? "Yes" : "No",
+               node->tx_rate,
+               mesh_txq_depth(node->node_id),
+               (long)node->hop_latency,
+               (long)node->path_latency);
+        for (uint8_t j = 0; j < node->hop_n; j++)
+        {
+            if (node->hops[j].node_id != node->next_hop)
+                printf(" %u(%u)", node->hops[j].node_id, node->hops[j].metric);
+        }
+        printf("\n");
     }
-    printf("========================\n\n");
+
+    // Neighbors that can't hear each other
+    for (i = 0; i < routing_table.node_count; i++)
+    {
+        for (uint8_t j = i+1; j < routing_table.node_count; j++)
+        {
+            if (mesh_hidden_pair(routing_table.nodes[i].node_id, routing_table.nodes[j].node_id))
+                printf("Hidden nodes: %u and %u\n", routing_table.nodes[i].node_id,
+                       routing_table.nodes[j].node_id);
+        }
+    }
+    MESH_SYNC *ms = &mesh_sync;
+    printf("Time root %u, %s, hops %u via %u, offset %ld us, delay %ld us, skew %ld ppb, "
+           "error %lu us (latest %lu us)\n",
+           ms->root, mesh_synced() ? "synced" : "not synced", ms->hops, ms->parent,
+           (long)ms->ref_offset, (long)ms->delay, (long)ms->skew_ppb,
+           (unsigned long)ms->error, (unsigned long)ms->last_error);
+    printf("Relays (MPR):");
+    for (uint8_t i = 0; i < routing_table.node_count; i++)
+    {
+        if (NBR_MAP_TEST(mpr_map, routing_table.nodes[i].node_id))
+            printf(" %u", routing_table.nodes[i].node_id);
+    }
+    printf("\nRelaying for:");
+    for (uint8_t i = 0; i < routing_table.node_count; i++)
+    {
+        if (routing_table.nodes[i].is_active && routing_table.nodes[i].mpr_selector)
+            printf(" %u", routing_table.nodes[i].node_id);
+    }
+    printf("\n========================\n\n");
 }
 
 // Check if P2P is enabled
@@ -486,6 +2267,12 @@ bool is_mesh_enabled(void)
     return mesh_enabled;
 }
 
+// Get node ID of this node
+uint8_t mesh_local_node(void)
+{
+    return routing_table.local_node_id;
+}
+
 // P2P peer found callback (called when a peer is discovered)
 void p2p_peer_found_handler(P2P_PEER *peer)
 {
@@ -35,15 +35,100 @@
 #define P2P_LISTEN_CHAN     P2P_CHAN_1
 #define P2P_LISTEN_PERIOD   100
 
+// Peer table: peers are found by scanning for P2P group SSIDs
+#define P2P_MAX_PEERS       16
+#define P2P_PEER_HASH       32     // Hash slots for MAC lookup, power of 2
+#define P2P_PEER_TIMEOUT    30000  // Peer not heard for this long is stale (ms)
+#define P2P_RSSI_SHIFT      2      // Smoothing, new RSSI has weight 1/4
+#define P2P_SSID_PREFIX     "DIRECT-"
+#define P2P_SEARCH_INTERVAL 20000  // Peer search by main loop, less than timeout (ms)
+
 // WPS trigger types for P2P
 #define WPS_PBC             4   // Push Button Configuration
 #define WPS_PIN             0   // PIN method
 
 // Mesh network configuration
+#ifndef MESH_MAX_NODES
 #define MESH_MAX_NODES      8
+#endif
 #define MESH_BEACON_INTERVAL 5000  // Beacon interval in ms
 #define MESH_ROUTE_TIMEOUT  30000  // Route timeout in ms
 #define MESH_MAX_HOPS       4      // Maximum hops in mesh
+#define MESH_BCAST_NODE     0xFF   // Broadcast destination node_id
+#define MESH_MAX_NEXT_HOPS  3      // Next hops kept per destination
+
+// Encoding of neighbor set in beacons
+#define MESH_NBR_LIST       0      // List of node IDs, up to MESH_MAX_NODES
+#define MESH_NBR_BITMAP     1      // One bit per node ID, exact
+#define MESH_NBR_BLOOM      2      // Bloom filter, smaller but approximate
+#ifndef MESH_NBR_ENCODING
+#define MESH_NBR_ENCODING   MESH_NBR_BITMAP
+#endif
+#define MESH_NBR_MAP_BYTES  32     // Bitmap over the 8-bit node ID space
+#define MESH_BLOOM_BYTES    16
+#define MESH_BLOOM_HASHES   3
+#if MESH_NBR_ENCODING == MESH_NBR_LIST
+#define MESH_NBR_SET_BYTES  MESH_MAX_NODES
+#elif MESH_NBR_ENCODING == MESH_NBR_BITMAP
+#define MESH_NBR_SET_BYTES  MESH_NBR_MAP_BYTES
+#else
+#define MESH_NBR_SET_BYTES  MESH_BLOOM_BYTES
+#endif
+
+// Flooding of broadcasts through multipoint relays (MPRs)
+#define MESH_DUP_ENTRIES    16     // Recent broadcasts remembered
+#define MESH_DUP_TIMEOUT    10000  // Time to remember a broadcast (ms)
+
+// Time synchronisation: the lowest node ID heard is the time root, others
+// estimate offset and drift from beacons of a neighbor nearer the root
+#define MESH_SYNC_ENTRIES   8      // Beacon timestamps used for regression
+#define MESH_SYNC_TIMEOUT   (4 * MESH_BEACON_INTERVAL)  // Loss of sync (ms)
+#define MESH_SYNC_NONE      0xFF   // Hops from root, if not synchronised
+#define MESH_FLAG_TX_SYNC   0x02   // tx_time is synchronised mesh time
+#define MESH_FLAG_ORIG_SYNC 0x04   // orig_time is synchronised mesh time
+#define MESH_SYNC_MAX_RTT   100000 // Longest round trip used for delay (us)
+
+// Root beacon counts wrap, so are compared by difference
+#define MESH_SEQ_NEWER(a, b) ((int16_t)((uint16_t)(a) - (uint16_t)(b)) > 0)
+
+// Publish/subscribe: each beacon has Bloom filters of topics subscribed to
+// by the sender (level 0), and by nodes 1 or more hops beyond it
+#define MESH_TOPIC_LEVELS   3      // Levels of attenuated Bloom filter
+#define MESH_TOPIC_BYTES    8      // Bytes per level
+#define MESH_TOPIC_HASHES   2      // Bits set per topic
+#define MESH_MAX_SUBS       8      // Local subscriptions
+
+// Node ID bitmap access
+#define NBR_MAP_SET(m, id)  ((m)[(id) >> 3] |= 1 << ((id) & 7))
+#define NBR_MAP_TEST(m, id) (((m)[(id) >> 3] >> ((id) & 7)) & 1)
+
+// Mesh fragmentation
+#define MESH_MAX_DGRAM      1400   // Largest mesh datagram (header + payload)
+#define MESH_MAX_PAYLOAD    8192   // Largest payload accepted by mesh_send_data
+#define MESH_MAX_FRAGS      32     // Fragments per payload (bits in rx_mask)
+#define MESH_REASM_SLOTS    2      // Concurrent reassemblies
+#define MESH_REASM_TIMEOUT  2000   // Reassembly timeout in ms
+#define MESH_FRAG_GAP_US    2000   // Minimum gap between fragments in us
+
+// Mesh transmit queues and traffic classes
+#define MESH_CLASS_CTRL     0      // Beacons, route requests/responses, ACKs
+#define MESH_CLASS_HIGH     1      // Latency-sensitive application data
+#define MESH_CLASS_NORMAL   2      // Default application data
+#define MESH_CLASS_BULK     3      // Bulk transfers
+#define MESH_NUM_CLASSES    4
+#define MESH_TXQ_SLOTS      8      // Packet buffers shared by all queues
+#define MESH_TXQ_CTRL_SLOTS 2      // Buffers reserved for control traffic
+#define MESH_TXQ_BURST      4      // Max packets sent per poll
+#define MESH_TXQ_NONE       0xFF
+
+// Mesh congestion control
+#define MESH_FLAG_CE        0x01   // Congestion experienced on the path
+#define MESH_CONGEST_DEPTH  3      // Next hop queue depth that marks packets
+#define MESH_CONGEST_HOLDOFF 100   // Min ms between notifications to a source
+#define MESH_RATE_MAX       500    // Source rate per destination, packets/s
+#define MESH_RATE_MIN       5
+#define MESH_RATE_STEP      10     // Rate increase per recovery interval
+#define MESH_RATE_RECOVER   100    // Recovery interval in ms
 
 // Mesh message types
 #define MESH_MSG_BEACON     0x01
@@ -51,6 +136,9 @@
 #define MESH_MSG_ROUTE_REQ  0x03
 #define MESH_MSG_ROUTE_RESP 0x04
 #define MESH_MSG_ACK        0x05
+#define MESH_MSG_FRAG       0x06
+#define MESH_MSG_CONGEST    0x07
+#define MESH_MSG_PUBLISH    0x08
 
 // P2P Enable command structure
 typedef struct {
@@ -78,18 +166,44 @@ typedef struct {
     uint8_t mac_addr[6];
     uint8_t device_name[32];
     uint8_t channel;
-    int8_t rssi;
-    uint32_t last_seen;
+    int8_t rssi;           // Latest RSSI
+    uint32_t last_seen;    // Time last heard (ms)
+    bool in_use;
+    int16_t rssi_avg;      // Smoothed RSSI, times 16
+    uint16_t count;        // Number of times heard
 } P2P_PEER;
 
+// Candidate next hop for a destination
+typedef struct {
+    uint8_t node_id;
+    uint8_t metric;        // Hop count via this neighbor
+    uint32_t last_update;
+} MESH_NEXT_HOP;
+
 // Mesh node information
 typedef struct {
     uint8_t node_id;
     uint8_t mac_addr[6];
-    uint8_t hop_count;
+    uint8_t hop_count;     // Best metric of all next hops
     uint8_t next_hop;      // Next hop node_id to reach this node
     uint32_t last_update;
     bool is_active;
+    SOCK_ADDR addr;        // UDP address, if direct neighbor
+    MESH_NEXT_HOP hops[MESH_MAX_NEXT_HOPS];
+    uint8_t hop_n;
+    uint16_t tx_rate;      // Allowed send rate to this node, packets/s
+    uint32_t tx_time;      // Time of last send to this node (us)
+    uint32_t rate_time;    // Time of last rate change (ms)
+    uint32_t congest_time; // Time of last congestion notice to this node (ms)
+    uint8_t nbr_map[MESH_NBR_MAP_BYTES]; // Neighbors of this node, from its beacon
+    bool mpr_selector;     // Node has chosen us as a relay for its broadcasts
+    uint8_t sync_root;     // Time root used by this node, from its beacon
+    bool echo_due;         // Node takes time from us, and its beacon is to be echoed
+    uint32_t echo_time;    // tx_time of its latest beacon (us)
+    uint32_t echo_rx;      // Local time that beacon was received (us)
+    int32_t hop_latency;   // Average one-way latency from this neighbor (us)
+    int32_t path_latency;  // Average end-to-end latency from this node (us)
+    uint8_t topics[MESH_TOPIC_LEVELS][MESH_TOPIC_BYTES]; // Subscriptions via this node
 } MESH_NODE;
 
 // Mesh routing table
@@ -107,17 +221,149 @@ typedef struct {
     uint8_t hop_count;
     uint16_t seq_num;
     uint16_t payload_len;
+    uint8_t flow_id;       // Keeps a flow on one of several equal-cost paths
+    uint8_t tclass;        // Traffic class of data packets (MESH_CLASS_xxx)
+    uint8_t flags;         // MESH_FLAG_xxx
+    uint8_t last_hop;      // Node that sent this copy of the packet
+    uint32_t tx_time;      // Sender's mesh time when this copy was sent (us)
+    uint32_t orig_time;    // Source's mesh time when packet was created (us)
 } MESH_PKT_HDR;
 
+// Route advertised in a beacon, to a node 2 or more hops away
+typedef struct {
+    uint8_t node_id;
+    uint8_t metric;        // Sender's hop count to the node
+    uint8_t next_hop;      // Sender's next hop, so it isn't offered back to it
+} MESH_ROUTE_ENTRY;
+
 // Mesh beacon packet
 typedef struct {
     MESH_PKT_HDR hdr;
     uint8_t node_id;
     uint8_t node_name[16];
-    uint8_t neighbors[MESH_MAX_NODES];
     uint8_t neighbor_count;
+    uint8_t nbr_encoding;  // MESH_NBR_xxx
+    uint8_t mpr_count;
+    uint8_t sync_root;     // Sender's time root
+    uint8_t sync_hops;     // Sender's hops from root, or MESH_SYNC_NONE
+    uint8_t sync_parent;   // Sender's parent, which echoes its beacons
+    uint8_t echo_node;     // Child whose beacon is echoed, or MESH_BCAST_NODE
+    uint32_t echo_time;    // tx_time of that child's beacon (us)
+    uint32_t echo_hold;    // Mesh time between receiving it and sending this (us)
+    uint16_t sync_seq;     // Root's beacon count, passed on by other nodes
+    uint8_t topics[MESH_TOPIC_LEVELS][MESH_TOPIC_BYTES]; // Subscriptions at 0, 1.. hops
+    uint8_t set_len;       // Bytes in each neighbor set; later fields follow them
+    uint8_t neighbors[MESH_NBR_SET_BYTES];  // Neighbor set, in given encoding
+    uint8_t mprs[MESH_NBR_SET_BYTES];       // Neighbors chosen to relay broadcasts
+    uint8_t route_count;
+    MESH_ROUTE_ENTRY routes[MESH_MAX_NODES]; // Learned routes, only route_count sent
 } MESH_BEACON;
 
+// Time synchronisation state
+typedef struct {
+    uint8_t root;          // Node providing the time base
+    uint8_t hops;          // Hops from root, MESH_SYNC_NONE if unsynchronised
+    uint8_t parent;        // Neighbor we take time from
+    uint8_t count, idx;    // Entries in regression table, next to be replaced
+    uint16_t seq;          // Latest root beacon count
+    uint8_t lost_root;     // Root that timed out, and its last count, so
+    uint16_t lost_seq;     // stale news of it is ignored for a while
+    uint32_t lost_time;    // Time root was lost (ms)
+    uint32_t root_time;    // Time a new root beacon count was last heard (ms)
+    uint32_t parent_time;  // Time parent was last heard from (ms)
+    uint32_t local[MESH_SYNC_ENTRIES];  // Local time of parent's beacons (us)
+    int32_t offset[MESH_SYNC_ENTRIES];  // Mesh time minus local time (us)
+    uint32_t ref;          // Local time of regression reference point (us)
+    int32_t ref_offset;    // Offset at reference point (us)
+    int32_t skew_ppb;      // Drift of mesh time relative to local clock
+    int32_t delay;         // One-way delay from parent, half the round trip (us)
+    uint32_t error;        // Largest regression residual (us)
+    uint32_t last_error;   // Prediction error of latest beacon (us)
+} MESH_SYNC;
+
+// Recently seen broadcast, for duplicate suppression
+typedef struct {
+    uint8_t src_node;
+    uint16_t seq_num;
+    bool relayed;          // Retransmitted by this node
+    uint32_t time;         // Time received (ms)
+} MESH_DUP_ENTRY;
+
+// Congestion notification, sent back to the source of marked or dropped data
+typedef struct {
+    MESH_PKT_HDR hdr;
+    uint8_t dst_node;      // Destination of the congested flow
+    uint8_t depth;         // Queue depth at the congested node
+    uint8_t x[2];
+} MESH_CONGEST_MSG;
+
+// Fragment header, follows MESH_PKT_HDR in MESH_MSG_FRAG packets
+typedef struct {
+    uint16_t frag_id;      // Sequence number shared by all fragments
+    uint8_t index, count;
+    uint16_t total_len, x;
+} MESH_FRAG_HDR;
+
+// Payload bytes carried by each fragment
+#define MESH_FRAG_PAYLOAD   (MESH_MAX_DGRAM - sizeof(MESH_PKT_HDR) - sizeof(MESH_FRAG_HDR))
+
+// Reassembly buffer
+typedef struct {
+    bool in_use;
+    uint8_t src_node, count;
+    uint16_t frag_id, total_len;
+    uint32_t rx_mask;      // Bitmap of fragments received
+    uint32_t start_time;   // Time first fragment arrived (ms)
+    uint8_t data[MESH_MAX_PAYLOAD];
+} MESH_REASM;
+
+// Outgoing fragmented payload, paced by mesh_beacon_handler
+typedef struct {
+    bool in_use;
+    uint8_t dst_node, flow_id, tclass, index, count;
+    uint16_t frag_id, total_len;
+    uint32_t tim;          // Time of last fragment (us)
+    uint8_t data[MESH_MAX_PAYLOAD];
+} MESH_FRAG_TX;
+
+// Transmit queue entry, holding one complete mesh datagram in a pool block
+typedef struct {
+    uint8_t next;          // Next buffer in queue or free list
+    uint8_t next_hop;
+    uint16_t len;
+    uint8_t *data;
+} MESH_TXQ_SLOT;
+
+// Transmit queue for one next hop, with a FIFO per traffic class
+typedef struct {
+    uint8_t next_hop, depth;
+    uint8_t head[MESH_NUM_CLASSES], tail[MESH_NUM_CLASSES];
+    uint8_t credit[MESH_NUM_CLASSES];
+} MESH_TXQ;
+
+// Result of mesh_send_data() and mesh_send_flow(). Failed and sent are 0
+// and 1, as for a bool; the others were not sent, but can be retried
+typedef enum {
+    MESH_SEND_FAIL = 0,         // Mesh off, too large, no route or queue full
+    MESH_SEND_OK,               // Queued for sending
+    MESH_SEND_RATE_LIMITED,     // Over the rate to the destination, see mesh_send_wait()
+    MESH_SEND_BUSY              // Fragmented send in progress, see mesh_tx_busy()
+} MESH_SEND_RESULT;
+
+// Application handler for mesh data addressed to this node
+typedef void (* MESH_HANDLER)(int fd, uint8_t src_node, uint8_t *data, uint16_t len);
+
+// Published data header, follows MESH_PKT_HDR in MESH_MSG_PUBLISH packets
+typedef struct {
+    uint32_t topic;        // Hash of topic name
+} MESH_PUB_HDR;
+
+// Local subscription
+typedef struct {
+    uint32_t topic;
+    MESH_HANDLER handler;  // Handler for topic, or NULL for default handler
+} MESH_SUB;
+
 // Function declarations
 
 // P2P Mode Functions
@@ -129,23 +375,75 @@ bool p2p_connect(int fd, char *device_name, uint8_t channel);
 bool p2p_connect_wps_pbc(int fd);
 bool p2p_connect_wps_pin(int fd, uint8_t *pin);
 void p2p_peer_found_handler(P2P_PEER *peer);
+void p2p_check_resp(int fd, uint16_t gop, RESP_MSG *rmp);
+
+// P2P peer table
+P2P_PEER *p2p_peer_update(uint8_t *mac, char *name, uint8_t channel, int8_t rssi);
+P2P_PEER *p2p_peer_find(uint8_t *mac);
+P2P_PEER *p2p_peer_find_name(char *name);
+int p2p_best_peers(P2P_PEER **peers, int maxn);
+void p2p_print_peers(void);
 
 // Mesh Network Functions
 bool mesh_init(int fd, uint8_t node_id, char *node_name);
 bool mesh_enable(int fd);
 bool mesh_disable(int fd);
 bool mesh_send_beacon(int fd);
-bool mesh_send_data(int fd, uint8_t dst_node, uint8_t *data, uint16_t len);
+MESH_SEND_RESULT mesh_send_data(int fd, uint8_t dst_node, uint8_t *data, uint16_t len);
+MESH_SEND_RESULT mesh_send_flow(int fd, uint8_t dst_node, uint8_t flow_id, uint8_t tclass,
+                                uint8_t *data, uint16_t len);
+uint32_t mesh_send_wait(uint8_t dst_node);
+bool mesh_tx_busy(void);
 bool mesh_route_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data);
 void mesh_update_routing_table(MESH_BEACON *beacon);
 int mesh_find_route(uint8_t dst_node);
+int mesh_find_route_flow(uint8_t dst_node, uint8_t src_node, uint8_t flow_id);
 void mesh_beacon_handler(int fd);
-void mesh_data_handler(int fd, uint8_t *data, uint16_t len);
+void mesh_data_handler(int fd, uint8_t src_node, uint8_t *data, uint16_t len);
+void mesh_set_handler(MESH_HANDLER handler);
+
+// Mesh transport
+int mesh_open_sock(uint16_t port);
+void mesh_sock_handler(int fd, uint8_t sock, int rxlen);
+bool mesh_xmit(int fd, uint8_t next_hop, MESH_PKT_HDR *hdr, uint8_t *data);
+void mesh_frag_input(int fd, MESH_PKT_HDR *hdr, uint8_t *data);
+void mesh_frag_poll(int fd);
+void mesh_txq_poll(int fd);
+int mesh_txq_depth(uint8_t next_hop);
+bool mesh_send_congest(int fd, uint8_t src_node, uint8_t dst_node, uint8_t depth);
+void mesh_congest_input(MESH_CONGEST_MSG *msg);
+
+// Neighborhood functions
+void mesh_nbrset_add(uint8_t *set, uint8_t node_id);
+int mesh_nbrset_size(uint8_t encoding);
+void mesh_nbrset_decode(uint8_t encoding, uint8_t *set, int count, uint8_t *map);
+bool mesh_is_neighbor_of(uint8_t node_id, uint8_t other);
+int mesh_two_hop_via(uint8_t dst_node, uint8_t *via, int maxn);
+bool mesh_hidden_pair(uint8_t node_a, uint8_t node_b);
+int mesh_compute_mpr(void);
+bool mesh_is_duplicate(MESH_PKT_HDR *hdr);
+bool mesh_flood_packet(int fd, MESH_PKT_HDR *pkt, uint8_t *data);
+
+// Publish/subscribe
+uint32_t mesh_topic_hash(char *topic);
+bool mesh_subscribe(char *topic, MESH_HANDLER handler);
+bool mesh_unsubscribe(char *topic);
+bool mesh_publish(int fd, char *topic, uint8_t *data, uint16_t len);
+void mesh_pub_input(int fd, MESH_PKT_HDR *pkt, uint8_t *data);
+
+// Time synchronisation
+void mesh_sync_input(MESH_BEACON *beacon, uint32_t rx_time);
+void mesh_sync_poll(void);
+bool mesh_synced(void);
+uint32_t mesh_time_us(void);
+uint32_t mesh_local_to_mesh(uint32_t local);
+MESH_SYNC *mesh_sync_status(void);
 
 // Utility functions
 void mesh_print_routing_table(void);
 bool is_p2p_enabled(void);
 bool is_mesh_enabled(void);
+uint8_t mesh_local_node(void);
 
 #endif // WINC_P2P_H
 
@@ -0,0 +1,130 @@
+// ATWINC1500/1510 WiFi module packet capture output for the Pico 2W
+//
+// Socket data as synthetic Ethernet/IP frames, for conversion to pcap
+// Based on original work by Jeremy P Bentham
+//
+// The WINC1500 handles the network stack itself, so the driver only sees
+// socket payloads and addresses. Each payload sent or read is given
+// Ethernet, IPv4 and UDP or TCP headers, using the socket's remote address
+// and the module's own address and local port, and output over the UART as
+// a hex line; uart2pcap.py converts these to a pcap file or stream for
+// Wireshark. TCP sequence numbers count the bytes in each direction, so
+// streams can be followed; checksums are not set.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_pcap.h"
+
+#define ETH_TYPE_IP     0x0800
+#define IP_PROTO_TCP    6
+#define IP_PROTO_UDP    17
+#define TCP_PSH_ACK     0x18
+
+extern SOCKET sockets[MAX_SOCKETS];
+
+static uint16_t pcap_ip_id;
+static uint32_t pcap_tx_seq[MAX_SOCKETS], pcap_rx_seq[MAX_SOCKETS];
+
+// Put big-endian values into frame
+static uint8_t *put16(uint8_t *p, uint16_t val)
+{
+    *p++ = (uint8_t)(val >> 8);
+    *p++ = (uint8_t)val;
+    return(p);
+}
+static uint8_t *put32(uint8_t *p, uint32_t val)
+{
+    return(put16(put16(p, (uint16_t)(val >> 16)), (uint16_t)val));
+}
+
+// Put IP address or port, already in network byte order
+static uint8_t *put_net(uint8_t *p, void *val, int len)
+{
+    memcpy(p, val, len);
+    return(p + len);
+}
+
+// Get IP header checksum
+static uint16_t ip_checksum(uint8_t *p, int len)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i += 2)
+        sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return((uint16_t)~sum);
+}
+
+// Output socket payload as an Ethernet frame
+void pcap_sock(uint8_t sock, bool tx, void *data, int len)
+{
+    static const uint8_t local_mac[6] = {0x02, 0, 0, 0, 0, 0x01};
+    static const uint8_t remote_mac[6] = {0x02, 0, 0, 0, 0, 0x02};
+    SOCKET *sp = &sockets[sock];
+    bool tcp = sock < MIN_UDP_SOCK;
+    uint8_t hdr[PCAP_MAX_HDR_LEN], *p = hdr, *ip;
+    uint16_t localport;
+    int i, hlen = PCAP_IP_HDR_LEN + (tcp ? PCAP_TCP_HDR_LEN : PCAP_UDP_HDR_LEN);
+    uint32_t t = usec();
+
+    if (sock >= MAX_SOCKETS || len <= 0)
+        return;
+    localport = swap16(sp->localport);
+
+    // Ethernet
+    p = put_net(p, (void *)(tx ? remote_mac : local_mac), 6);
+    p = put_net(p, (void *)(tx ? local_mac : remote_mac), 6);
+    p = put16(p, ETH_TYPE_IP);
+
+    // IPv4
+    ip = p;
+    *p++ = 0x45;
+    *p++ = 0;
+    p = put16(p, (uint16_t)(hlen + len));
+    p = put16(p, pcap_ip_id++);
+    p = put16(p, 0x4000);
+    *p++ = 64;
+    *p++ = tcp ? IP_PROTO_TCP : IP_PROTO_UDP;
+    p = put16(p, 0);
+    p = put_net(p, tx ? &wifi_ip : &sp->addr.ip, 4);
+    p = put_net(p, tx ? &sp->addr.ip : &wifi_ip, 4);
+    put16(&ip[10], ip_checksum(ip, PCAP_IP_HDR_LEN));
+
+    // UDP or TCP
+    p = put_net(p, tx ? &localport : &sp->addr.port, 2);
+    p = put_net(p, tx ? &sp->addr.port : &localport, 2);
+    if (tcp)
+    {
+        p = put32(p, tx ? pcap_tx_seq[sock] : pcap_rx_seq[sock]);
+        p = put32(p, tx ? pcap_rx_seq[sock] : pcap_tx_seq[sock]);
+        *p++ = (PCAP_TCP_HDR_LEN / 4) << 4;
+        *p++ = TCP_PSH_ACK;
+        p = put16(p, 0xffff);
+        p = put32(p, 0);
+        if (tx)
+            pcap_tx_seq[sock] += len;
+        else
+            pcap_rx_seq[sock] += len;
+    }
+    else
+    {
+        p = put16(p, (uint16_t)(PCAP_UDP_HDR_LEN + len));
+        p = put16(p, 0);
+    }
+
+    // Time, frame length, then frame in hex
+    printf("PK %lu %u ", (unsigned long)t, (unsigned)(p - hdr + len));
+    for (i = 0; i < p - hdr; i++)
+        printf("%02X", hdr[i]);
+    for (i = 0; i < len && i < PCAP_SNAPLEN; i++)
+        printf("%02X", ((uint8_t *)data)[i]);
+    printf("\n");
+}
+
+// EOF
@@ -0,0 +1,30 @@
+// ATWINC1500/1510 WiFi module packet capture output for the Pico 2W
+//
+// Socket data as synthetic Ethernet/IP frames, for conversion to pcap
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_PCAP_H
+#define WINC_PCAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "winc_config.h"
+
+#define PCAP_ETH_HDR_LEN    14
+#define PCAP_IP_HDR_LEN     20
+#define PCAP_UDP_HDR_LEN    8
+#define PCAP_TCP_HDR_LEN    20
+#define PCAP_MAX_HDR_LEN    (PCAP_ETH_HDR_LEN + PCAP_IP_HDR_LEN + PCAP_TCP_HDR_LEN)
+
+#if PCAP_ENABLE
+#define PCAP_SOCK(sock, tx, data, len)  pcap_sock(sock, tx, data, len)
+#else
+#define PCAP_SOCK(sock, tx, data, len)  ((void)0)
+#endif
+
+void pcap_sock(uint8_t sock, bool tx, void *data, int len);
+
+#endif // WINC_PCAP_H
+
+// EOF
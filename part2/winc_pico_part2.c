@@ -24,6 +24,11 @@
 #include "winc_wifi.h"
 #include "winc_sock.h"
 #include "winc_p2p.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
+#include "winc_capture.h"
+#include "winc_gw.h"
+#include "winc_buf.h"
 
 #define VERBOSE     1           // Diagnostic output level (0 to 3)
 #define SPI_SPEED   11000000    // SPI clock (actually 10.42 MHz)
@@ -35,6 +40,24 @@
 #define MESH_NODE_ID     1      // Unique ID for this mesh node (1-255)
 #define MESH_NODE_NAME   "PicoNode1"
 
+#if ENABLE_MESH_MODE && !MESH_ENABLE
+#error "Mesh mode needs the larger buffer pool: build with WINC_MESH on"
+#endif
+
+// Gateway: set to 1 on one mesh node to forward mesh traffic to a collector
+#define ENABLE_GATEWAY   0
+#define GW_COLLECTOR_IP  GW_IP(10,1,1,2)
+#define GW_COLLECTOR_PORT 1040
+
+// Interval for printing driver counters (ms), 0 to disable
+#define STATS_INTERVAL   30000
+
+// Dump trace when an interrupt takes longer than this (us), if TRACE_ENABLE
+#define TRACE_TRIGGER_US 20000
+
+// Dump SPI capture after this time (ms) or when full, if CAPTURE_ENABLE
+#define CAPTURE_TIME     60000
+
 #if !NEW_PROTO              // Old Pico prototype
 #define SCK_PIN     2
 #define MOSI_PIN    3
@@ -58,29 +81,44 @@
 
 extern int verbose;
 
+#if STATS_ENABLE && STATS_INTERVAL
+WINC_STATS stats_last, stats_now, stats_delta;
+#endif
+uint32_t spi_hz;                // Actual SPI clock
+
 // Return microsecond time
 uint32_t usec(void)
 {
     return(time_us_32());
 }
 
-// Do SPI transfer
+// Do SPI transfer; if no transmit data, send zeros, if no receive data, discard it
 int spi_xfer(int fd, uint8_t *txd, uint8_t *rxd, int len)
 {
+    STATS_INC(spi.xfers);
+    STATS_ADD(spi.bytes, len);
+    TRACE_BEGIN(TR_SPI_XFER, len);
     if (verbose > 2)
     {
         printf("  Tx:");
         for (int i=0; i<len; i++)
-            printf(" %02X", txd[i]);
+            printf(" %02X", txd ? txd[i] : 0);
     }
     gpio_put(CS_PIN, 0);
-    spi_write_read_blocking(SPI_PORT, txd, rxd, len);
+    if (!txd)
+        spi_read_blocking(SPI_PORT, 0, rxd, len);
+    else if (!rxd)
+        spi_write_blocking(SPI_PORT, txd, len);
+    else
+        spi_write_read_blocking(SPI_PORT, txd, rxd, len);
     while (gpio_get(SCK_PIN)) ;
     gpio_put(CS_PIN, 1);
+    TRACE_END(TR_SPI_XFER, len);
+    CAPTURE_XFER(txd, rxd, len);
     if (verbose > 2)
     {
         printf("\n  Rx:");
-        for (int i=0; i<len; i++)
+        for (int i=0; rxd && i<len; i++)
             printf(" %02X", rxd[i]);
         printf("\n");
     }
@@ -90,14 +128,25 @@ int spi_xfer(int fd, uint8_t *txd, uint8_t *rxd, int len)
 // Read IRQ line
 int read_irq(void)
 {
-    return(gpio_get(IRQ_PIN));
+    int level = gpio_get(IRQ_PIN);
+
+    CAPTURE_IRQ(IRQ_PIN, level);
+    return(level);
 }
 
+#if STATS_ENABLE
+// Record time of IRQ falling edge, for latency histograms
+void irq_edge(uint gpio, uint32_t events)
+{
+    stats_irq_edge = usec();
+}
+#endif
+
 // Initialise SPI interface
 void spi_setup(int fd)
 {
     stdio_init_all();
-    spi_init(SPI_PORT, SPI_SPEED);
+    spi_hz = spi_init(SPI_PORT, SPI_SPEED);
     spi_set_format(SPI_PORT, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
     gpio_init(MISO_PIN);
     gpio_set_function(MISO_PIN, GPIO_FUNC_SPI);
@@ -113,6 +162,9 @@ void spi_setup(int fd)
     gpio_init(IRQ_PIN);
     gpio_set_dir(IRQ_PIN, GPIO_IN);
     gpio_pull_up(IRQ_PIN);
+#if STATS_ENABLE
+    gpio_set_irq_enabled_with_callback(IRQ_PIN, GPIO_IRQ_EDGE_FALL, true, irq_edge);
+#endif
     gpio_init(RESET_PIN);
     gpio_set_dir(RESET_PIN, GPIO_OUT);
     gpio_put(RESET_PIN, 0);
@@ -123,12 +175,14 @@ void spi_setup(int fd)
 
 int main(int argc, char *argv[])
 {
-    int fd;
-    uint32_t val=0;
-    bool ok, irq=1;
+    int fd=0;
+    bool ok;
     int sock;
 
     verbose = VERBOSE;
+#if CAPTURE_ENABLE
+    capture_start();
+#endif
     spi_setup(fd);
     disable_crc(fd);
     ok = chip_init(fd);
@@ -158,6 +212,10 @@ int main(int argc, char *argv[])
                 printf("Mesh networking enabled\n");
             else
                 printf("Failed to enable mesh networking\n");
+
+            // Look for P2P peers, then again every P2P_SEARCH_INTERVAL
+            if (ok && !p2p_start_search(fd))
+                printf("Failed to start peer search\n");
         }
         else
         {
@@ -165,9 +223,17 @@ int main(int argc, char *argv[])
         }
 
         // Set up UDP socket for mesh communication
-        sock = open_sock_server(UDP_PORTNUM, 0, udp_echo_handler);
+        sock = mesh_open_sock(UDP_PORTNUM);
         printf("Mesh socket %u UDP port %u %s\n", sock, UDP_PORTNUM, sock>=0 ? "ok" : "failed");
 
+#if ENABLE_GATEWAY
+        // Forward mesh payloads addressed to this node upstream
+        mesh_set_handler(gw_mesh_handler);
+        ok = ok && gw_init(fd, PSK_SSID, PSK_PASSPHRASE, GW_COLLECTOR_IP, GW_COLLECTOR_PORT);
+        printf("Gateway to %u.%u.%u.%u:%u %s\n", IP_BYTES(GW_COLLECTOR_IP), GW_COLLECTOR_PORT,
+               ok ? "ok" : "failed");
+#endif
+
         // Also support TCP for mesh data
         sock = open_sock_server(TCP_PORTNUM, 1, tcp_echo_handler);
         printf("Mesh socket %u TCP port %u %s\n", sock, TCP_PORTNUM, sock>=0 ? "ok" : "failed");
@@ -189,7 +255,7 @@ int main(int argc, char *argv[])
         ok = join_net(fd, PSK_SSID, PSK_PASSPHRASE);
 
         printf("Connecting");
-        while (ok && (irq=read_irq()) && msdelay(100))
+        while (ok && read_irq() && msdelay(100))
         {
             putchar('.');
             fflush(stdout);
@@ -198,24 +264,72 @@ int main(int argc, char *argv[])
 #endif
 
         // Main loop
-        uint32_t last_print = 0;
+#if ENABLE_MESH_MODE
+        uint32_t last_print = 0, last_search = time_us_32() / 1000;
+#endif
+#if TRACE_ENABLE
+        trace_start(TRACE_TRIGGER_US);
+#endif
         while (ok)
         {
             if (read_irq() == 0)
                 interrupt_handler();
+#if TRACE_ENABLE
+            if (trace_triggered())
+            {
+                trace_dump();
+                trace_start(TRACE_TRIGGER_US);
+            }
+#endif
+#if CAPTURE_ENABLE
+            if (capture_running() && (capture_full() || time_us_32() / 1000 > CAPTURE_TIME))
+            {
+                capture_dump();
+                capture_stop();
+            }
+#endif
 
 #if ENABLE_MESH_MODE
             // Handle mesh beacon sending and routing table maintenance
             mesh_beacon_handler(fd);
+#if ENABLE_GATEWAY
+            gw_poll(fd);
+#endif
 
-            // Periodically print routing table (every 30 seconds)
+            // Periodically search for peers, while not joined upstream
             uint32_t now = time_us_32() / 1000;
+            if (now - last_search > P2P_SEARCH_INTERVAL && is_p2p_enabled())
+            {
+                p2p_start_search(fd);
+                last_search = now;
+            }
+
+            // Periodically print routing table (every 30 seconds)
             if (now - last_print > 30000)
             {
                 mesh_print_routing_table();
+                p2p_print_peers();
+#if ENABLE_GATEWAY
+                gw_print_status();
+#endif
                 last_print = now;
             }
 #endif
+
+#if STATS_ENABLE && STATS_INTERVAL
+            // Periodically print counters for the last interval
+            if (time_us_32() / 1000 - stats_last.time > STATS_INTERVAL)
+            {
+                stats_snapshot(&stats_now);
+                stats_diff(&stats_last, &stats_now, &stats_delta);
+                stats_print(&stats_delta);
+                stats_bus_print(&stats_delta, spi_hz);
+                hist_print();
+                buf_print();
+                hist_reset();
+                stats_last = stats_now;
+            }
+#endif
         }
     }
 	return(0);
@@ -20,12 +20,25 @@
 #include <stdbool.h>
 #include "winc_wifi.h"
 #include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
+#include "winc_pcap.h"
+#include "winc_buf.h"
 
 SOCKET sockets[MAX_SOCKETS];
 RESP_MSG resp_msg;
-uint8_t databuff[SPI_BUFFLEN];
+int wifi_state;             // Last connection state (1 if connected)
+uint32_t wifi_ip;           // Address from DHCP, 0 if none
+static RESP_HANDLER resp_handler;   // Responses for other modules
 extern int verbose, spi_fd;
 
+// Datagrams received by udp_batch_handler, in pool blocks, per UDP socket
+static UDP_MSG udp_batch[MAX_UDP_SOCK-MIN_UDP_SOCK][UDP_BATCH_LEN];
+static uint8_t udp_batch_head[MAX_UDP_SOCK-MIN_UDP_SOCK], udp_batch_count[MAX_UDP_SOCK-MIN_UDP_SOCK];
+static int udp_batch_bufs;      // Blocks queued or taken, and not yet freed
+static_assert(UDP_BATCH_BUFS > 0 && UDP_BATCH_BUFS <= BUF_COUNT - 2,
+              "UDP batch queues must leave pool blocks for receiving and sending");
+
 // Socket errors, corresponding to negative length values
 char *sock_errs[] = {"OK", "Invalid addr", "Addr already in use",
     "Too many TCP socks", "Too many UDP socks", "?", "Invalid arg",
@@ -68,8 +81,10 @@ void interrupt_handler(void)
     uint32_t val, size, addr=0;
     HIF_HDR hh;
     RESP_MSG *rmp=&resp_msg;
-    char temps[50]="";
+    char temps[64]="";
 
+    stats_irq_begin();
+    TRACE_BEGIN(TR_IRQ, 0);
     if (verbose > 1)
         printf("Interrupt\n");
     ok = spi_read_reg(fd, RCV_CTRL_REG0, &val) &&
@@ -80,6 +95,12 @@ void interrupt_handler(void)
     // Read HIF header
     ok = ok && hif_get(fd, addr, &hh, sizeof(hh));
     gop = GIDOP((uint16_t)hh.gid, hh.op);
+    if (ok)
+    {
+        STATS_HIST(HIST_IRQ_HDR, stats_irq_start);
+        STATS_INC(hif_rx);
+        STATS_HIF_RX(hh.gid, hh.op);
+    }
     hlen = MIN((hh.len - HIF_HDR_SIZE), sizeof(RESP_MSG));
 
     // Read response message
@@ -109,25 +130,47 @@ void interrupt_handler(void)
         if (rmp->recv.sock < MAX_SOCKETS)
             sockets[rmp->recv.sock].hif_data_addr = addr+HIF_HDR_SIZE+rmp->recv.oset;
     }
+    else if (gop==GOP_SCAN_RESULT && ok)
+        snprintf(temps, sizeof(temps), "%.32s chan %u RSSI %d", rmp->scan.ssid, rmp->scan.chan, rmp->scan.rssi);
     if (verbose)
     {
         printf("Interrupt gid %u op %u len %u %s %s\n",
                hh.gid, hh.op, hh.len, op_str(hh.gid, hh.op), temps);
     }
     check_sock(fd, gop, rmp);
+    if (ok && resp_handler)
+        resp_handler(fd, gop, rmp);
     ok = ok && hif_rx_done(fd);
+    TRACE_END(TR_IRQ, gop);
+    TRACE_CHECK(stats_irq_start);
+    stats_irq_end();
     if (verbose > 1)
         printf("Interrupt complete %s\n", ok ? "OK":"error");
 }
 
+// Set handler for module responses, NULL if none; it is called after the
+// socket layer has acted on each one
+void set_resp_handler(RESP_HANDLER handler)
+{
+    resp_handler = handler;
+}
+
 // Check for socket actions, given a received message
 void check_sock(int fd, uint16_t gop, RESP_MSG *rmp)
 {
     SOCKET *sp;
     uint8_t sock, sock2;
 
-    if (gop==GOP_DHCP_CONF)
+    TRACE_BEGIN(TR_CHECK_SOCK, gop);
+    if (gop==GOP_STATE_CHANGE)
+    {
+        wifi_state = rmp->val;
+        if (wifi_state != 1)
+            wifi_ip = 0;
+    }
+    else if (gop==GOP_DHCP_CONF)
     {
+        wifi_ip = rmp->dhcp.self;
         for (sock=MIN_SOCKET; sock<MAX_SOCKETS; sock++)
         {
             sp = &sockets[sock];
@@ -147,10 +190,12 @@ void check_sock(int fd, uint16_t gop, RESP_MSG *rmp)
     else if (gop==GOP_RECVFROM && (sock=rmp->recv.sock)<MAX_SOCKETS &&
              (sp=&sockets[sock])->state==STATE_BOUND)
     {
+        sock_rx_stats(sock, rmp->recv.dlen);
         memcpy(&sp->addr, &rmp->recv.addr, sizeof(SOCK_ADDR));
         if (sp->handler)
-            sp->handler(fd, sock, rmp->recv.dlen);
-        put_sock_recvfrom(fd, sock);
+            sock_call_handler(fd, sock, rmp->recv.dlen);
+        if (!sp->rx_paused)
+            put_sock_recvfrom(fd, sock);
     }
     else if (gop==GOP_ACCEPT &&
              (sock=rmp->accept.listen_sock)<MAX_SOCKETS &&
@@ -158,18 +203,61 @@ void check_sock(int fd, uint16_t gop, RESP_MSG *rmp)
              sockets[sock].state==STATE_BOUND)
     {
         memcpy(&sockets[sock2].addr, &rmp->recv.addr, sizeof(SOCK_ADDR));
+        sockets[sock2].localport = sockets[sock].localport;
         sockets[sock2].handler = sockets[sock].handler;
+        sockets[sock2].rx_paused = false;
         sock_state(sock2, STATE_CONNECTED);
         put_sock_recv(fd, sock2);
     }
     else if (gop==GOP_RECV && (sock=rmp->recv.sock)<MAX_SOCKETS &&
             (sp=&sockets[sock])->state==STATE_CONNECTED)
     {
+        sock_rx_stats(sock, rmp->recv.dlen);
         if (sp->handler)
-            sp->handler(fd, sock, rmp->recv.dlen);
-        if (rmp->recv.dlen > 0)
+            sock_call_handler(fd, sock, rmp->recv.dlen);
+        if (rmp->recv.dlen > 0 && !sp->rx_paused)
             put_sock_recv(fd, sock);
     }
+    else if ((gop==GOP_RECVFROM || gop==GOP_RECV) && (sock=rmp->recv.sock)<MAX_SOCKETS)
+        STATS_INC(sock[sock].drops);
+    TRACE_END(TR_CHECK_SOCK, gop);
+}
+
+// Call socket handler, timing the call
+void sock_call_handler(int fd, uint8_t sock, int rxlen)
+{
+    STATS_START(t);
+
+    STATS_HIST(HIST_IRQ_HANDLER, stats_irq_start);
+    TRACE_BEGIN(TR_HANDLER, sock);
+    sockets[sock].handler(fd, sock, rxlen);
+    TRACE_END(TR_HANDLER, sock);
+    STATS_HIST(HIST_HANDLER, t);
+}
+
+// Count received data, or error, for socket
+void sock_rx_stats(uint8_t sock, int dlen)
+{
+    if (dlen > 0)
+    {
+        STATS_INC(sock[sock].rx_pkts);
+        STATS_ADD(sock[sock].rx_bytes, dlen);
+    }
+    else if (dlen < 0)
+        STATS_INC(sock[sock].drops);
+}
+
+// Count transmitted data, or failure, for socket
+bool sock_tx_stats(uint8_t sock, int len, bool ok)
+{
+    if (ok)
+    {
+        STATS_INC(sock[sock].tx_pkts);
+        STATS_ADD(sock[sock].tx_bytes, len);
+    }
+    else
+        STATS_INC(sock[sock].drops);
+    return(ok);
 }
 
 // Change state of socket
@@ -179,6 +267,26 @@ void sock_state(uint8_t sock, int news)
         sockets[sock].state = news;
 }
 
+// Stop re-arming receive after the handler returns, while it holds data
+void sock_rx_pause(uint8_t sock)
+{
+    if (sock < MAX_SOCKETS)
+        sockets[sock].rx_paused = true;
+}
+
+// Re-arm receive on a paused socket, when the held data has been taken
+bool sock_rx_resume(int fd, uint8_t sock)
+{
+    SOCKET *sp;
+
+    if (sock >= MAX_SOCKETS || !(sp=&sockets[sock])->rx_paused)
+        return(false);
+    sp->rx_paused = false;
+    if (sock < MIN_UDP_SOCK)
+        return(sp->state==STATE_CONNECTED && put_sock_recv(fd, sock));
+    return(sp->state==STATE_BOUND && put_sock_recvfrom(fd, sock));
+}
+
 // Request to bind a socket
 bool put_sock_bind(int fd, uint8_t sock, uint16_t port)
 {
@@ -215,26 +323,41 @@ bool put_sock_recvfrom(int fd, uint8_t sock)
     return(hif_put(fd, GOP_RECVFROM, &rc, sizeof(rc), 0, 0, 0));
 }
 
-// Send TCP data using socket
-bool put_sock_send(int fd, uint8_t sock, void *data, int len)
+// Send TCP or UDP data; the command's address and session are copied from
+// the socket as they are, so only the length is filled in for each send
+static bool put_sock_data(int fd, uint8_t sock, uint16_t gop, int oset, void *data, int len)
 {
     SOCKET *sp=&sockets[sock];
-    SENDTO_CMD sc = {
-        .saddr = {sp->addr.family, sp->addr.port, sp->addr.ip},
-        .sock=sock, .len=len, .x=0, .session=sp->session, .x2=0};
+    SENDTO_CMD sc = {.sock=sock, .len=len, .saddr=sp->addr, .session=sp->session};
+    bool ok = hif_put(fd, gop|REQ_DATA, &sc, sizeof(sc), data, len, oset);
 
-    return(hif_put(fd, GOP_SEND|REQ_DATA, &sc, sizeof(sc), data, len, TCP_DATA_OSET));
+    if (ok)
+        PCAP_SOCK(sock, true, data, len);
+    return(sock_tx_stats(sock, len, ok));
+}
+
+// Send TCP or UDP data with a header and command already encoded, by the
+// C++ encoders in winc_wire.hpp
+bool put_sock_frame(int fd, uint8_t sock, uint16_t gop, uint8_t *frame, int flen,
+                    void *data, int len, int oset)
+{
+    bool ok = hif_put_frame(fd, gop|REQ_DATA, frame, flen, data, len, oset);
+
+    if (ok)
+        PCAP_SOCK(sock, true, data, len);
+    return(sock_tx_stats(sock, len, ok));
+}
+
+// Send TCP data using socket
+bool put_sock_send(int fd, uint8_t sock, void *data, int len)
+{
+    return(put_sock_data(fd, sock, GOP_SEND, TCP_DATA_OSET, data, len));
 }
 
 // Send UDP data using socket
 bool put_sock_sendto(int fd, uint8_t sock, void *data, int len)
 {
-    SOCKET *sp=&sockets[sock];
-    SENDTO_CMD sc = {
-        .saddr = {sp->addr.family, sp->addr.port, sp->addr.ip},
-        .sock=sock, .len=len, .x=0, .session=sp->session, .x2=0};
-
-    return(hif_put(fd, GOP_SENDTO|REQ_DATA, &sc, sizeof(sc), data, len, UDP_DATA_OSET));
+    return(put_sock_data(fd, sock, GOP_SENDTO, UDP_DATA_OSET, data, len));
 }
 
 // Close socket
@@ -242,7 +365,10 @@ bool put_sock_close(int fd, uint8_t sock)
 {
     CLOSE_CMD cc = {sock, 0, sockets[sock].session};
     bool ok = hif_put(fd, GOP_CLOSE, &cc, sizeof(cc), 0, 0, 0);
+    UDP_MSG msg;
 
+    while (get_sock_batch(sock, &msg, 1))
+        free_sock_batch(&msg, 1);
     memset(&sockets[sock], 0, sizeof(SOCKET));
     return(ok);
 }
@@ -255,35 +381,113 @@ bool get_sock_data(int fd, uint8_t sock, void *data, int len)
 
     if (len > 0)
         ok = hif_get(fd, sp->hif_data_addr, data, len);
+    if (ok)
+        PCAP_SOCK(sock, false, data, len);
     return(ok);
 }
 
 // Handler for TCP echo
 void tcp_echo_handler(int fd, uint8_t sock, int rxlen)
 {
+    uint8_t *buff = rxlen>0 && rxlen<=BUF_SIZE ? buf_alloc() : NULL;
+
     printf("TCP Rx socket %u len %d %s\n", sock, rxlen,
            rxlen<=0 ? sock_err_str(rxlen) : "");
     if (rxlen < 0)
         put_sock_close(fd, sock);
-    else if (rxlen>0 && get_sock_data(fd, sock, databuff, rxlen))
+    else if (buff && get_sock_data(fd, sock, buff, rxlen))
     {
         if (verbose > 1)
-            dump_hex(databuff, rxlen, 16, "  ");
-        put_sock_send(fd, sock, databuff, rxlen);
+            dump_hex(buff, rxlen, 16, "  ");
+        put_sock_send(fd, sock, buff, rxlen);
     }
+    buf_free(buff);
 }
 
 // Handler for UDP echo
 void udp_echo_handler(int fd, uint8_t sock, int rxlen)
 {
+    uint8_t *buff = rxlen>0 && rxlen<=BUF_SIZE ? buf_alloc() : NULL;
+
     printf("UDP Rx socket %u len %d %s\n", sock, rxlen,
            rxlen<=0 ? sock_err_str(rxlen) : "");
-    if (rxlen>0 && get_sock_data(fd, sock, databuff, rxlen))
+    if (buff && get_sock_data(fd, sock, buff, rxlen))
     {
         if (verbose > 1)
-            dump_hex(databuff, rxlen, 16, "  ");
-        put_sock_sendto(fd, sock, databuff, rxlen);
+            dump_hex(buff, rxlen, 16, "  ");
+        put_sock_sendto(fd, sock, buff, rxlen);
+    }
+    buf_free(buff);
+}
+
+// Handler queueing received datagrams, with their source addresses, for
+// get_sock_batch(); each is read into a pool block
+void udp_batch_handler(int fd, uint8_t sock, int rxlen)
+{
+    int q = sock - MIN_UDP_SOCK;
+    UDP_MSG *mp;
+
+    if (rxlen <= 0 || sock < MIN_UDP_SOCK || sock >= MAX_UDP_SOCK)
+        return;
+    mp = &udp_batch[q][(udp_batch_head[q] + udp_batch_count[q]) % UDP_BATCH_LEN];
+    if (udp_batch_count[q] >= UDP_BATCH_LEN || udp_batch_bufs >= UDP_BATCH_BUFS ||
+        rxlen > BUF_SIZE || !(mp->data = buf_alloc()))
+        STATS_INC(sock[sock].drops);
+    else if (get_sock_data(fd, sock, mp->data, rxlen))
+    {
+        mp->addr = sockets[sock].addr;
+        mp->len = rxlen;
+        udp_batch_count[q]++;
+        udp_batch_bufs++;
+    }
+    else
+        buf_free(mp->data);
+}
+
+// Take up to n queued datagrams, return the number taken; the caller
+// frees their data with free_sock_batch()
+int get_sock_batch(uint8_t sock, UDP_MSG *msgs, int n)
+{
+    int i, q = sock - MIN_UDP_SOCK;
+
+    if (sock < MIN_UDP_SOCK || sock >= MAX_UDP_SOCK)
+        return(0);
+    for (i = 0; i < n && udp_batch_count[q]; i++)
+    {
+        msgs[i] = udp_batch[q][udp_batch_head[q]];
+        udp_batch_head[q] = (udp_batch_head[q] + 1) % UDP_BATCH_LEN;
+        udp_batch_count[q]--;
+    }
+    return(i);
+}
+
+// Free data of datagrams taken by get_sock_batch()
+void free_sock_batch(UDP_MSG *msgs, int n)
+{
+    while (n-- > 0)
+    {
+        udp_batch_bufs -= msgs[n].data != NULL;
+        buf_free(msgs[n].data);
+        msgs[n].data = NULL;
+    }
+}
+
+// Send datagrams, each to its own address, return the number sent; the
+// socket's remote address is unchanged afterwards
+int put_sock_sendto_batch(int fd, uint8_t sock, UDP_MSG *msgs, int n)
+{
+    SOCKET *sp=&sockets[sock];
+    SOCK_ADDR addr = sp->addr;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        sp->addr = msgs[i].addr;
+        if (!put_sock_data(fd, sock, GOP_SENDTO, UDP_DATA_OSET, msgs[i].data, msgs[i].len))
+            break;
     }
+    sp->addr = addr;
+    return(i);
 }
 
 // EOF
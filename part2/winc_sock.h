@@ -19,6 +19,7 @@
 #define TCP_PORTNUM     1025
 #define UDP_SESSION     1
 #define TCP_SESSION     1
+// Socket numbers are allocated by the module firmware, so are not configurable
 #define MIN_SOCKET      0
 #define MIN_TCP_SOCK    0
 #define MAX_TCP_SOCK    7
@@ -80,8 +81,33 @@ typedef union {
     LISTEN_RESP_MSG listen;
     ACCEPT_RESP_MSG accept;
     RECV_RESP_MSG recv;
+    SCAN_DONE_MSG scan_done;
+    SCAN_RESULT_MSG scan;
 } RESP_MSG;
 
+WIRE_SIZE(DHCP_RESP_MSG, 20);
+WIRE_SIZE(BIND_RESP_MSG, 4);
+WIRE_SIZE(LISTEN_RESP_MSG, 4);
+WIRE_SIZE(ACCEPT_RESP_MSG, 12);
+WIRE_OSET(ACCEPT_RESP_MSG, listen_sock, 8);
+WIRE_OSET(ACCEPT_RESP_MSG, oset, 10);
+WIRE_SIZE(RECV_RESP_MSG, 16);
+WIRE_OSET(RECV_RESP_MSG, dlen, 8);
+WIRE_OSET(RECV_RESP_MSG, oset, 10);
+WIRE_OSET(RECV_RESP_MSG, sock, 12);
+WIRE_OSET(RECV_RESP_MSG, session, 14);
+
+// Send data must start after the command
+static_assert(UDP_DATA_OSET >= sizeof(SENDTO_CMD) && TCP_DATA_OSET >= sizeof(SENDTO_CMD),
+              "DATA_OSET");
+
+// Datagram for batch send and receive, with remote address in network order
+typedef struct {
+    SOCK_ADDR addr;
+    uint8_t *data;
+    int len;
+} UDP_MSG;
+
 // Storage for socket config
 typedef struct {
     SOCK_ADDR addr;
@@ -89,12 +115,23 @@ typedef struct {
     int state, conn_sock;
     uint32_t hif_data_addr;
     SOCK_HANDLER handler;
+    bool rx_paused;        // Handler is holding data, so receive isn't re-armed
 } SOCKET;
 
+// Handler of module responses for other modules, e.g. P2P scan results
+typedef void (* RESP_HANDLER)(int fd, uint16_t gop, RESP_MSG *rmp);
+
+extern int wifi_state;
+extern uint32_t wifi_ip;
+
 char *sock_err_str(int err);
 int open_sock_server(int portnum, bool tcp, SOCK_HANDLER handler);
 void interrupt_handler(void);
+void set_resp_handler(RESP_HANDLER handler);
 void sock_state(uint8_t sock, int news);
+void sock_call_handler(int fd, uint8_t sock, int rxlen);
+void sock_rx_stats(uint8_t sock, int dlen);
+bool sock_tx_stats(uint8_t sock, int len, bool ok);
 void check_sock(int fd, uint16_t gop, RESP_MSG *rmp);
 bool put_sock_bind(int fd, uint8_t sock, uint16_t port);
 bool put_sock_listen(int fd, uint8_t sock);
@@ -102,10 +139,18 @@ bool put_sock_recv(int fd, uint8_t sock);
 bool put_sock_recvfrom(int fd, uint8_t sock);
 bool put_sock_send(int fd, uint8_t sock, void *data, int len);
 bool put_sock_sendto(int fd, uint8_t sock, void *data, int len);
+bool put_sock_frame(int fd, uint8_t sock, uint16_t gop, uint8_t *frame, int flen,
+                    void *data, int len, int oset);
 bool put_sock_close(int fd, uint8_t sock);
+void sock_rx_pause(uint8_t sock);
+bool sock_rx_resume(int fd, uint8_t sock);
 bool get_sock_data(int fd, uint8_t sock, void *data, int len);
 void tcp_echo_handler(int fd, uint8_t sock, int rxlen);
 void udp_echo_handler(int fd, uint8_t sock, int rxlen);
+void udp_batch_handler(int fd, uint8_t sock, int rxlen);
+int get_sock_batch(uint8_t sock, UDP_MSG *msgs, int n);
+void free_sock_batch(UDP_MSG *msgs, int n);
+int put_sock_sendto_batch(int fd, uint8_t sock, UDP_MSG *msgs, int n);
 
 // EOF
 
@@ -0,0 +1,183 @@
+// ATWINC1500/1510 WiFi module C++ wrappers for the Pico 2W
+//
+// Header-only chip and socket classes for C++17 applications
+// Based on original work by Jeremy P Bentham
+//
+// The classes hold a socket number and the SPI file descriptor, and their
+// functions are inline calls of the C socket functions, so they compile to
+// the same code; sends are encoded inline by winc_wire.hpp. Sockets that own their socket number are move-only, and
+// close it when destroyed; handlers are given a non-owning Tcp or UdpSock
+// for the socket that has data. C handler functions are made from C++ ones
+// by a template, so there is no extra indirection:
+//
+//   static void echo(winc::TcpSock s, int rxlen) { ... }
+//   winc::TcpListener server(TCP_PORTNUM, winc::tcp_handler<echo>);
+//
+// host/winc_bench_cpp compares them with the C functions on the emulated chip.
+
+#ifndef WINC_SOCK_HPP
+#define WINC_SOCK_HPP
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+#include "winc_wire.hpp"
+
+namespace winc {
+
+// Contiguous bytes to send, or space to receive into (std::span is C++20)
+class Bytes {
+public:
+    constexpr Bytes(void *data, size_t size) : data_((uint8_t *)data), size_(size) {}
+    template <typename T, size_t N>
+    constexpr Bytes(T (&arr)[N]) : data_((uint8_t *)arr), size_(sizeof(arr)) {}
+    template <typename C, typename = std::enable_if_t<!std::is_same<C, Bytes>::value>,
+              typename = decltype(std::declval<C &>().data())>
+    constexpr Bytes(C &c) : data_((uint8_t *)c.data()), size_(c.size() * sizeof(*c.data())) {}
+    constexpr uint8_t *data() const { return data_; }
+    constexpr size_t size() const { return size_; }
+    constexpr Bytes first(size_t n) const { return Bytes(data_, n < size_ ? n : size_); }
+
+private:
+    uint8_t *data_;
+    size_t size_;
+};
+
+// Socket, not owning the socket number; Tcp selects send or sendto
+template <bool Tcp>
+class SockRef {
+public:
+    constexpr SockRef(int fd, uint8_t sock) : fd_(fd), sock_(sock) {}
+    constexpr int fd() const { return fd_; }
+    constexpr uint8_t sock() const { return sock_; }
+    int state() const { return sockets[sock_].state; }
+
+    // Send data, to the connection or last UDP sender
+    bool send(Bytes b) const { return wire::send<Tcp>(fd_, sock_, b.data(), (int)b.size()); }
+
+    // Read received data in a handler, up to the space given; 0 if failed
+    int recv(Bytes b, int rxlen) const {
+        int n = rxlen < (int)b.size() ? rxlen : (int)b.size();
+
+        return n > 0 && get_sock_data(fd_, sock_, b.data(), n) ? n : 0;
+    }
+
+    bool close() const { return put_sock_close(fd_, sock_); }
+
+protected:
+    int fd_;
+    uint8_t sock_;
+};
+
+typedef SockRef<true> TcpSock;
+typedef SockRef<false> UdpSock;
+
+// Socket owning its socket number, closed when destroyed; empty if default
+// constructed, or if no socket number was free
+template <bool Tcp>
+class Sock : public SockRef<Tcp> {
+public:
+    Sock() : SockRef<Tcp>(0, 0), open_(false) {}
+    Sock(const Sock &) = delete;
+    Sock &operator=(const Sock &) = delete;
+    Sock(Sock &&s) noexcept : SockRef<Tcp>(s.fd_, s.sock_), open_(s.open_) { s.open_ = false; }
+    Sock &operator=(Sock &&s) noexcept {
+        if (this != &s) {
+            reset();
+            this->fd_ = s.fd_;
+            this->sock_ = s.sock_;
+            open_ = s.open_;
+            s.open_ = false;
+        }
+        return *this;
+    }
+    ~Sock() { reset(); }
+
+    // True if a socket was allocated, and not closed or moved
+    explicit operator bool() const { return open_; }
+
+    // Close socket, if open
+    void reset() {
+        if (open_)
+            this->close();
+        open_ = false;
+    }
+
+    // Give up ownership, returning the socket number
+    uint8_t release() {
+        open_ = false;
+        return this->sock_;
+    }
+
+protected:
+    Sock(int fd, int sock) : SockRef<Tcp>(fd, (uint8_t)(sock < 0 ? 0 : sock)), open_(sock >= 0) {}
+
+private:
+    bool open_;
+};
+
+// TCP server socket; accepted connections are given the same handler
+class TcpListener : public Sock<true> {
+public:
+    TcpListener() {}
+    TcpListener(int port, SOCK_HANDLER handler, int fd = 0)
+        : Sock<true>(fd, open_sock_server(port, true, handler)) {}
+};
+
+// Accepted TCP connection, taken over from a handler
+class TcpConnection : public Sock<true> {
+public:
+    TcpConnection() {}
+    explicit TcpConnection(TcpSock s) : Sock<true>(s.fd(), s.sock()) {}
+};
+
+// UDP server socket
+class UdpSocket : public Sock<false> {
+public:
+    UdpSocket() {}
+    UdpSocket(int port, SOCK_HANDLER handler, int fd = 0)
+        : Sock<false>(fd, open_sock_server(port, false, handler)) {}
+};
+
+// C socket handlers calling C++ ones, with the socket as an object
+template <void (*F)(TcpSock, int)>
+void tcp_handler(int fd, uint8_t sock, int rxlen) { F(TcpSock(fd, sock), rxlen); }
+template <void (*F)(UdpSock, int)>
+void udp_handler(int fd, uint8_t sock, int rxlen) { F(UdpSock(fd, sock), rxlen); }
+
+// Module, on an SPI interface set up by the platform code
+class Chip {
+public:
+    explicit constexpr Chip(int fd = 0) : fd_(fd) {}
+    Chip(const Chip &) = delete;
+    Chip &operator=(const Chip &) = delete;
+    constexpr int fd() const { return fd_; }
+
+    // Initialise module, return chip ID, 0 if failed
+    uint32_t init() {
+        disable_crc(fd_);
+        return chip_init(fd_) ? chip_get_id(fd_) : 0;
+    }
+
+    bool join(char *ssid, char *pass) { return join_net(fd_, ssid, pass); }
+
+    // Handle module interrupt if the IRQ line is low, return true if it was
+    bool poll() {
+        if (read_irq() != 0)
+            return false;
+        interrupt_handler();
+        return true;
+    }
+
+private:
+    int fd_;
+};
+
+} // namespace winc
+
+#endif // WINC_SOCK_HPP
+
+// EOF
@@ -0,0 +1,219 @@
+// ATWINC1500/1510 WiFi module performance counters for the Pico 2W
+//
+// Cheap always-on counters for each layer: SPI, HIF, sockets and mesh
+// Based on original work by Jeremy P Bentham
+//
+// The counters are incremented in place by the driver; the application takes
+// snapshots, and can print the difference between two of them to see what an
+// operation (e.g. one echo round trip) cost.
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "winc_wifi.h"
+#include "winc_sock.h"
+#include "winc_stats.h"
+
+static_assert(STATS_SOCKETS == MAX_SOCKETS, "STATS_SOCKETS");
+
+WINC_STATS winc_stats;
+STATS_HIST stats_hists[HIST_STAGES];
+
+// Time of IRQ falling edge, if the application has a GPIO interrupt for it,
+// and start time of the message being handled
+volatile uint32_t stats_irq_edge;
+uint32_t stats_irq_start;
+
+char *hist_names[HIST_STAGES] = {
+    "IRQ to header", "IRQ to handler", "Handler", "IRQ to reply",
+    "IRQ to done", "HIF accept", "HIF send", "Sync error", "Hop latency"};
+
+// Clear all counters
+void stats_reset(void)
+{
+    memset(&winc_stats, 0, sizeof(winc_stats));
+    hist_reset();
+}
+
+// Copy the counters, with the current time
+void stats_snapshot(WINC_STATS *sp)
+{
+    memcpy(sp, &winc_stats, sizeof(WINC_STATS));
+    sp->time = time_us_32() / 1000;
+}
+
+// Get the change in counters between two snapshots; wraparound is allowed
+void stats_diff(WINC_STATS *older, WINC_STATS *newer, WINC_STATS *diff)
+{
+    uint32_t *a32 = (uint32_t *)older, *b32 = (uint32_t *)newer, *d32 = (uint32_t *)diff;
+    uint16_t *a16 = (uint16_t *)older->hif_tx_ops, *b16 = (uint16_t *)newer->hif_tx_ops;
+    uint16_t *d16 = (uint16_t *)diff->hif_tx_ops;
+    int i;
+
+    for (i = 0; i < offsetof(WINC_STATS, hif_tx_ops) / sizeof(uint32_t); i++)
+        d32[i] = b32[i] - a32[i];
+    for (i = 0; i < 2 * STATS_HIF_GIDS * STATS_HIF_OPS; i++)
+        d16[i] = b16[i] - a16[i];
+}
+
+// Print non-zero counters
+void stats_print(WINC_STATS *sp)
+{
+    SPI_STATS *ssp = &sp->spi;
+    MESH_STATS *msp = &sp->mesh;
+    int gid, op, sock;
+
+    printf("\n=== WINC1500 Stats (%lu ms) ===\n", (unsigned long)sp->time);
+    printf("SPI:  %lu xfers, %lu bytes, %lu read polls, %lu write polls, "
+           "%lu HIF waits, %lu errors\n",
+           (unsigned long)ssp->xfers, (unsigned long)ssp->bytes,
+           (unsigned long)ssp->read_polls, (unsigned long)ssp->write_polls,
+           (unsigned long)ssp->hif_waits, (unsigned long)ssp->errors);
+    printf("HIF:  %lu sent, %lu received, %lu errors\n", (unsigned long)sp->hif_tx,
+           (unsigned long)sp->hif_rx, (unsigned long)sp->hif_errors);
+    for (gid = 0; gid < STATS_HIF_GIDS; gid++)
+    {
+        for (op = 0; op < STATS_HIF_OPS; op++)
+        {
+            if (sp->hif_tx_ops[gid][op] || sp->hif_rx_ops[gid][op])
+                printf("  gid %u op %3u  tx %5u  rx %5u  %s\n", gid, op,
+                       sp->hif_tx_ops[gid][op], sp->hif_rx_ops[gid][op], op_str(gid, op));
+        }
+    }
+    for (sock = 0; sock < MAX_SOCKETS; sock++)
+    {
+        SOCK_STATS *p = &sp->sock[sock];
+
+        if (p->tx_pkts || p->rx_pkts || p->drops)
+            printf("Sock %u: tx %lu pkts %lu bytes, rx %lu pkts %lu bytes, %lu drops\n", sock,
+                   (unsigned long)p->tx_pkts, (unsigned long)p->tx_bytes,
+                   (unsigned long)p->rx_pkts, (unsigned long)p->rx_bytes,
+                   (unsigned long)p->drops);
+    }
+    if (msp->tx_pkts || msp->rx_pkts)
+        printf("Mesh: tx %lu pkts %lu bytes, rx %lu pkts %lu bytes, delivered %lu, "
+               "forwarded %lu, dropped %lu, duplicates %lu, CE marked %lu\n",
+               (unsigned long)msp->tx_pkts, (unsigned long)msp->tx_bytes,
+               (unsigned long)msp->rx_pkts, (unsigned long)msp->rx_bytes,
+               (unsigned long)msp->delivered, (unsigned long)msp->forwarded,
+               (unsigned long)msp->dropped, (unsigned long)msp->duplicates,
+               (unsigned long)msp->ce_marked);
+    if (msp->sync_samples || msp->sync_resets)
+        printf("Sync: %lu beacons used, %lu root or parent losses\n",
+               (unsigned long)msp->sync_samples, (unsigned long)msp->sync_resets);
+    if (sp->buf.allocs || sp->buf.fails)
+        printf("Buf:  %lu allocs, %lu failed, %lu packets queued in place\n",
+               (unsigned long)sp->buf.allocs, (unsigned long)sp->buf.fails,
+               (unsigned long)sp->buf.shared);
+}
+
+// Print part of interval as a percentage, with one decimal place
+static void print_share(char *name, uint64_t us, uint64_t total)
+{
+    uint32_t pm = total ? (uint32_t)(us * 1000 / total) : 0;
+
+    printf(" %s %lu.%lu%%", name, (unsigned long)(pm / 10), (unsigned long)(pm % 10));
+}
+
+// Print SPI bus time by use, and payload bandwidth as a fraction of the clock
+// Commands include the zero tails and response headers of register and data
+// commands; HIF is data blocks other than socket payload, i.e. message
+// headers and bodies. Other is bytes sent outside the driver's functions
+void stats_bus_print(WINC_STATS *sp, uint32_t spi_hz)
+{
+    SPI_STATS *ssp = &sp->spi;
+    uint64_t payload = 0, hif, other, busy, interval = (uint64_t)sp->time * 1000;
+    uint32_t per_byte;
+    int sock;
+
+    if (!spi_hz)
+        return;
+    for (sock = 0; sock < MAX_SOCKETS; sock++)
+        payload += sp->sock[sock].tx_bytes + sp->sock[sock].rx_bytes;
+    payload = MIN(payload, ssp->data_bytes);
+    hif = ssp->data_bytes - payload;
+    other = ssp->bytes - MIN(ssp->bytes, ssp->cmd_bytes + ssp->poll_bytes + ssp->data_bytes);
+    busy = BUS_US(ssp->bytes, spi_hz);
+    interval = interval > busy ? interval : busy;
+    printf("Bus:  SPI %lu Hz, time:", (unsigned long)spi_hz);
+    print_share("command", BUS_US(ssp->cmd_bytes, spi_hz), interval);
+    print_share("poll", BUS_US(ssp->poll_bytes, spi_hz), interval);
+    print_share("HIF", BUS_US(hif, spi_hz), interval);
+    print_share("payload", BUS_US(payload, spi_hz), interval);
+    if (other)
+        print_share("other", BUS_US(other, spi_hz), interval);
+    print_share("idle", interval - busy, interval);
+    per_byte = payload ? (uint32_t)((uint64_t)ssp->bytes * 100 / payload) : 0;
+    printf("\n      payload %lu bytes, %lu kbit/s,", (unsigned long)payload,
+           (unsigned long)(interval ? payload * 8000 / interval : 0));
+    print_share("of SPI clock", BUS_US(payload, spi_hz), interval);
+    printf(", %lu.%02lu bus bytes per payload byte\n",
+           (unsigned long)(per_byte / 100), (unsigned long)(per_byte % 100));
+}
+
+#if STATS_ENABLE || TRACE_ENABLE
+// Start timing an interrupt, from the IRQ edge if known, else now
+void stats_irq_begin(void)
+{
+    uint32_t edge = stats_irq_edge;
+
+    stats_irq_edge = 0;
+    stats_irq_start = edge ? edge : usec();
+}
+
+// End of interrupt, so sends are no longer replies
+void stats_irq_end(void)
+{
+    STATS_HIST(HIST_IRQ_DONE, stats_irq_start);
+    stats_irq_start = 0;
+}
+#endif
+
+// Get value at percentile, as the highest value in its bucket
+uint32_t hist_value(STATS_HIST *hp, int pct)
+{
+    uint32_t target = (uint32_t)(((uint64_t)hp->count * pct + 99) / 100), total = 0;
+    uint32_t val;
+    int n, msb;
+
+    for (n = 0; n < HIST_BUCKETS && target; n++)
+    {
+        if ((total += hp->buckets[n]) >= target)
+        {
+            if (n < HIST_SUB_BUCKETS)
+                return(n);
+            msb = (n >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+            val = ((uint32_t)(HIST_SUB_BUCKETS + (n & (HIST_SUB_BUCKETS - 1)))
+                  << (msb - HIST_SUB_BITS)) + (1u << (msb - HIST_SUB_BITS)) - 1;
+            return(MIN(val, hp->max));
+        }
+    }
+    return(0);
+}
+
+// Clear histograms
+void hist_reset(void)
+{
+    memset(stats_hists, 0, sizeof(stats_hists));
+}
+
+// Print non-empty histograms
+void hist_print(void)
+{
+    STATS_HIST *hp;
+    int n;
+
+    for (n = 0; n < HIST_STAGES; n++)
+    {
+        hp = &stats_hists[n];
+        if (hp->count)
+            printf("%-15s %7lu  p50 %6lu  p99 %6lu  max %6lu us\n", hist_names[n],
+                   (unsigned long)hp->count, (unsigned long)hist_value(hp, 50),
+                   (unsigned long)hist_value(hp, 99), (unsigned long)hp->max);
+    }
+}
+
+// EOF
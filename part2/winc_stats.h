@@ -0,0 +1,163 @@
+// ATWINC1500/1510 WiFi module performance counters for the Pico 2W
+//
+// Cheap always-on counters for each layer: SPI, HIF, sockets and mesh
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_STATS_H
+#define WINC_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "winc_config.h"
+
+// HIF messages are counted per group ID and opcode
+#define STATS_HIF_GIDS      4
+#define STATS_HIF_OPS       128
+
+// Sockets counted, the same as MAX_SOCKETS, so this header doesn't need the
+// socket definitions
+#define STATS_SOCKETS       10
+
+// SPI transfers, from the platform spi_xfer() and driver
+typedef struct {
+    uint32_t xfers, bytes;     // spi_xfer calls and bytes transferred
+    uint32_t read_polls;       // Extra polls waiting for read data
+    uint32_t write_polls;      // Extra polls waiting for write ack
+    uint32_t hif_waits;        // Polls waiting for chip to accept HIF message
+    uint32_t errors;           // Register or data transactions that failed
+    uint32_t cmd_bytes;        // Commands, register values, response headers
+    uint32_t poll_bytes;       // Single-byte polls for read data and write ack
+    uint32_t data_bytes;       // Data blocks: HIF messages and socket payload
+} SPI_STATS;
+
+// Per-socket traffic
+typedef struct {
+    uint32_t tx_pkts, tx_bytes;
+    uint32_t rx_pkts, rx_bytes;
+    uint32_t drops;            // Send failures, receive errors, unexpected data
+} SOCK_STATS;
+
+// Mesh traffic
+typedef struct {
+    uint32_t tx_pkts, tx_bytes;    // Datagrams sent on mesh socket
+    uint32_t rx_pkts, rx_bytes;    // Datagrams received from other nodes
+    uint32_t delivered;            // Payloads passed to handler
+    uint32_t forwarded;            // Packets relayed for other nodes
+    uint32_t dropped;              // No route, hop limit, queue full
+    uint32_t duplicates;           // Broadcasts already seen
+    uint32_t ce_marked;            // Packets marked as congested
+    uint32_t sync_samples;         // Parent beacons used for time sync
+    uint32_t sync_resets;          // Time root or parent lost
+} MESH_STATS;
+
+// Buffer pool
+typedef struct {
+    uint32_t allocs;               // Blocks taken from the pool
+    uint32_t fails;                // Allocations with no block free
+    uint32_t shared;               // Packets queued in place, not copied
+} BUF_STATS;
+
+// All counters; 32-bit counters first, then the 16-bit HIF opcode counts
+typedef struct {
+    uint32_t time;                 // Time of snapshot, or interval (ms)
+    SPI_STATS spi;
+    uint32_t hif_tx, hif_rx;       // HIF messages sent and received
+    uint32_t hif_errors;           // HIF messages not sent
+    SOCK_STATS sock[STATS_SOCKETS];
+    MESH_STATS mesh;
+    BUF_STATS buf;
+    uint16_t hif_tx_ops[STATS_HIF_GIDS][STATS_HIF_OPS];
+    uint16_t hif_rx_ops[STATS_HIF_GIDS][STATS_HIF_OPS];
+} WINC_STATS;
+
+// Latency histograms (us), with log buckets as in HdrHistogram: 4 buckets
+// per power of 2, so values are recorded to within 25%, up to 2^32 us
+#define HIST_SUB_BITS       2
+#define HIST_SUB_BUCKETS    (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        ((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+    uint32_t count, max;
+    uint32_t buckets[HIST_BUCKETS];
+} STATS_HIST;
+
+// Stages of the critical path that are timed, then mesh times recorded as values
+#define HIST_IRQ_HDR        0   // IRQ to HIF header read
+#define HIST_IRQ_HANDLER    1   // IRQ to socket handler call
+#define HIST_HANDLER        2   // Socket handler run time
+#define HIST_IRQ_REPLY      3   // IRQ to data sent by handler
+#define HIST_IRQ_DONE       4   // IRQ to end of interrupt handler
+#define HIST_HIF_ACK        5   // HIF send start to chip accepting message
+#define HIST_HIF_PUT        6   // HIF send start to transfer complete
+#define HIST_SYNC_ERROR     7   // Mesh time sync prediction error
+#define HIST_HOP_LATENCY    8   // One-way latency from a mesh neighbor
+#define HIST_STAGES         9
+
+extern WINC_STATS winc_stats;
+extern STATS_HIST stats_hists[HIST_STAGES];
+extern volatile uint32_t stats_irq_edge;
+extern uint32_t stats_irq_start;
+
+// Get bucket for value
+static inline int hist_bucket(uint32_t val)
+{
+    int msb;
+
+    if (val < HIST_SUB_BUCKETS)
+        return(val);
+    msb = 31 - __builtin_clz(val);
+    return(((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           ((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1)));
+}
+
+// Add value to histogram
+static inline void hist_record(STATS_HIST *hp, uint32_t val)
+{
+    hp->buckets[hist_bucket(val)]++;
+    hp->count++;
+    if (val > hp->max)
+        hp->max = val;
+}
+
+#if STATS_ENABLE
+#define STATS_INC(f)        (winc_stats.f++)
+#define STATS_ADD(f, n)     (winc_stats.f += (n))
+#define STATS_START(t)      uint32_t t = usec()
+#define STATS_HIST(n, t)    hist_record(&stats_hists[n], usec() - (t))
+#define STATS_VALUE(n, v)   hist_record(&stats_hists[n], v)
+#else
+#define STATS_INC(f)        ((void)0)
+#define STATS_ADD(f, n)     ((void)0)
+#define STATS_START(t)      ((void)0)
+#define STATS_HIST(n, t)    ((void)0)
+#define STATS_VALUE(n, v)   ((void)0)
+#endif
+
+// Interrupt start time, for the histograms and the trace trigger
+#if STATS_ENABLE || TRACE_ENABLE
+void stats_irq_begin(void);
+void stats_irq_end(void);
+#else
+#define stats_irq_begin()   ((void)0)
+#define stats_irq_end()     ((void)0)
+#endif
+
+// Time in us to clock bytes over the SPI bus
+#define BUS_US(n, hz)       ((uint64_t)(n) * 8000000 / (hz))
+
+#define STATS_HIF_TX(gid, op) STATS_INC(hif_tx_ops[(gid) % STATS_HIF_GIDS][(op) % STATS_HIF_OPS])
+#define STATS_HIF_RX(gid, op) STATS_INC(hif_rx_ops[(gid) % STATS_HIF_GIDS][(op) % STATS_HIF_OPS])
+
+void stats_reset(void);
+void stats_snapshot(WINC_STATS *sp);
+void stats_diff(WINC_STATS *older, WINC_STATS *newer, WINC_STATS *diff);
+void stats_print(WINC_STATS *sp);
+void stats_bus_print(WINC_STATS *sp, uint32_t spi_hz);
+uint32_t hist_value(STATS_HIST *hp, int pct);
+void hist_reset(void);
+void hist_print(void);
+
+#endif // WINC_STATS_H
+
+// EOF
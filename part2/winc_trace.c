@@ -0,0 +1,90 @@
+// ATWINC1500/1510 WiFi module event tracer for the Pico 2W
+//
+// Records begin/end events in a ring buffer, for conversion to a timeline
+// Based on original work by Jeremy P Bentham
+//
+// The buffer keeps the latest TRACE_SIZE events. Tracing can be stopped
+// automatically when an interrupt takes longer than a trigger time, so the
+// buffer holds the events leading up to the stall; it is then dumped as text
+// over the UART, and trace2json.py converts it to Chrome trace JSON for
+// viewing in Perfetto or chrome://tracing.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_trace.h"
+
+TRACE_EVENT trace_events[TRACE_SIZE];
+uint32_t trace_count;
+bool trace_on;
+
+static uint32_t trace_trigger_us;
+static bool trace_trig;
+static char *trace_names[TR_MAX_ID] = {
+    "spi_xfer", "spi_poll", "hif_start", "hif_put",
+    "interrupt_handler", "check_sock", "handler", "mesh_sync"};
+
+// Clear buffer and start tracing; stop if an interrupt exceeds trigger time
+void trace_start(uint32_t trigger_us)
+{
+    trace_count = 0;
+    trace_trig = false;
+    trace_trigger_us = trigger_us;
+    trace_on = true;
+}
+
+// Stop tracing
+void trace_stop(void)
+{
+    trace_on = false;
+}
+
+// Check if tracing has been stopped by the trigger
+bool trace_triggered(void)
+{
+    return(trace_trig);
+}
+
+// Check duration since start time against trigger, stop tracing if exceeded
+void trace_check(uint32_t start)
+{
+    if (trace_on && trace_trigger_us && usec() - start > trace_trigger_us)
+    {
+        trace_on = false;
+        trace_trig = true;
+    }
+}
+
+// Set name of a trace point, for the dump
+void trace_name(int id, char *name)
+{
+    if (id < TR_MAX_ID)
+        trace_names[id] = name;
+}
+
+// Print names and events, oldest first
+void trace_dump(void)
+{
+    bool on = trace_on;
+    uint32_t n, start = trace_count > TRACE_SIZE ? trace_count - TRACE_SIZE : 0;
+    TRACE_EVENT *tp;
+    int id;
+
+    trace_on = false;
+    printf("TRACE_START %lu\n", (unsigned long)(trace_count - start));
+    for (id = 0; id < TR_MAX_ID; id++)
+    {
+        if (trace_names[id])
+            printf("TN %d %s\n", id, trace_names[id]);
+    }
+    for (n = start; n < trace_count; n++)
+    {
+        tp = &trace_events[n & (TRACE_SIZE - 1)];
+        printf("TE %lu %c %u %u\n", (unsigned long)tp->time, tp->phase, tp->id, tp->arg);
+    }
+    printf("TRACE_END\n");
+    trace_on = on;
+}
+
+// EOF
@@ -0,0 +1,79 @@
+// ATWINC1500/1510 WiFi module event tracer for the Pico 2W
+//
+// Records begin/end events in a ring buffer, for conversion to a timeline
+// Based on original work by Jeremy P Bentham
+
+#ifndef WINC_TRACE_H
+#define WINC_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "winc_config.h"
+
+// Trace points; application handlers can use TR_USER upwards
+#define TR_SPI_XFER         0   // spi_xfer, arg is length
+#define TR_SPI_POLL         1   // Polling for read data or write ack
+#define TR_HIF_START        2   // hif_start, arg is opcode, then tries left
+#define TR_HIF_PUT          3   // hif_put, arg is group ID and opcode
+#define TR_IRQ              4   // interrupt_handler, arg is group ID and opcode
+#define TR_CHECK_SOCK       5   // check_sock, arg is group ID and opcode
+#define TR_HANDLER          6   // Socket handler, arg is socket number
+#define TR_MESH_SYNC        7   // Mesh time sync beacon, arg is prediction error (us)
+#define TR_USER             8
+#define TR_MAX_ID           16
+
+// Event phases, as in Chrome trace format
+#define TR_BEGIN            'B'
+#define TR_END              'E'
+#define TR_INSTANT          'i'
+
+typedef struct {
+    uint32_t time;          // Microseconds
+    uint8_t id, phase;
+    uint16_t arg;
+} TRACE_EVENT;
+
+extern TRACE_EVENT trace_events[TRACE_SIZE];
+extern uint32_t trace_count;
+extern bool trace_on;
+
+uint32_t usec(void);
+
+// Add event to ring buffer
+static inline void trace_event(int id, int phase, int arg)
+{
+    TRACE_EVENT *tp;
+
+    if (trace_on)
+    {
+        tp = &trace_events[trace_count++ & (TRACE_SIZE - 1)];
+        tp->time = usec();
+        tp->id = (uint8_t)id;
+        tp->phase = (uint8_t)phase;
+        tp->arg = (uint16_t)arg;
+    }
+}
+
+#if TRACE_ENABLE
+#define TRACE_BEGIN(id, arg)    trace_event(id, TR_BEGIN, arg)
+#define TRACE_END(id, arg)      trace_event(id, TR_END, arg)
+#define TRACE_INSTANT(id, arg)  trace_event(id, TR_INSTANT, arg)
+#define TRACE_CHECK(t)          trace_check(t)
+#else
+#define TRACE_BEGIN(id, arg)    ((void)0)
+#define TRACE_END(id, arg)      ((void)0)
+#define TRACE_INSTANT(id, arg)  ((void)0)
+#define TRACE_CHECK(t)          ((void)0)
+#endif
+
+void trace_start(uint32_t trigger_us);
+void trace_stop(void);
+bool trace_triggered(void);
+void trace_check(uint32_t start);
+void trace_name(int id, char *name);
+void trace_dump(void);
+
+#endif // WINC_TRACE_H
+
+// EOF
@@ -22,18 +22,22 @@
 #include <stdbool.h>
 #include "winc_wifi.h"
 #include "winc_sock.h"
+#include "winc_stats.h"
+#include "winc_trace.h"
 
-#define NEW_JOIN            0
 #define U16_DATA(d, n, val) {d[n]=val>>8; d[n+1]=val;}
 #define U24_DATA(d, n, val) {d[n]=val>>16; d[n+1]=val>>8; d[n+2]=val;}
 #define U32_DATA(d, n, val) {d[n]=val>>24; d[n+1]=val>>16; d[n+2]=val>>8; d[n+3]=val;}
 #define DATA_U32(d)         ((d[0]<<24) | (d[1]<<16) | (d[2]<<8) | d[3])
 #define RSP_U32(d, n)       (d[n] | (uint32_t)(d[n+1])<<8 | (uint32_t)(d[n+2])<<16 | (uint32_t)(d[n+3])<<24)
 
-uint8_t txbuff[SPI_BUFFLEN], rxbuff[SPI_BUFFLEN];
 int verbose, spi_fd;
-uint8_t tx_zeros[1024];
 bool use_crc=1;
+
+// Data write staging: start token and data go in one transfer. This is not
+// taken from the buffer pool, so writes (e.g. to re-arm a socket receive)
+// never fail because queued packets are holding all the blocks
+static uint8_t spi_wbuff[SPI_BUFFLEN+1] __attribute__((aligned(4)));
 extern uint32_t spi_speed;
 
 #define CLOCKLESS_ADDR      (1 << 15)
@@ -80,7 +84,8 @@ typedef struct {
 OP_STR wifi_gop_resps[] = {{GOP_CONN_REQ_OLD, "Conn req"}, {GOP_STATE_CHANGE, "State change"},
     {GOP_DHCP_CONF, "DHCP conf"}, {GOP_CONN_REQ_NEW, "Conn_req"}, {GOP_BIND, "Bind"},
     {GOP_LISTEN, "Listen"}, {GOP_ACCEPT, "Accept"}, {GOP_SEND, "Send"}, {GOP_RECV, "Recv"},
-    {GOP_SENDTO, "SendTo"}, {GOP_RECVFROM, "RecvFrom"}, {GOP_CLOSE, "Close"}, {0,""}};
+    {GOP_SENDTO, "SendTo"}, {GOP_RECVFROM, "RecvFrom"}, {GOP_CLOSE, "Close"},
+    {GOP_SCAN_DONE, "Scan done"}, {GOP_SCAN_RESULT, "Scan result"}, {0,""}};
 
 uint8_t remove_crc[11] = {0xC9, 0, 0xE8, 0x24, 0,  0,  0, 0x52, 0x5C, 0, 0};
 
@@ -164,7 +169,8 @@ uint16_t swap16(uint16_t val)
 // Disable SPI CRCs
 void disable_crc(int fd)
 {
-    spi_xfer(fd, remove_crc, rxbuff, sizeof(remove_crc));
+    spi_xfer(fd, remove_crc, NULL, sizeof(remove_crc));
+    STATS_ADD(spi.cmd_bytes, sizeof(remove_crc));
     use_crc = 0;
 }
 
@@ -177,62 +183,79 @@ int spi_cmd_resp(int fd, uint8_t *txd, uint8_t *rxd, int txlen, int rxlen)
 // Read register
 int spi_read_reg(int fd, uint32_t addr, uint32_t *valp)
 {
-    CMD_MSG_A *mp=(CMD_MSG_A *)txbuff;
+    CMD_MSG_A msg, *mp=&msg;
     int n, a, rxlen=sizeof(mp->zeros), txlen=sizeof(*mp)-rxlen;
-    uint8_t *rsp = &rxbuff[txlen];
+    uint8_t rxd[sizeof(CMD_MSG_A)], *rsp = &rxd[txlen];
 
     mp->cmd = addr <= 0x30 ? CMD_INTERNAL_READ : CMD_SINGLE_READ;
     a = addr <= 0x30 ? (addr | CLOCKLESS_ADDR) << 8 : addr;
     U24_DATA(mp->addr, 0, a);
     memset(mp->zeros, 0, sizeof(mp->zeros));
-    n = spi_cmd_resp(fd, txbuff, rxbuff, txlen, rxlen);
+    n = spi_cmd_resp(fd, (uint8_t *)mp, rxd, txlen, rxlen);
+    STATS_ADD(spi.cmd_bytes, txlen + rxlen);
     if (n && rsp[0]==mp->cmd && rsp[1]==0 && (rsp[2] & 0xf0)==0xf0)
     {
         *valp = RSP_U32(rsp, 3);
         if (verbose > 1)
             printf("Rd reg %04x: %08x\n", addr, *valp);
     }
+    else
+        STATS_INC(spi.errors);
     return(rxlen);
 }
 
 // Read single data block
 int spi_read_data(int fd, uint32_t addr, uint8_t *data, int dlen)
 {
-    CMD_MSG_B *mp=(CMD_MSG_B *)txbuff;
+    CMD_MSG_B msg, *mp=&msg;
     int n, tries, txlen=sizeof(*mp);
     uint8_t b;
 
     mp->cmd = CMD_READ_DATA;
     U24_DATA(mp->addr, 0, addr);
     U24_DATA(mp->count, 0, dlen);
-    n = spi_cmd_resp(fd, (uint8_t *)mp, rxbuff, txlen, 0);
+    n = spi_cmd_resp(fd, (uint8_t *)mp, NULL, txlen, 0);
+    STATS_ADD(spi.cmd_bytes, txlen);
     b = 0;
     tries = 10;
+    TRACE_BEGIN(TR_SPI_POLL, 0);
     while (n && !b && tries--)
-        n = spi_xfer(fd, tx_zeros, &b, 1);
+    {
+        n = spi_xfer(fd, NULL, &b, 1);
+        STATS_INC(spi.poll_bytes);
+    }
+    TRACE_END(TR_SPI_POLL, 9 - tries);
+    STATS_ADD(spi.read_polls, 9 - tries);
     if (n && b == CMD_READ_DATA)
     {
-        n = spi_xfer(fd, tx_zeros, data, 2) &&
-            spi_xfer(fd, tx_zeros, data, dlen);
+        n = spi_xfer(fd, NULL, data, 2) &&
+            spi_xfer(fd, NULL, data, dlen);
+        STATS_ADD(spi.cmd_bytes, 2);
+        STATS_ADD(spi.data_bytes, dlen);
         if (verbose > 1)
             printf("Rd data %04x: %u bytes\n", addr, dlen);
     }
+    else
+        STATS_INC(spi.errors);
     return(n);
 }
 
 // Write register
 int spi_write_reg(int fd, uint32_t addr, uint32_t val)
 {
-    CMD_MSG_D *mp=(CMD_MSG_D *)txbuff;
+    CMD_MSG_D msg, *mp=&msg;
     int n=0, rxlen=sizeof(mp->zeros), txlen=sizeof(*mp)-rxlen;
-    uint8_t *rsp = &rxbuff[txlen];
+    uint8_t rxd[sizeof(CMD_MSG_D)], *rsp = &rxd[txlen];
 
     mp->cmd = CMD_SINGLE_WRITE;
     U24_DATA(mp->addr, 0, addr);
     U32_DATA(mp->data, 0, val);
     memset(mp->zeros, 0, sizeof(mp->zeros));
-    n = spi_cmd_resp(fd, (uint8_t *)mp, rxbuff, txlen, rxlen);
+    n = spi_cmd_resp(fd, (uint8_t *)mp, rxd, txlen, rxlen);
+    STATS_ADD(spi.cmd_bytes, txlen + rxlen);
     n = rsp[0]==mp->cmd && rsp[1]==0 ? n : 0;
+    if (!n)
+        STATS_INC(spi.errors);
     if (n && verbose > 1)
         printf("Wr reg %04x: %08x\n", addr, val);
     return(n);
@@ -241,24 +264,38 @@ int spi_write_reg(int fd, uint32_t addr, uint32_t val)
 // Write single data block
 int spi_write_data(int fd, uint32_t addr, uint8_t *data, int dlen)
 {
-    CMD_MSG_B *mp=(CMD_MSG_B *)txbuff;
+    uint8_t txd[sizeof(CMD_MSG_B)+2], rxd[sizeof(txd)], b;
+    CMD_MSG_B *mp=(CMD_MSG_B *)txd;
     int n, tries, txlen=sizeof(*mp);
-    uint8_t b;
 
     mp->cmd = CMD_WRITE_DATA;
     U24_DATA(mp->addr, 0, addr);
     U24_DATA(mp->count, 0, dlen);
-    txbuff[txlen] = txbuff[txlen+1] = 0;
-    rxbuff[0] = 0;
-    n = spi_cmd_resp(fd, (uint8_t *)mp, rxbuff, txlen, 2) && rxbuff[txlen]==CMD_WRITE_DATA;
-    txbuff[0] = 0xf3;
-    memcpy(&txbuff[1], data, dlen);
-    n = n && spi_cmd_resp(fd, txbuff, rxbuff, dlen+1, 0);
+    txd[txlen] = txd[txlen+1] = 0;
+    rxd[txlen] = 0;
+    n = dlen <= SPI_BUFFLEN && spi_cmd_resp(fd, txd, rxd, txlen, 2) && rxd[txlen]==CMD_WRITE_DATA;
+    if (n)
+    {
+        spi_wbuff[0] = 0xf3;
+        memcpy(&spi_wbuff[1], data, dlen);
+    }
+    n = n && spi_cmd_resp(fd, spi_wbuff, NULL, dlen+1, 0);
+    STATS_ADD(spi.cmd_bytes, txlen + 3);
+    STATS_ADD(spi.data_bytes, dlen);
     b = 0;
     tries = 10;
+    TRACE_BEGIN(TR_SPI_POLL, 1);
     while (n && b!=0xc3 && tries--)
-        n = spi_xfer(fd, tx_zeros, &b, 1);
-    n = n && spi_xfer(fd, tx_zeros, &b, 1);
+    {
+        n = spi_xfer(fd, NULL, &b, 1);
+        STATS_INC(spi.poll_bytes);
+    }
+    TRACE_END(TR_SPI_POLL, 9 - tries);
+    STATS_ADD(spi.write_polls, 9 - tries);
+    n = n && spi_xfer(fd, NULL, &b, 1);
+    STATS_INC(spi.poll_bytes);
+    if (!n)
+        STATS_INC(spi.errors);
     if (n && verbose > 1)
         printf("Wr data %04x: %u bytes\n", addr, dlen);
     return(n);
@@ -359,32 +396,51 @@ bool hif_start(int fd, uint8_t gid, uint8_t op, int dlen)
     uint8_t hif[4] = {(uint8_t)(len>>8), (uint8_t)len, op, gid};
     bool ok;
 
+    TRACE_BEGIN(TR_HIF_START, op);
     ok = spi_write_reg(fd, NMI_STATE_REG, DATA_U32(hif)) &&
          spi_write_reg(fd, RCV_CTRL_REG2, 2);
     if (ok) do {
         ok = spi_read_reg(fd, RCV_CTRL_REG2, &val) && (val&2)==0;
     } while (!ok && tries-- && usdelay(10));
+    STATS_ADD(spi.hif_waits, 100 - tries);
+    TRACE_END(TR_HIF_START, tries);
     return(ok);
 }
 
 // Send 1 or 2 HIF data blocks
 // (Send HIF hdr 4 bytes, then skip 4 bytes and send 1st data block
 //  Send optional 2nd block, with offset measured from start of 1st block)
-bool hif_put(int fd, uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset)
+static bool hif_send(int fd, uint16_t gop, uint8_t *hdr, void *dp1, int dlen1,
+                     void *dp2, int dlen2, int oset)
 {
-    uint32_t addr, a, dlen = HIF_HDR_SIZE + (dlen2 ? oset+dlen2 : dlen1);
+    uint32_t addr, a, dlen = hdr[2] | hdr[3]<<8;
     uint8_t gid = (uint8_t)(gop>>8), op=(uint8_t)gop;
-    uint8_t hdr[8] = {gid, op&0x7f, (uint8_t)dlen, (uint8_t)(dlen>>8)};
     bool ok;
+    STATS_START(t);
 
+    TRACE_BEGIN(TR_HIF_PUT, gop);
     ok = hif_start(fd, gid, op, dlen);                      // Start transfer
+    if (ok)
+        STATS_HIST(HIST_HIF_ACK, t);
     ok = ok && spi_read_reg(fd, RCV_CTRL_REG4, &addr);      // Get DMA addr
-    ok = ok && spi_write_data(fd, addr, hdr, sizeof(hdr));  // Write header
+    ok = ok && spi_write_data(fd, addr, hdr, HIF_HDR_SIZE); // Write header
     a = addr + HIF_HDR_SIZE;
     ok = ok && spi_write_data(fd, a, dp1, dlen1);           // Write 1st block (e.g. SSID)
     if (dp2 && dlen2)                                       // Write 2nd block (e.g. passphrase)
         ok = ok && spi_write_data(fd, a+oset, dp2, dlen2);
     ok = ok && spi_write_reg(fd, RCV_CTRL_REG3, addr<<2|2); // Complete transfer
+    if (ok)
+    {
+        STATS_INC(hif_tx);
+        STATS_HIF_TX(gid, op & 0x7f);
+        STATS_HIST(HIST_HIF_PUT, t);
+        if (stats_irq_start &&
+            ((gop & ~REQ_DATA) == GOP_SEND || (gop & ~REQ_DATA) == GOP_SENDTO))
+            STATS_HIST(HIST_IRQ_REPLY, stats_irq_start);
+    }
+    else
+        STATS_INC(hif_errors);
+    TRACE_END(TR_HIF_PUT, gop);
     if (verbose > 1)
     {
         printf("Send gid=%u op=%u len=%u,%u\n", gid, op, dlen1, dlen2);
@@ -395,6 +451,23 @@ bool hif_put(int fd, uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, i
     return(ok);
 }
 
+// Send HIF message
+bool hif_put(int fd, uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset)
+{
+    uint32_t dlen = HIF_HDR_SIZE + (dlen2 ? oset+dlen2 : dlen1);
+    uint8_t hdr[HIF_HDR_SIZE] = {(uint8_t)(gop>>8), (uint8_t)(gop&0x7f),
+                                 (uint8_t)dlen, (uint8_t)(dlen>>8)};
+
+    return(hif_send(fd, gop, hdr, dp1, dlen1, dp2, dlen2, oset));
+}
+
+// Send HIF message already encoded as header and command, with optional data;
+// the bus transfers are the same as hif_put()
+bool hif_put_frame(int fd, uint16_t gop, uint8_t *frame, int flen, void *data, int dlen, int oset)
+{
+    return(hif_send(fd, gop, frame, frame+HIF_HDR_SIZE, flen-HIF_HDR_SIZE, data, dlen, oset));
+}
+
 // Receive Host Interface (HIF) header
 int hif_hdr_get(int fd, uint32_t addr, HIF_HDR *hp)
 {
@@ -14,6 +14,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stddef.h>
+#include <assert.h>
+#include "winc_config.h"
+
 #ifndef MIN
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
@@ -58,8 +62,13 @@
 #define GID_HIF         3
 
 // Host Interface operations with Group ID (GID)
-#define GIDOP(gid, op) ((gid << 8) | op)
+#define GIDOP(gid, op) (((gid) << 8) | (op))
+#define GOP_SCAN_REQ        GIDOP(GID_WIFI, 16)
+#define GOP_SCAN_DONE       GIDOP(GID_WIFI, 17)
+#define GOP_SCAN_RESULT_REQ GIDOP(GID_WIFI, 18)
+#define GOP_SCAN_RESULT     GIDOP(GID_WIFI, 19)
 #define GOP_CONN_REQ_OLD    GIDOP(GID_WIFI, 40)
+#define GOP_DISCONNECT      GIDOP(GID_WIFI, 43)
 #define GOP_STATE_CHANGE    GIDOP(GID_WIFI, 44)
 #define GOP_DHCP_CONF       GIDOP(GID_WIFI, 50)
 #define GOP_CONN_REQ_NEW    GIDOP(GID_WIFI, 59)
@@ -88,8 +97,6 @@
 #define CRED_STORE      3
 #define REQ_DATA        0x80
 
-#define SPI_BUFFLEN     1600
-
 // Header and status data for incoming HIF message
 // Header is first 4 bytes, then dummy 4 bytes, then data starts
 typedef struct {
@@ -144,6 +151,68 @@ typedef struct {
     uint16_t session;
 } CLOSE_CMD;
 
+// Scan request, 4 bytes
+typedef struct {
+    uint8_t chan, x;
+    uint16_t passive_time;
+} SCAN_CMD;
+
+// Scan complete response, 4 bytes
+typedef struct {
+    uint8_t count;
+    int8_t state;
+    uint8_t x[2];
+} SCAN_DONE_MSG;
+
+// Scan result request, 4 bytes
+typedef struct {
+    uint8_t index, x[3];
+} SCAN_RESULT_CMD;
+
+// Scan result response, 44 bytes
+typedef struct {
+    uint8_t index;
+    int8_t rssi;
+    uint8_t auth, chan;
+    uint8_t bssid[6];
+    char ssid[33];
+    uint8_t x;
+} SCAN_RESULT_MSG;
+
+// Check a message layout matches the firmware, at compile time
+#define WIRE_SIZE(t, n)         static_assert(sizeof(t) == (n), #t " size")
+#define WIRE_OSET(t, f, n)      static_assert(offsetof(t, f) == (n), #t "." #f " offset")
+
+WIRE_SIZE(HIF_HDR, 4);
+WIRE_SIZE(SOCK_ADDR, 8);
+WIRE_OSET(SOCK_ADDR, port, 2);
+WIRE_OSET(SOCK_ADDR, ip, 4);
+WIRE_SIZE(BIND_CMD, 12);
+WIRE_OSET(BIND_CMD, sock, 8);
+WIRE_OSET(BIND_CMD, session, 10);
+WIRE_SIZE(LISTEN_CMD, 4);
+WIRE_OSET(LISTEN_CMD, session, 2);
+WIRE_SIZE(RECVFROM_CMD, 8);
+WIRE_OSET(RECVFROM_CMD, sock, 4);
+WIRE_OSET(RECVFROM_CMD, session, 6);
+WIRE_SIZE(RECV_CMD, 8);
+WIRE_OSET(RECV_CMD, sock, 4);
+WIRE_OSET(RECV_CMD, session, 6);
+WIRE_SIZE(SENDTO_CMD, 16);
+WIRE_OSET(SENDTO_CMD, len, 2);
+WIRE_OSET(SENDTO_CMD, saddr, 4);
+WIRE_OSET(SENDTO_CMD, session, 12);
+WIRE_SIZE(CLOSE_CMD, 4);
+WIRE_OSET(CLOSE_CMD, session, 2);
+WIRE_SIZE(SCAN_CMD, 4);
+WIRE_OSET(SCAN_CMD, passive_time, 2);
+WIRE_SIZE(SCAN_DONE_MSG, 4);
+WIRE_SIZE(SCAN_RESULT_CMD, 4);
+WIRE_SIZE(SCAN_RESULT_MSG, 44);
+WIRE_OSET(SCAN_RESULT_MSG, bssid, 4);
+WIRE_OSET(SCAN_RESULT_MSG, ssid, 10);
+static_assert(sizeof(HIF_HDR) <= HIF_HDR_SIZE, "HIF_HDR_SIZE");
+
 typedef void (* SOCK_HANDLER)(int fd, uint8_t sock, int rxlen);
 
 char *op_str(int gid, int op);
@@ -167,6 +236,7 @@ bool chip_init(int fd);
 bool chip_get_info(int fd);
 bool hif_start(int fd, uint8_t gid, uint8_t op, int dlen);
 bool hif_put(int fd, uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset);
+bool hif_put_frame(int fd, uint16_t gop, uint8_t *frame, int flen, void *data, int dlen, int oset);
 int hif_get(int fd, uint32_t addr, void *buff, int len);
 bool sock_hdr_get(int fd, uint32_t addr, SOCK_ADDR *sap);
 int hif_recv(int fd, uint32_t addr, uint8_t *gidp, uint8_t *opp, void *buff, int maxlen);
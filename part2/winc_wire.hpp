@@ -0,0 +1,114 @@
+// ATWINC1500/1510 WiFi module wire-format encoders for the Pico 2W
+//
+// Header-only encoding of HIF send frames for the C++ socket classes
+// Based on original work by Jeremy P Bentham
+//
+// A frame is the HIF header, padded to HIF_HDR_SIZE, followed by the send
+// command, packed as the module reads them. The bytes that are the same for
+// every send of a message type are set at compile time in a template frame,
+// so a send copies the template and fills in only the length, socket,
+// address and session. The field offsets are checked against the C structs
+// in winc_wifi.h, so a layout change fails the build. Frames go out through
+// put_sock_frame(), with the same bus transfers as put_sock_send().
+
+#ifndef WINC_WIRE_HPP
+#define WINC_WIRE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+extern "C" {
+#include "winc_wifi.h"
+#include "winc_sock.h"
+extern SOCKET sockets[MAX_SOCKETS];
+}
+
+namespace winc {
+namespace wire {
+
+// Field offsets in a send frame
+constexpr size_t HDR_GID     = 0;
+constexpr size_t HDR_OP      = 1;
+constexpr size_t HDR_LEN     = 2;
+constexpr size_t CMD         = HIF_HDR_SIZE;
+constexpr size_t CMD_SOCK    = CMD + 0;
+constexpr size_t CMD_LEN     = CMD + 2;
+constexpr size_t CMD_ADDR    = CMD + 4;
+constexpr size_t CMD_SESSION = CMD + 12;
+constexpr size_t SEND_FRAME  = CMD + 16;
+
+static_assert(offsetof(HIF_HDR, gid) == HDR_GID && offsetof(HIF_HDR, op) == HDR_OP &&
+              offsetof(HIF_HDR, len) == HDR_LEN, "HIF_HDR layout");
+static_assert(offsetof(SENDTO_CMD, sock) == CMD_SOCK - CMD, "SENDTO_CMD.sock offset");
+static_assert(offsetof(SENDTO_CMD, len) == CMD_LEN - CMD, "SENDTO_CMD.len offset");
+static_assert(offsetof(SENDTO_CMD, saddr) == CMD_ADDR - CMD, "SENDTO_CMD.saddr offset");
+static_assert(offsetof(SENDTO_CMD, session) == CMD_SESSION - CMD, "SENDTO_CMD.session offset");
+static_assert(sizeof(SENDTO_CMD) == SEND_FRAME - CMD, "SENDTO_CMD size");
+static_assert(sizeof(SOCK_ADDR) == CMD_SESSION - CMD_ADDR, "SOCK_ADDR size");
+
+// Store 16 bits in the module's byte order (LSbyte first)
+constexpr void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+// HIF header and send command, for a message type and data offset
+template <uint16_t Gop, int Oset>
+struct SendFrame {
+    static_assert(Oset >= (int)(SEND_FRAME - CMD), "Send data must start after the command");
+    static_assert(HIF_HDR_SIZE + Oset + SPI_BUFFLEN <= 0xffff, "HIF length is 16 bits");
+
+    static constexpr uint16_t gop = Gop;
+    static constexpr int oset = Oset;
+    uint8_t bytes[SEND_FRAME];
+
+    // Frame with only the fixed bytes set
+    static constexpr SendFrame fixed() {
+        SendFrame f{};
+        f.bytes[HDR_GID] = (uint8_t)(Gop >> 8);
+        f.bytes[HDR_OP] = (uint8_t)(Gop & 0x7f);
+        return f;
+    }
+
+    // Fill in the fields for a send of len bytes; the socket's address is
+    // already in network order, so is copied as it is
+    void set(uint8_t sock, const SOCKET &s, uint16_t len) {
+        put16(&bytes[HDR_LEN], (uint16_t)(HIF_HDR_SIZE + Oset + len));
+        bytes[CMD_SOCK] = sock;
+        put16(&bytes[CMD_LEN], len);
+        memcpy(&bytes[CMD_ADDR], &s.addr, sizeof(s.addr));
+        put16(&bytes[CMD_SESSION], s.session);
+    }
+};
+
+typedef SendFrame<GOP_SEND, TCP_DATA_OSET> TcpSendFrame;
+typedef SendFrame<GOP_SENDTO, UDP_DATA_OSET> UdpSendFrame;
+
+// Template frames, computed at compile time
+template <typename F>
+constexpr F frame_template = F::fixed();
+
+static_assert(frame_template<TcpSendFrame>.bytes[HDR_GID] == GID_IP &&
+              frame_template<UdpSendFrame>.bytes[HDR_OP] == (GOP_SENDTO & 0x7f),
+              "Template frames are constant");
+
+// Send data on a socket: TCP to its connection, UDP to its last sender
+template <bool Tcp>
+inline bool send(int fd, uint8_t sock, void *data, int len)
+{
+    typedef typename std::conditional<Tcp, TcpSendFrame, UdpSendFrame>::type F;
+    F f = frame_template<F>;
+
+    f.set(sock, sockets[sock], (uint16_t)len);
+    return put_sock_frame(fd, sock, F::gop, f.bytes, sizeof(f.bytes), data, len, F::oset);
+}
+
+} // namespace wire
+} // namespace winc
+
+#endif // WINC_WIRE_HPP
+
+// EOF